@@ -0,0 +1,88 @@
+//
+//  btree_bench.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+// Compares the persistent B+-tree against RBTree on the same workload:
+// building by repeated insert, random lookups, an in-order scan and removing
+// every key again. Usage: btree_bench [keys] [lookups]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "rbtree.h"
+#include "btree.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template<class Tree>
+void run(char const * name, std::vector<std::int64_t> const & keys, std::vector<std::int64_t> const & probes)
+{
+    Clock::time_point t0 = Clock::now();
+    Tree t;
+    for (std::int64_t k : keys){
+        t = t.insert(k, static_cast<int>(k));
+    }
+    double insert = secondsSince(t0);
+
+    t0 = Clock::now();
+    std::size_t hits = 0;
+    for (std::int64_t k : probes){
+        hits += t.member(k);
+    }
+    double lookup = secondsSince(t0);
+
+    t0 = Clock::now();
+    std::int64_t sum = 0;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        sum += it->items().front();
+    }
+    double scan = secondsSince(t0);
+
+    t0 = Clock::now();
+    for (std::int64_t k : keys){
+        t = t.remove(k);
+    }
+    double remove = secondsSince(t0);
+
+    double n = static_cast<double>(keys.size());
+    double m = static_cast<double>(probes.size());
+    std::printf("%-8s insert %7.1f ns  lookup %7.1f ns  scan %6.2f ns  remove %7.1f ns  (%zu hits, %lld)\n",
+                name, insert / n * 1e9, lookup / m * 1e9, scan / n * 1e9, remove / n * 1e9,
+                hits, static_cast<long long>(sum));
+}
+
+} // namespace
+
+int main(int argc, char const * argv[])
+{
+    std::size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::size_t m = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000000;
+
+    std::mt19937_64 rng(42);
+    std::vector<std::int64_t> keys(n);
+    for (std::int64_t & k : keys){
+        k = static_cast<std::int64_t>(rng() >> 1);
+    }
+    std::vector<std::int64_t> probes(m);
+    for (std::size_t i = 0; i < m; ++i){
+        probes[i] = i % 2 ? keys[rng() % n] : static_cast<std::int64_t>(rng() >> 1);
+    }
+
+    run<RBTree<std::int64_t, int>>("RBTree", keys, probes);
+    run<BTree<std::int64_t, int>>("BTree", keys, probes);
+    return 0;
+}
@@ -0,0 +1,582 @@
+//
+//  rbtree_bench.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+// RBTree and List operations against std::map and std::multimap, over tree
+// sizes from 1e3 up to RBTREE_BENCH_MAX_KEYS, three key distributions, a few
+// item-list lengths and both integer and string keys. Benchmarks are named
+//
+//     Operation/Structure<key>/distribution/keys/itemsPerKey
+//
+// so --benchmark_filter can pick out a slice, and
+// --benchmark_out=file --benchmark_out_format=json (or the bench_json
+// target) keeps the results for comparison between runs.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "rbtree.h"
+#include "list.h"
+#include "itemseq.h"
+#include "batch.h"
+#include "traverse.h"
+
+#ifndef RBTREE_BENCH_MAX_KEYS
+#define RBTREE_BENCH_MAX_KEYS 10000000
+#endif
+
+namespace {
+
+enum Dist
+{
+    SEQUENTIAL,
+    RANDOM,
+    ZIPF
+};
+
+char const * distName(Dist d)
+{
+    switch (d){
+        case SEQUENTIAL: return "sequential";
+        case RANDOM: return "random";
+        default: return "zipf";
+    }
+}
+
+// Zipf-distributed ranks in [0, n) with exponent theta, by the method of
+// Gray et al., "Quickly generating billion-record synthetic databases".
+class Zipf
+{
+public:
+    Zipf(std::uint64_t n, double theta)
+    : n_(n), theta_(theta), alpha_(1 / (1 - theta)), zetan_(zeta(n, theta))
+    {
+        eta_ = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan_);
+    }
+
+    template<class G>
+    std::uint64_t operator()(G & g)
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(g);
+        double uz = u * zetan_;
+        if (uz < 1)
+            return 0;
+        if (uz < 1 + std::pow(0.5, theta_))
+            return 1;
+        return std::min(n_ - 1, static_cast<std::uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_)));
+    }
+
+private:
+    static double zeta(std::uint64_t n, double theta)
+    {
+        double sum = 0;
+        for (std::uint64_t i = 1; i <= n; ++i){
+            sum += 1 / std::pow(double(i), theta);
+        }
+        return sum;
+    }
+
+    std::uint64_t n_;
+    double theta_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+};
+
+// Key number i as a key; string keys sort in the same order.
+template<class K> K makeKey(std::uint64_t i);
+
+template<>
+std::int64_t makeKey<std::int64_t>(std::uint64_t i)
+{
+    return static_cast<std::int64_t>(i);
+}
+
+template<>
+std::string makeKey<std::string>(std::uint64_t i)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "key-%012llu", static_cast<unsigned long long>(i));
+    return buf;
+}
+
+char const * keyName(std::int64_t const *) { return "int64"; }
+char const * keyName(std::string const *) { return "string"; }
+
+// The keys of an n-key workload in the order they are inserted. Zipf draws
+// repeat, so fewer than n distinct keys are inserted, the hot ones many times.
+template<class K>
+std::vector<K> insertOrder(Dist d, std::uint64_t n)
+{
+    std::vector<std::uint64_t> ix(n);
+    std::mt19937_64 g(42);
+    if (d == ZIPF){
+        Zipf z(n, 0.99);
+        for (std::uint64_t & i : ix){
+            i = z(g);
+        }
+    } else {
+        for (std::uint64_t i = 0; i < n; ++i){
+            ix[i] = i;
+        }
+        if (d == RANDOM)
+            std::shuffle(ix.begin(), ix.end(), g);
+    }
+    std::vector<K> keys;
+    keys.reserve(n);
+    for (std::uint64_t i : ix){
+        keys.push_back(makeKey<K>(i));
+    }
+    return keys;
+}
+
+const std::size_t kProbes = 1 << 16;
+
+// Keys looked up, drawn from the same distribution as the inserts.
+template<class K>
+std::vector<K> probes(Dist d, std::uint64_t n)
+{
+    std::vector<K> keys;
+    keys.reserve(kProbes);
+    std::mt19937_64 g(7);
+    Zipf z(d == ZIPF ? n : 2, 0.99);
+    for (std::size_t i = 0; i < kProbes; ++i){
+        std::uint64_t k = d == SEQUENTIAL ? i % n : d == RANDOM ? g() % n : z(g);
+        keys.push_back(makeKey<K>(k));
+    }
+    return keys;
+}
+
+// The three structures behind a common face. std::map keeps one item per
+// key, so it is only run with one item per key.
+template<class K>
+struct PersistentTree
+{
+    static char const * name() { return "RBTree"; }
+    void insert(K const & k, int item) { t_ = t_.insert(k, item); }
+    void remove(K const & k) { t_ = t_.remove(k); }
+    bool member(K const & k) const { return t_.member(k); }
+    std::size_t getItems(K const & k) const { return t_.getItems(k).size(); }
+    bool next(K const & k) const { return !t_.getNodeJustGreaterThan(k).items().isEmpty(); }
+    RBTree<K, int> t_;
+};
+
+template<class K>
+struct Map
+{
+    static char const * name() { return "std::map"; }
+    void insert(K const & k, int item) { m_[k] = item; }
+    void remove(K const & k) { m_.erase(k); }
+    bool member(K const & k) const { return m_.find(k) != m_.end(); }
+    std::size_t getItems(K const & k) const { return m_.count(k); }
+    bool next(K const & k) const { return m_.upper_bound(k) != m_.end(); }
+    std::map<K, int> m_;
+};
+
+template<class K>
+struct Multimap
+{
+    static char const * name() { return "std::multimap"; }
+    void insert(K const & k, int item) { m_.emplace(k, item); }
+    void remove(K const & k) { m_.erase(k); }
+    bool member(K const & k) const { return m_.find(k) != m_.end(); }
+    std::size_t getItems(K const & k) const
+    {
+        auto r = m_.equal_range(k);
+        return std::distance(r.first, r.second);
+    }
+    bool next(K const & k) const { return m_.upper_bound(k) != m_.end(); }
+    std::multimap<K, int> m_;
+};
+
+template<class S, class K>
+void fill(S & s, std::vector<K> const & keys, int items)
+{
+    for (int j = 0; j < items; ++j){
+        for (K const & k : keys){
+            s.insert(k, j);
+        }
+    }
+}
+
+// The structure for the last workload asked for, kept between the repeated
+// calls the library makes while it settles on an iteration count.
+template<class S, class K>
+S const & built(Dist d, std::uint64_t n, int items)
+{
+    static std::unique_ptr<S> s;
+    static std::tuple<Dist, std::uint64_t, int> key;
+    if (!s || key != std::make_tuple(d, n, items)){
+        s.reset();
+        s.reset(new S());
+        fill(*s, insertOrder<K>(d, n), items);
+        key = std::make_tuple(d, n, items);
+    }
+    return *s;
+}
+
+template<class S, class K>
+void insertBench(benchmark::State & state, Dist d)
+{
+    std::vector<K> keys = insertOrder<K>(d, state.range(0));
+    int items = static_cast<int>(state.range(1));
+    for (auto _ : state){
+        S s;
+        fill(s, keys, items);
+        benchmark::DoNotOptimize(&s);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size() * items);
+}
+
+template<class S, class K>
+void removeBench(benchmark::State & state, Dist d)
+{
+    std::vector<K> keys = insertOrder<K>(d, state.range(0));
+    int items = static_cast<int>(state.range(1));
+    for (auto _ : state){
+        state.PauseTiming();
+        std::unique_ptr<S> s(new S());
+        fill(*s, keys, items);
+        state.ResumeTiming();
+        for (K const & k : keys){
+            s->remove(k);
+        }
+        benchmark::DoNotOptimize(s.get());
+        state.PauseTiming();
+        s.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+enum Lookup
+{
+    MEMBER,
+    GET_ITEMS,
+    NEXT
+};
+
+template<class S, class K>
+void lookupBench(benchmark::State & state, Dist d, Lookup op)
+{
+    std::uint64_t n = state.range(0);
+    S const & s = built<S, K>(d, n, static_cast<int>(state.range(1)));
+    std::vector<K> ks = probes<K>(d, n);
+    std::size_t i = 0, found = 0;
+    for (auto _ : state){
+        K const & k = ks[i++ & (kProbes - 1)];
+        switch (op){
+            case MEMBER: found += s.member(k); break;
+            case GET_ITEMS: found += s.getItems(k); break;
+            default: found += s.next(k);
+        }
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<class S, class K>
+void registerStructure(bool multiItems)
+{
+    static const Dist dists[] = { SEQUENTIAL, RANDOM, ZIPF };
+    static const struct { char const * name; Lookup op; } lookups[] = {
+        { "Member", MEMBER }, { "GetItems", GET_ITEMS }, { "GetNodeJustGreaterThan", NEXT }
+    };
+    std::vector<std::pair<std::int64_t, std::int64_t>> args;
+    for (std::int64_t n = 1000; n <= RBTREE_BENCH_MAX_KEYS; n *= 10){
+        args.push_back(std::make_pair(n, 1));
+    }
+    if (multiItems){
+        for (std::int64_t n : { 1000, 100000 }){
+            if (n <= RBTREE_BENCH_MAX_KEYS){
+                args.push_back(std::make_pair(n, 4));
+                args.push_back(std::make_pair(n, 16));
+            }
+        }
+    }
+    for (Dist d : dists){
+        std::string suffix = std::string(S::name()) + "<" + keyName(static_cast<K const *>(nullptr)) + ">/"
+                             + distName(d);
+        std::vector<benchmark::internal::Benchmark *> bs;
+        bs.push_back(benchmark::RegisterBenchmark(("Insert/" + suffix).c_str(), insertBench<S, K>, d));
+        bs.push_back(benchmark::RegisterBenchmark(("Remove/" + suffix).c_str(), removeBench<S, K>, d));
+        for (auto const & l : lookups){
+            bs.push_back(benchmark::RegisterBenchmark((std::string(l.name) + "/" + suffix).c_str(),
+                                                      lookupBench<S, K>, d, l.op));
+        }
+        for (benchmark::internal::Benchmark * b : bs){
+            b->ArgNames({ "keys", "items" });
+            for (auto const & a : args){
+                b->Args({ a.first, a.second });
+            }
+        }
+        // Insert and remove time whole builds and teardowns.
+        bs[0]->Unit(benchmark::kMillisecond);
+        bs[1]->Unit(benchmark::kMillisecond);
+    }
+}
+
+// Batched lookups on RBTree, against member() and getItems() one at a time
+// in the benchmarks above.
+const std::size_t kBatch = 1024;
+
+template<class K>
+void batchBench(benchmark::State & state, Dist d, Lookup op)
+{
+    std::uint64_t n = state.range(0);
+    RBTree<K, int> const & t = built<PersistentTree<K>, K>(d, n, static_cast<int>(state.range(1))).t_;
+    std::vector<K> ks = probes<K>(d, n);
+    std::vector<bool> in(kBatch);
+    std::vector<typename RBTree<K, int>::ItemList> items(kBatch);
+    std::size_t at = 0;
+    for (auto _ : state){
+        auto first = ks.begin() + at;
+        if (op == MEMBER){
+            t.memberBatch(first, first + kBatch, in.begin());
+        } else {
+            t.getItemsBatch(first, first + kBatch, items.begin());
+        }
+        benchmark::ClobberMemory();
+        at = (at + kBatch) & (kProbes - 1);
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+template<class K>
+void registerBatches()
+{
+    static const Dist dists[] = { SEQUENTIAL, RANDOM, ZIPF };
+    for (Dist d : dists){
+        std::string suffix = std::string("RBTree<") + keyName(static_cast<K const *>(nullptr)) + ">/" + distName(d);
+        benchmark::internal::Benchmark * bs[] = {
+            benchmark::RegisterBenchmark(("MemberBatch/" + suffix).c_str(), batchBench<K>, d, MEMBER),
+            benchmark::RegisterBenchmark(("GetItemsBatch/" + suffix).c_str(), batchBench<K>, d, GET_ITEMS),
+        };
+        for (benchmark::internal::Benchmark * b : bs){
+            b->ArgNames({ "keys", "items" });
+            for (std::int64_t n = 1000; n <= RBTREE_BENCH_MAX_KEYS; n *= 10){
+                b->Args({ n, 1 });
+            }
+        }
+    }
+}
+
+// A sorted batch of updates to a tree of random keys, applied one at a time
+// or with insertBatch and removeBatch. keys is the tree size, batch the
+// number of updates.
+void batchUpdateBench(benchmark::State & state, bool batched, bool removing)
+{
+    std::uint64_t n = state.range(0);
+    std::size_t k = state.range(1);
+    RBTree<std::int64_t, int> const & t = built<PersistentTree<std::int64_t>, std::int64_t>(RANDOM, n, 1).t_;
+    std::mt19937_64 g(3);
+    std::vector<std::pair<std::int64_t, int>> updates;
+    for (std::size_t i = 0; i < k; ++i){
+        updates.push_back(std::make_pair(static_cast<std::int64_t>(g() % (2 * n)), static_cast<int>(i)));
+    }
+    std::sort(updates.begin(), updates.end());
+    for (auto _ : state){
+        RBTree<std::int64_t, int> r = t;
+        if (batched){
+            r = removing ? removeBatch(t, updates.begin(), updates.end())
+                         : insertBatch(t, updates.begin(), updates.end());
+        } else {
+            for (auto const & u : updates){
+                r = removing ? r.remove(u.first, u.second) : r.insert(u.first, u.second);
+            }
+        }
+        benchmark::DoNotOptimize(r.id());
+    }
+    state.SetItemsProcessed(state.iterations() * k);
+}
+
+void registerBatchUpdates()
+{
+    static const struct { char const * name; bool batched; bool removing; } kinds[] = {
+        { "InsertSorted/RBTree<int64>", false, false },
+        { "InsertBatch/RBTree<int64>", true, false },
+        { "RemoveSorted/RBTree<int64>", false, true },
+        { "RemoveBatch/RBTree<int64>", true, true },
+    };
+    for (auto const & k : kinds){
+        benchmark::internal::Benchmark * b =
+            benchmark::RegisterBenchmark(k.name, batchUpdateBench, k.batched, k.removing);
+        b->ArgNames({ "keys", "batch" });
+        for (std::int64_t n = 1000; n <= RBTREE_BENCH_MAX_KEYS; n *= 10){
+            for (std::int64_t batch : { 64, 4096, 65536 }){
+                b->Args({ n, batch });
+            }
+        }
+    }
+}
+
+// Whole-tree folds: an in-order walk with iterators, parallelReduce, and
+// mapValues rebuilding the tree.
+enum Whole
+{
+    ITERATE,
+    REDUCE,
+    MAP_VALUES
+};
+
+void wholeTreeBench(benchmark::State & state, Whole op)
+{
+    std::uint64_t n = state.range(0);
+    RBTree<std::int64_t, int> const & t = built<PersistentTree<std::int64_t>, std::int64_t>(RANDOM, n, 1).t_;
+    for (auto _ : state){
+        if (op == ITERATE){
+            long sum = 0;
+            for (auto it = t.begin(); it != t.end(); ++it){
+                sum += it->items().front();
+            }
+            benchmark::DoNotOptimize(sum);
+        } else if (op == REDUCE){
+            long sum = parallelReduce(t, 0L,
+                                      [](std::int64_t, RBTree<std::int64_t, int>::ItemList const & items){
+                                          return long(items.front());
+                                      },
+                                      [](long a, long b){ return a + b; });
+            benchmark::DoNotOptimize(sum);
+        } else {
+            RBTree<std::int64_t, long> m = mapValues(t, [](int u){ return 2L * u; });
+            benchmark::DoNotOptimize(m.id());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+void registerWholeTree()
+{
+    static const struct { char const * name; Whole op; } kinds[] = {
+        { "Iterate/RBTree<int64>", ITERATE },
+        { "ParallelReduce/RBTree<int64>", REDUCE },
+        { "MapValues/RBTree<int64>", MAP_VALUES },
+    };
+    for (auto const & k : kinds){
+        benchmark::internal::Benchmark * b = benchmark::RegisterBenchmark(k.name, wholeTreeBench, k.op);
+        b->ArgName("keys")->Unit(benchmark::kMillisecond)->UseRealTime();
+        for (std::int64_t n = 1000; n <= RBTREE_BENCH_MAX_KEYS; n *= 10){
+            b->Arg(n);
+        }
+    }
+}
+
+// Item lists on their own: building one by push_front, removing from the
+// middle, and folding over it.
+typedef List<int> IntList;
+typedef ItemSeq<int> IntSeq;
+
+template<class L>
+L makeList(std::int64_t n)
+{
+    L l;
+    for (std::int64_t i = 0; i < n; ++i){
+        l = l.push_front(static_cast<int>(i));
+    }
+    return l;
+}
+
+template<class L>
+void listPushFront(benchmark::State & state)
+{
+    for (auto _ : state){
+        L l = makeList<L>(state.range(0));
+        benchmark::DoNotOptimize(&l);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<class L>
+void listRemove(benchmark::State & state)
+{
+    L l = makeList<L>(state.range(0));
+    int middle = static_cast<int>(state.range(0) / 2);
+    for (auto _ : state){
+        L r = l.remove(middle);
+        benchmark::DoNotOptimize(&r);
+    }
+}
+
+void listInsertAt(benchmark::State & state)
+{
+    IntList l = makeList<IntList>(state.range(0));
+    int middle = static_cast<int>(state.range(0) / 2);
+    for (auto _ : state){
+        IntList r = l.insertAt(middle, -1);
+        benchmark::DoNotOptimize(&r);
+    }
+}
+
+void listFold(benchmark::State & state)
+{
+    IntList l = makeList<IntList>(state.range(0));
+    for (auto _ : state){
+        benchmark::DoNotOptimize(foldl([](long acc, int x){ return acc + x; }, 0L, l));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void seqIterate(benchmark::State & state)
+{
+    IntSeq s = makeList<IntSeq>(state.range(0));
+    for (auto _ : state){
+        long sum = 0;
+        for (int x : s){
+            sum += x;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void registerLists()
+{
+    std::vector<benchmark::internal::Benchmark *> bs = {
+        benchmark::RegisterBenchmark("ListPushFront/List", listPushFront<IntList>),
+        benchmark::RegisterBenchmark("ListPushFront/ItemSeq", listPushFront<IntSeq>),
+        benchmark::RegisterBenchmark("ListRemove/List", listRemove<IntList>),
+        benchmark::RegisterBenchmark("ListRemove/ItemSeq", listRemove<IntSeq>),
+        benchmark::RegisterBenchmark("ListInsertAt/List", listInsertAt),
+        benchmark::RegisterBenchmark("ListFold/List", listFold),
+        benchmark::RegisterBenchmark("ListIterate/ItemSeq", seqIterate),
+    };
+    for (benchmark::internal::Benchmark * b : bs){
+        b->ArgName("items")->Arg(4)->Arg(64)->Arg(1024);
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    registerStructure<PersistentTree<std::int64_t>, std::int64_t>(true);
+    registerStructure<Map<std::int64_t>, std::int64_t>(false);
+    registerStructure<Multimap<std::int64_t>, std::int64_t>(true);
+    registerStructure<PersistentTree<std::string>, std::string>(true);
+    registerStructure<Map<std::string>, std::string>(false);
+    registerStructure<Multimap<std::string>, std::string>(true);
+    registerBatches<std::int64_t>();
+    registerBatches<std::string>();
+    registerBatchUpdates();
+    registerWholeTree();
+    registerLists();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
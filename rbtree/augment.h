@@ -0,0 +1,139 @@
+//
+//  augment.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__augment__
+#define __rbtree__augment__
+
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+
+#include "list.h"
+
+// Subtree summaries stored in each node, recomputed from the children
+// whenever a node is built or changed in place.
+template<bool Enabled>
+struct OrderStats
+{
+    template<class N>
+    void count(N const *, N const *, std::size_t) {}
+};
+
+template<>
+struct OrderStats<true>
+{
+    template<class N>
+    void count(N const * lft, N const * rgt, std::size_t items)
+    {
+        itemCount_ = items;
+        size_ = 1 + (lft ? lft->size_ : 0) + (rgt ? rgt->size_ : 0);
+        totalItems_ = items + (lft ? lft->totalItems_ : 0) + (rgt ? rgt->totalItems_ : 0);
+    }
+    
+    std::size_t size_;       // keys in this subtree
+    std::size_t itemCount_;  // items under this key
+    std::size_t totalItems_; // items in this subtree
+};
+
+
+// A monoid over items, for aggregates cached in each node. It provides
+//
+//     typedef ... value_type;
+//     static value_type identity();
+//     static value_type combine(value_type const & a, value_type const & b);
+//     template<class I> static value_type measure(I const & item);
+//
+// combine must be associative; it need not be commutative, as values are
+// always combined in key order (and list order within a key).
+struct NoMonoid {};
+
+template<class V>
+struct SumMonoid
+{
+    typedef V value_type;
+    static V identity() { return V(); }
+    static V combine(V const & a, V const & b) { return a + b; }
+    template<class I> static V measure(I const & item) { return V(item); }
+};
+
+template<class V>
+struct MinMonoid
+{
+    typedef V value_type;
+    // Infinity where V has one, so that an item of infinity is no smaller
+    // than the empty aggregate.
+    static V identity()
+    {
+        return std::numeric_limits<V>::has_infinity ? std::numeric_limits<V>::infinity()
+                                                    : std::numeric_limits<V>::max();
+    }
+    static V combine(V const & a, V const & b) { return std::min(a, b); }
+    template<class I> static V measure(I const & item) { return V(item); }
+};
+
+template<class V>
+struct MaxMonoid
+{
+    typedef V value_type;
+    static V identity()
+    {
+        return std::numeric_limits<V>::has_infinity ? -std::numeric_limits<V>::infinity()
+                                                    : std::numeric_limits<V>::lowest();
+    }
+    static V combine(V const & a, V const & b) { return std::max(a, b); }
+    template<class I> static V measure(I const & item) { return V(item); }
+};
+
+// Keeps the monoid value of a node's own items (self_) and of its whole
+// subtree (total_). Only a node whose items an update changed is reduced
+// over them; nodes copied to be recoloured or rotated, or to take new
+// children, keep their source's self_. So an update costs the length of the
+// copied path plus the items under the one key it changed.
+template<class M>
+struct MonoidSummary
+{
+    typedef typename M::value_type value_type;
+    
+    template<class N, class L>
+    void reduce(N const * lft, N const * rgt, L const & items)
+    {
+        self_ = foldl([](value_type acc, typename L::value_type const & item){
+                          return M::combine(acc, M::measure(item));
+                      }, M::identity(), items);
+        total_ = M::combine(M::combine(totalOf(lft), self_), totalOf(rgt));
+    }
+    
+    template<class N>
+    void reuse(N const * src, N const * lft, N const * rgt)
+    {
+        self_ = src->self_;
+        total_ = M::combine(M::combine(totalOf(lft), self_), totalOf(rgt));
+    }
+    
+    template<class N>
+    static value_type totalOf(N const * n)
+    {
+        return n ? n->total_ : M::identity();
+    }
+    
+    value_type self_;
+    value_type total_;
+};
+
+template<>
+struct MonoidSummary<NoMonoid>
+{
+    typedef void value_type;
+    
+    template<class N, class L>
+    void reduce(N const *, N const *, L const &) {}
+    
+    template<class N>
+    void reuse(N const *, N const *, N const *) {}
+};
+
+#endif /* defined(__rbtree__augment__) */
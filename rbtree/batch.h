@@ -0,0 +1,186 @@
+//
+//  batch.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__batch__
+#define __rbtree__batch__
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rbtree.h"
+#include "setops.h"
+#include "parallel.h"
+
+// Sorted batches of updates applied in one pass. The batch is split at each
+// node's key on the way down and the node is rebuilt once, by a join of its
+// two updated sides, on the way up; subtrees no update falls in are kept as
+// they are. Applying k updates to a tree of n keys costs O(k log(n/k + 1))
+// rather than k separate O(log n) path copies, and the two sides of a large
+// enough batch are updated in parallel, as the set operations are.
+
+namespace batch {
+
+// Batches shorter than this are not worth handing to another thread.
+const std::size_t kForkRun = 1 << 12;
+
+template<class A, class B>
+A const & keyOf(std::pair<A, B> const & p)
+{
+    return p.first;
+}
+
+template<class X>
+X const & keyOf(X const & x)
+{
+    return x;
+}
+
+template<class It>
+bool sortedByKey(It first, It last)
+{
+    return std::is_sorted(first, last, [](auto const & a, auto const & b){ return keyOf(a) < keyOf(b); });
+}
+
+// The run [lo, hi) split around key k: [lo, a) below it, [a, b) at it and
+// [b, hi) above it.
+template<class It, class T>
+std::pair<It, It> around(It lo, It hi, T const & k)
+{
+    It a = std::lower_bound(lo, hi, k, [](auto const & e, T const & x){ return keyOf(e) < x; });
+    It b = std::upper_bound(a, hi, k, [](T const & x, auto const & e){ return x < keyOf(e); });
+    return std::make_pair(a, b);
+}
+
+// A tree of just the (key, item) pairs of a run, items of a repeated key in
+// the order repeated inserts would leave them.
+template<class Tree, class It>
+Tree fromRun(It lo, It hi)
+{
+    typedef typename Tree::ItemList ItemList;
+    typedef typename std::decay<decltype(lo->first)>::type T;
+    std::vector<std::pair<T, ItemList>> keys;
+    for (It i = lo; i != hi; ++i){
+        if (keys.empty() || keys.back().first < i->first){
+            keys.push_back(std::make_pair(i->first, ItemList()));
+        }
+        keys.back().second = keys.back().second.push_front(i->second);
+    }
+    return Tree::fromSorted(keys.begin(), keys.end());
+}
+
+using setops::Sized;
+using setops::measured;
+using setops::child;
+
+// t's entry, or e in its place, between updated sides. When the sides kept
+// their heights and no red-red pair is made, that is t's node with new
+// children; otherwise it is a join.
+template<class Tree, class E>
+Sized<Tree> rejoin(Sized<Tree> const & t, Sized<Tree> const & l, E const & e, Sized<Tree> const & r)
+{
+    using namespace setops;
+    Color c = t.t.rootColor();
+    int below = t.h - (c == BLACK ? 1 : 0);
+    if (l.h == below && r.h == below && (c == BLACK || (!isRed(l.t) && !isRed(r.t))))
+        return Sized<Tree>{ node(c, l.t, e, r.t), t.h };
+    return joinSized(l, e, r);
+}
+
+template<class Tree, class It>
+Sized<Tree> insert(Sized<Tree> const & t, It lo, It hi, int forks)
+{
+    if (lo == hi)
+        return t;
+    if (t.t.isEmpty())
+        return measured(fromRun<Tree>(lo, hi));
+    std::pair<It, It> at = around(lo, hi, t.t.value());
+    Sized<Tree> l = child(t, t.t.left()), r = child(t, t.t.right());
+    setops::maybeFork(std::size_t(hi - lo) >= kForkRun ? forks : 0,
+                      [&]{ l = insert(l, lo, at.first, forks - 1); },
+                      [&]{ r = insert(r, at.second, hi, forks - 1); });
+    if (at.first == at.second)
+        return rejoin(t, l, t.t.view(), r);
+    typename Tree::ItemList items = t.t.items();
+    for (It i = at.first; i != at.second; ++i){
+        items = items.push_front(i->second);
+    }
+    return rejoin(t, l, setops::fresh(t.t.value(), items), r);
+}
+
+// Entries of the run are keys, each removed with all its items, or (key,
+// item) pairs, each removing one item.
+template<class Tree, class It>
+Sized<Tree> remove(Sized<Tree> const & t, It lo, It hi, int forks)
+{
+    if (lo == hi || t.t.isEmpty())
+        return t;
+    std::pair<It, It> at = around(lo, hi, t.t.value());
+    Sized<Tree> l = child(t, t.t.left()), r = child(t, t.t.right());
+    setops::maybeFork(std::size_t(hi - lo) >= kForkRun ? forks : 0,
+                      [&]{ l = remove(l, lo, at.first, forks - 1); },
+                      [&]{ r = remove(r, at.second, hi, forks - 1); });
+    bool same = l.t.id() == t.t.left().id() && r.t.id() == t.t.right().id();
+    typename Tree::ItemList items;
+    if (at.first == at.second){
+        if (same)
+            return t;
+        return rejoin(t, l, t.t.view(), r);
+    } else if constexpr (!std::is_same<typename std::decay<decltype(keyOf(*lo))>::type,
+                                       typename std::decay<decltype(*lo)>::type>::value){
+        items = t.t.items();
+        for (It i = at.first; i != at.second; ++i){
+            items = items.remove(i->second);
+        }
+        if (items.size() == t.t.items().size())
+            return same ? t : rejoin(t, l, t.t.view(), r);
+    }
+    if (items.isEmpty())
+        return setops::join2(l, r);
+    return rejoin(t, l, setops::fresh(t.t.value(), items), r);
+}
+
+template<class It>
+using RandomAccess = std::is_base_of<std::random_access_iterator_tag,
+                                     typename std::iterator_traits<It>::iterator_category>;
+
+} // namespace batch
+
+// t with the (key, item) pairs of [first, last) inserted, as by inserting
+// them one by one. The pairs must be sorted by key; a key may repeat.
+template<class T, class U, class P, class It>
+RBTree<T, U, P> insertBatch(RBTree<T, U, P> const & t, It first, It last)
+{
+    if constexpr (!batch::RandomAccess<It>::value){
+        std::vector<typename std::iterator_traits<It>::value_type> v(first, last);
+        return insertBatch(t, v.begin(), v.end());
+    } else {
+        assert(batch::sortedByKey(first, last));
+        return setops::blacken(batch::insert(batch::measured(t), first, last, forkDepth()).t);
+    }
+}
+
+// t less the entries of [first, last), sorted by key: keys, removed with all
+// their items, or (key, item) pairs, each removing one item and the key with
+// its last. Entries not in t are ignored.
+template<class T, class U, class P, class It>
+RBTree<T, U, P> removeBatch(RBTree<T, U, P> const & t, It first, It last)
+{
+    if constexpr (!batch::RandomAccess<It>::value){
+        std::vector<typename std::iterator_traits<It>::value_type> v(first, last);
+        return removeBatch(t, v.begin(), v.end());
+    } else {
+        assert(batch::sortedByKey(first, last));
+        return setops::blacken(batch::remove(batch::measured(t), first, last, forkDepth()).t);
+    }
+}
+
+#endif /* defined(__rbtree__batch__) */
@@ -0,0 +1,822 @@
+//
+//  btree.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__btree__
+#define __rbtree__btree__
+
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "rbtree.h"
+#include "search.h"
+
+// Persistent B+-tree with RBTree's interface for updates, lookups and
+// iteration. Keys sit side by
+// side in wide nodes, Policy::btreeNodeBytes worth at a time, so a lookup
+// touches a handful of contiguous blocks instead of one node per level of a
+// binary tree, and arithmetic keys are searched without branching (see
+// search.h). All entries live in the leaves; inner nodes hold separator
+// keys only. Updates copy the nodes on the path from the root, a whole node
+// at a time, and share everything else with the old version.
+//
+// Order statistics and monoids are not kept, so there is no size(),
+// totalItems(), rank(), select() or aggregate(), and a policy asking for
+// either is refused at compile time. The policy's allocator, reference
+// count and inline item count are used as for RBTree. A node is
+// bigger than the largest block the pool hands out (pool::kMaxBlock): a
+// leaf holds its items next to its keys, so even with small keys it comes
+// to a kilobyte or more. PoolAllocator passes such requests straight to
+// ::operator new, so with the default policy BTree nodes come from the
+// system heap and do not show in poolStats(); only the chunks of long item
+// lists come from the pool. Shrinking btreeNodeBytes far enough to bring
+// nodes under the pool's limit would leave a handful of keys per node and
+// lose what the layout is for.
+template<class T, class U, class Policy = DefaultPolicy>
+class BTree
+{
+    static_assert(!Policy::orderStatistics, "BTree keeps no order statistics");
+    static_assert(std::is_same<typename Policy::monoid, NoMonoid>::value, "BTree keeps no monoid");
+
+public:
+    typedef typename RBTree<T, U, Policy>::ItemList ItemList;
+    typedef typename RBTree<T, U, Policy>::Contents Contents;
+
+private:
+    static const std::size_t kKeys = Policy::btreeNodeBytes / sizeof(T) < 4 ? 4
+                                   : Policy::btreeNodeBytes / sizeof(T);
+    // Every node but the root keeps at least this many keys.
+    static const std::size_t kMin = kKeys / 2;
+    // Fan-out is at least two, so this covers any tree that fits in memory.
+    static const int kMaxDepth = 8 * sizeof(std::size_t);
+
+    struct Node;
+    struct Leaf;
+    struct Inner;
+    typedef IntrusivePtr<const Node> NodePtr;
+    typedef typename Policy::template allocator<Leaf> LeafAlloc;
+    typedef typename Policy::template allocator<Inner> InnerAlloc;
+
+    struct Node
+    {
+        explicit Node(bool leaf) : n_(0), leaf_(leaf) {}
+
+        T * keys() { return reinterpret_cast<T *>(keys_); }
+        T const * keys() const { return reinterpret_cast<T const *>(keys_); }
+
+        static void destroy(Node const * n)
+        {
+            if (n->leaf_){
+                LeafAlloc alloc;
+                Leaf * p = static_cast<Leaf *>(const_cast<Node *>(n));
+                std::allocator_traits<LeafAlloc>::destroy(alloc, p);
+                std::allocator_traits<LeafAlloc>::deallocate(alloc, p, 1);
+            } else {
+                InnerAlloc alloc;
+                Inner * p = static_cast<Inner *>(const_cast<Node *>(n));
+                std::allocator_traits<InnerAlloc>::destroy(alloc, p);
+                std::allocator_traits<InnerAlloc>::deallocate(alloc, p, 1);
+            }
+        }
+
+        typename Policy::refcount refs_;
+        std::size_t n_;    // keys held
+        bool leaf_;
+        alignas(T) unsigned char keys_[kKeys * sizeof(T)];
+    };
+
+    // n_ keys, each with its items.
+    struct Leaf : Node
+    {
+        Leaf() : Node(true) {}
+
+        ~Leaf()
+        {
+            for (std::size_t i = 0; i < this->n_; ++i){
+                this->keys()[i].~T();
+                items()[i].~ItemList();
+            }
+        }
+
+        ItemList * items() { return reinterpret_cast<ItemList *>(items_); }
+        ItemList const * items() const { return reinterpret_cast<ItemList const *>(items_); }
+
+        template<class K, class L>
+        void add(K && key, L && items)
+        {
+            assert(this->n_ < kKeys);
+            new (this->keys() + this->n_) T(std::forward<K>(key));
+            try {
+                new (this->items() + this->n_) ItemList(std::forward<L>(items));
+            } catch (...) {
+                this->keys()[this->n_].~T();
+                throw;
+            }
+            ++this->n_;
+        }
+
+        void add(Leaf const * from, std::size_t first, std::size_t last)
+        {
+            for (; first < last; ++first){
+                add(from->keys()[first], from->items()[first]);
+            }
+        }
+
+        alignas(ItemList) unsigned char items_[kKeys * sizeof(ItemList)];
+    };
+
+    // n_ separator keys and n_ + 1 children. Child i holds the keys from
+    // separator i - 1 inclusive up to separator i exclusive.
+    struct Inner : Node
+    {
+        Inner() : Node(false) {}
+
+        ~Inner()
+        {
+            for (std::size_t i = 0; i < this->n_; ++i){
+                this->keys()[i].~T();
+            }
+        }
+
+        void add(T const & sep)
+        {
+            assert(this->n_ < kKeys);
+            new (this->keys() + this->n_) T(sep);
+            ++this->n_;
+        }
+
+        NodePtr kids_[kKeys + 1];
+    };
+
+    static Leaf * newLeaf(NodePtr & hold)
+    {
+        LeafAlloc alloc;
+        Leaf * l = std::allocator_traits<LeafAlloc>::allocate(alloc, 1);
+        new (l) Leaf();
+        hold = NodePtr(l);
+        return l;
+    }
+
+    static Inner * newInner(NodePtr & hold)
+    {
+        InnerAlloc alloc;
+        Inner * n = std::allocator_traits<InnerAlloc>::allocate(alloc, 1);
+        new (n) Inner();
+        hold = NodePtr(n);
+        return n;
+    }
+
+    static Leaf const * leaf(Node const * n)
+    {
+        assert(n->leaf_);
+        return static_cast<Leaf const *>(n);
+    }
+
+    static Inner const * inner(Node const * n)
+    {
+        assert(!n->leaf_);
+        return static_cast<Inner const *>(n);
+    }
+
+    // Index of the first key in n not less than x.
+    static std::size_t lowerBound(Node const * n, T const & x)
+    {
+        return search::rank<false>(n->keys(), n->n_, x);
+    }
+
+    // Index of the first key in n greater than x; in an inner node, the
+    // child to descend into for x.
+    static std::size_t upperBound(Node const * n, T const & x)
+    {
+        return search::rank<true>(n->keys(), n->n_, x);
+    }
+
+    explicit BTree(NodePtr const & root) : root_(root) {}
+
+public:
+    BTree() {} // empty tree
+
+    BTree(std::initializer_list<std::pair<T, U>> init)
+    {
+        BTree t;
+        for (auto const & v : init){
+            t = t.insert(v.first, v.second);
+        }
+        root_ = t.root_;
+    }
+
+    bool isEmpty() const
+    {
+        return !root_;
+    }
+
+    BTree insert(T const & x, U const & item) const
+    {
+        return emplace(x, item);
+    }
+
+    BTree insert(T && x, U && item) const
+    {
+        return emplace(std::move(x), std::move(item));
+    }
+
+    // Adds an item built in place from args under key x.
+    template<class... Args>
+    BTree emplace(T const & x, Args &&... args) const
+    {
+        return put(x, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    BTree emplace(T && x, Args &&... args) const
+    {
+        return put(std::move(x), std::forward<Args>(args)...);
+    }
+
+    // Both removes leave the tree as it is if there is nothing to remove.
+    BTree remove(T const & x) const
+    {
+        return checked(rem(x, nullptr));
+    }
+
+    BTree remove(T const & x, U const & item) const
+    {
+        return checked(rem(x, &item));
+    }
+
+    bool member(T const & x) const
+    {
+        std::size_t i;
+        return find(x, i) != nullptr;
+    }
+
+    ItemList getItems(T const & x) const
+    {
+        std::size_t i;
+        Leaf const * l = find(x, i);
+        return l ? l->items()[i] : ItemList();
+    }
+
+    // An entry of the tree, as seen through an iterator.
+    class Entry
+    {
+    public:
+        T const & value() const
+        {
+            return l_->keys()[i_];
+        }
+
+        ItemList const & items() const
+        {
+            return l_->items()[i_];
+        }
+
+    private:
+        friend class BTree;
+        Entry(Leaf const * l, std::size_t i) : l_(l), i_(i) {}
+        Leaf const * l_;
+        std::size_t i_;
+    };
+
+    // In-order iteration over entries, keeping the path down to the current
+    // leaf on a fixed stack. Valid only while the tree is alive. Entries are
+    // handed out by value, as RBTree hands out Views, so that adaptors such
+    // as std::reverse_iterator may dereference a temporary copy.
+    class const_iterator
+    {
+    public:
+        // What operator-> returns: an Entry to call through.
+        struct Arrow
+        {
+            Entry e_;
+            Entry const * operator->() const { return &e_; }
+        };
+
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef Entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Arrow pointer;
+        typedef Entry reference;
+
+        const_iterator() : root_(nullptr), depth_(0), cur_(nullptr, 0) {}
+
+        const_iterator(const_iterator const & other)
+        : root_(other.root_), depth_(other.depth_), cur_(other.cur_)
+        {
+            std::copy(other.nodes_, other.nodes_ + depth_, nodes_);
+            std::copy(other.pos_, other.pos_ + depth_, pos_);
+        }
+
+        const_iterator & operator=(const_iterator const & other)
+        {
+            root_ = other.root_;
+            depth_ = other.depth_;
+            cur_ = other.cur_;
+            std::copy(other.nodes_, other.nodes_ + depth_, nodes_);
+            std::copy(other.pos_, other.pos_ + depth_, pos_);
+            return *this;
+        }
+
+        reference operator*() const
+        {
+            assert(depth_ > 0);
+            return cur_;
+        }
+
+        pointer operator->() const
+        {
+            assert(depth_ > 0);
+            return Arrow{ cur_ };
+        }
+
+        const_iterator & operator++()
+        {
+            assert(depth_ > 0);
+            ++pos_[depth_ - 1];
+            skipForward();
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator old(*this);
+            ++*this;
+            return old;
+        }
+
+        // Decrementing end() gives the last entry.
+        const_iterator & operator--()
+        {
+            if (depth_ == 0){
+                assert(root_);
+                push(root_, root_->leaf_ ? root_->n_ - 1 : root_->n_);
+                descendRight();
+            } else if (pos_[depth_ - 1] > 0){
+                --pos_[depth_ - 1];
+            } else {
+                do {
+                    --depth_;
+                } while (depth_ > 0 && pos_[depth_ - 1] == 0);
+                assert(depth_ > 0);
+                --pos_[depth_ - 1];
+                descendRight();
+            }
+            settle();
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            const_iterator old(*this);
+            --*this;
+            return old;
+        }
+
+        bool operator==(const_iterator const & other) const
+        {
+            return cur_.l_ == other.cur_.l_ && cur_.i_ == other.cur_.i_;
+        }
+
+        bool operator!=(const_iterator const & other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class BTree;
+
+        explicit const_iterator(Node const * root)
+        : root_(root), depth_(0), cur_(nullptr, 0)
+        {}
+
+        void push(Node const * n, std::size_t pos)
+        {
+            assert(depth_ < kMaxDepth);
+            nodes_[depth_] = n;
+            pos_[depth_] = pos;
+            ++depth_;
+        }
+
+        void descendLeft()
+        {
+            while (!nodes_[depth_ - 1]->leaf_){
+                push(inner(nodes_[depth_ - 1])->kids_[pos_[depth_ - 1]].get(), 0);
+            }
+        }
+
+        void descendRight()
+        {
+            while (!nodes_[depth_ - 1]->leaf_){
+                Node const * n = inner(nodes_[depth_ - 1])->kids_[pos_[depth_ - 1]].get();
+                push(n, n->leaf_ ? n->n_ - 1 : n->n_);
+            }
+        }
+
+        // Moves off the end of the leaf on top, if need be, to the next
+        // entry or to end().
+        void skipForward()
+        {
+            if (pos_[depth_ - 1] == nodes_[depth_ - 1]->n_){
+                do {
+                    --depth_;
+                } while (depth_ > 0 && pos_[depth_ - 1] == nodes_[depth_ - 1]->n_);
+                if (depth_ > 0){
+                    ++pos_[depth_ - 1];
+                    descendLeft();
+                }
+            }
+            settle();
+        }
+
+        void settle()
+        {
+            cur_ = depth_ > 0 ? Entry(leaf(nodes_[depth_ - 1]), pos_[depth_ - 1]) : Entry(nullptr, 0);
+        }
+
+        Node const * root_;
+        int depth_;
+        Entry cur_;
+        Node const * nodes_[kMaxDepth];
+        std::size_t pos_[kMaxDepth];
+    };
+
+    typedef const_iterator iterator;
+
+    const_iterator begin() const
+    {
+        const_iterator it(root_.get());
+        if (root_){
+            it.push(root_.get(), 0);
+            it.descendLeft();
+        }
+        it.settle();
+        return it;
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(root_.get());
+    }
+
+    // First entry whose key is not less than x.
+    const_iterator lower_bound(T const & x) const
+    {
+        return bound(x, false);
+    }
+
+    // First entry whose key is greater than x.
+    const_iterator upper_bound(T const & x) const
+    {
+        return bound(x, true);
+    }
+
+    Contents getNodeJustGreaterThan(T const & x) const
+    {
+        const_iterator it = upper_bound(x);
+        return it == end() ? Contents() : Contents(it->value(), it->items());
+    }
+
+    // Checks key order, separator bounds, node fill and that every leaf is
+    // at the same depth. Usable from tests regardless of NDEBUG.
+    bool isValid() const
+    {
+        if (!root_)
+            return true;
+        int leafDepth = -1;
+        return validate(root_.get(), nullptr, nullptr, 0, leafDepth);
+    }
+
+    void checkInvariants() const
+    {
+        assert(isValid());
+    }
+
+private:
+    // What an insert below a node hands back: the node's replacement, and
+    // when it had to split, a second node to go to its right along with the
+    // separator between the two.
+    struct Grown
+    {
+        NodePtr left;
+        T const * sep;    // points into right or into the old tree
+        NodePtr right;
+    };
+
+    template<class K, class... Args>
+    BTree put(K && x, Args &&... args) const
+    {
+        if (!root_){
+            NodePtr hold;
+            newLeaf(hold)->add(std::forward<K>(x), ItemList().emplace_front(std::forward<Args>(args)...));
+            return checked(BTree(hold));
+        }
+        Grown g = ins(root_.get(), std::forward<K>(x), std::forward<Args>(args)...);
+        if (!g.right){
+            return checked(BTree(g.left));
+        }
+        NodePtr hold;
+        Inner * r = newInner(hold);
+        r->add(*g.sep);
+        r->kids_[0] = std::move(g.left);
+        r->kids_[1] = std::move(g.right);
+        return checked(BTree(hold));
+    }
+
+    template<class K, class... Args>
+    static Grown ins(Node const * n, K && x, Args &&... args)
+    {
+        if (n->leaf_){
+            return insLeaf(leaf(n), std::forward<K>(x), std::forward<Args>(args)...);
+        }
+        Inner const * in = inner(n);
+        std::size_t c = upperBound(in, x);
+        Grown g = ins(in->kids_[c].get(), std::forward<K>(x), std::forward<Args>(args)...);
+        if (!g.right){
+            NodePtr hold;
+            Inner * d = newInner(hold);
+            for (std::size_t i = 0; i < in->n_; ++i){
+                d->add(in->keys()[i]);
+                d->kids_[i] = in->kids_[i];
+            }
+            d->kids_[in->n_] = in->kids_[in->n_];
+            d->kids_[c] = std::move(g.left);
+            return Grown{ hold, nullptr, NodePtr() };
+        }
+        // The child split: lay out the separators and children with the new
+        // ones in place, then deal them into one or two nodes.
+        T const * seps[kKeys + 1];
+        NodePtr const * kids[kKeys + 2];
+        for (std::size_t i = 0, j = 0; i <= in->n_; ++i){
+            if (i == c){
+                kids[j] = &g.left;
+                seps[j] = g.sep;
+                ++j;
+                kids[j] = &g.right;
+            } else {
+                kids[j] = &in->kids_[i];
+            }
+            if (i < in->n_)
+                seps[j] = &in->keys()[i];
+            ++j;
+        }
+        return deal(seps, kids, in->n_ + 1);
+    }
+
+    template<class K, class... Args>
+    static Grown insLeaf(Leaf const * l, K && x, Args &&... args)
+    {
+        std::size_t i = lowerBound(l, x);
+        NodePtr ha, hb;
+        Leaf * a = newLeaf(ha);
+        if (i < l->n_ && !(x < l->keys()[i])){
+            a->add(l, 0, i);
+            a->add(l->keys()[i], l->items()[i].emplace_front(std::forward<Args>(args)...));
+            a->add(l, i + 1, l->n_);
+            return Grown{ ha, nullptr, NodePtr() };
+        }
+        std::size_t total = l->n_ + 1;
+        std::size_t cut = total <= kKeys ? total : total / 2;
+        Leaf * b = total > kKeys ? newLeaf(hb) : nullptr;
+        for (std::size_t j = 0; j < total; ++j){
+            Leaf * d = j < cut ? a : b;
+            if (j < i){
+                d->add(l->keys()[j], l->items()[j]);
+            } else if (j == i){
+                d->add(std::forward<K>(x), ItemList().emplace_front(std::forward<Args>(args)...));
+            } else {
+                d->add(l->keys()[j - 1], l->items()[j - 1]);
+            }
+        }
+        return Grown{ ha, b ? &b->keys()[0] : nullptr, hb };
+    }
+
+    // Builds inner nodes from n separators and n + 1 children: one node if
+    // they fit, otherwise two with the middle separator between them.
+    static Grown deal(T const * const * seps, NodePtr const * const * kids, std::size_t n)
+    {
+        NodePtr ha, hb;
+        Inner * a = newInner(ha);
+        if (n <= kKeys){
+            fill(a, seps, kids, 0, n);
+            return Grown{ ha, nullptr, NodePtr() };
+        }
+        std::size_t h = n / 2;
+        Inner * b = newInner(hb);
+        fill(a, seps, kids, 0, h);
+        fill(b, seps, kids, h + 1, n);
+        return Grown{ ha, seps[h], hb };
+    }
+
+    // Separators [first, last) and the children either side of them.
+    static void fill(Inner * d, T const * const * seps, NodePtr const * const * kids,
+                     std::size_t first, std::size_t last)
+    {
+        for (std::size_t i = first; i < last; ++i){
+            d->kids_[d->n_] = *kids[i];
+            d->add(*seps[i]);
+        }
+        d->kids_[d->n_] = *kids[last];
+    }
+
+    BTree rem(T const & x, U const * item) const
+    {
+        if (!root_)
+            return *this;
+        NodePtr r = rem(root_, x, item);
+        if (r == root_)
+            return *this;
+        if (r->n_ == 0){
+            return r->leaf_ ? BTree() : BTree(inner(r.get())->kids_[0]);
+        }
+        return BTree(r);
+    }
+
+    // n less x, or less just the item under x if one is given; n itself if
+    // there is nothing to remove. The result may be short of kMin keys.
+    static NodePtr rem(NodePtr const & n, T const & x, U const * item)
+    {
+        if (n->leaf_){
+            Leaf const * l = leaf(n.get());
+            std::size_t i = lowerBound(l, x);
+            if (i == l->n_ || x < l->keys()[i])
+                return n;
+            ItemList rest;
+            if (item){
+                rest = l->items()[i].remove(*item);
+                if (rest.size() == l->items()[i].size())
+                    return n;
+            }
+            NodePtr hold;
+            Leaf * d = newLeaf(hold);
+            d->add(l, 0, i);
+            if (!rest.isEmpty())
+                d->add(l->keys()[i], std::move(rest));
+            d->add(l, i + 1, l->n_);
+            return hold;
+        }
+        Inner const * in = inner(n.get());
+        std::size_t c = upperBound(in, x);
+        NodePtr k = rem(in->kids_[c], x, item);
+        if (k == in->kids_[c])
+            return n;
+        if (k->n_ >= kMin){
+            NodePtr hold;
+            Inner * d = newInner(hold);
+            for (std::size_t i = 0; i < in->n_; ++i){
+                d->add(in->keys()[i]);
+                d->kids_[i] = in->kids_[i];
+            }
+            d->kids_[in->n_] = in->kids_[in->n_];
+            d->kids_[c] = std::move(k);
+            return hold;
+        }
+        return refill(in, c, k);
+    }
+
+    // A copy of in with its child c replaced by k, which has too few keys.
+    // k is pooled with a neighbour and the two dealt out again, into one
+    // node if they fit and evenly into two if not.
+    static NodePtr refill(Inner const * in, std::size_t c, NodePtr const & k)
+    {
+        std::size_t li = c > 0 ? c - 1 : c;
+        NodePtr const & lft = li == c ? k : in->kids_[li];
+        NodePtr const & rgt = li == c ? in->kids_[c + 1] : k;
+        Grown g;
+        if (k->leaf_){
+            g = redeal(leaf(lft.get()), leaf(rgt.get()));
+        } else {
+            Inner const * a = inner(lft.get());
+            Inner const * b = inner(rgt.get());
+            T const * seps[2 * kKeys + 1];
+            NodePtr const * kids[2 * kKeys + 2];
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < a->n_; ++i, ++n){
+                seps[n] = &a->keys()[i];
+                kids[n] = &a->kids_[i];
+            }
+            seps[n] = &in->keys()[li];
+            kids[n] = &a->kids_[a->n_];
+            ++n;
+            for (std::size_t i = 0; i < b->n_; ++i, ++n){
+                seps[n] = &b->keys()[i];
+                kids[n] = &b->kids_[i];
+            }
+            kids[n] = &b->kids_[b->n_];
+            g = deal(seps, kids, n);
+        }
+        NodePtr hold;
+        Inner * d = newInner(hold);
+        for (std::size_t i = 0; i < li; ++i){
+            d->add(in->keys()[i]);
+            d->kids_[i] = in->kids_[i];
+        }
+        d->kids_[li] = std::move(g.left);
+        if (g.right){
+            d->add(*g.sep);
+            d->kids_[li + 1] = std::move(g.right);
+        }
+        for (std::size_t i = li + 1; i < in->n_; ++i){
+            d->add(in->keys()[i]);
+            d->kids_[d->n_] = in->kids_[i + 1];
+        }
+        return hold;
+    }
+
+    static Grown redeal(Leaf const * a, Leaf const * b)
+    {
+        std::size_t total = a->n_ + b->n_;
+        std::size_t cut = total <= kKeys ? total : total / 2;
+        NodePtr ha, hb;
+        Leaf * d = newLeaf(ha);
+        Leaf * e = total > kKeys ? newLeaf(hb) : nullptr;
+        for (std::size_t j = 0; j < total; ++j){
+            Leaf const * s = j < a->n_ ? a : b;
+            std::size_t i = j < a->n_ ? j : j - a->n_;
+            (j < cut ? d : e)->add(s->keys()[i], s->items()[i]);
+        }
+        return Grown{ ha, e ? &e->keys()[0] : nullptr, hb };
+    }
+
+    Leaf const * find(T const & x, std::size_t & i) const
+    {
+        Node const * n = root_.get();
+        if (!n)
+            return nullptr;
+        while (!n->leaf_){
+            n = inner(n)->kids_[upperBound(n, x)].get();
+        }
+        i = lowerBound(n, x);
+        return i < n->n_ && !(x < n->keys()[i]) ? leaf(n) : nullptr;
+    }
+
+    const_iterator bound(T const & x, bool strict) const
+    {
+        const_iterator it(root_.get());
+        Node const * n = root_.get();
+        if (!n)
+            return it;
+        while (!n->leaf_){
+            std::size_t c = upperBound(n, x);
+            it.push(n, c);
+            n = inner(n)->kids_[c].get();
+        }
+        it.push(n, strict ? upperBound(n, x) : lowerBound(n, x));
+        it.skipForward();
+        return it;
+    }
+
+    static bool validate(Node const * n, T const * lo, T const * hi, int depth, int & leafDepth)
+    {
+        if (depth > 0 && n->n_ < kMin)
+            return false;
+        if (n->n_ > kKeys || (!n->leaf_ && n->n_ == 0))
+            return false;
+        for (std::size_t i = 0; i < n->n_; ++i){
+            T const & k = n->keys()[i];
+            if ((i > 0 && !(n->keys()[i - 1] < k)) || (lo && k < *lo) || (hi && !(k < *hi)))
+                return false;
+        }
+        if (n->leaf_){
+            for (std::size_t i = 0; i < n->n_; ++i){
+                if (leaf(n)->items()[i].isEmpty())
+                    return false;
+            }
+            if (leafDepth < 0)
+                leafDepth = depth;
+            return leafDepth == depth;
+        }
+        Inner const * in = inner(n);
+        for (std::size_t i = 0; i <= n->n_; ++i){
+            if (!in->kids_[i])
+                return false;
+            T const * l = i > 0 ? &n->keys()[i - 1] : lo;
+            T const * h = i < n->n_ ? &n->keys()[i] : hi;
+            if (!validate(in->kids_[i].get(), l, h, depth + 1, leafDepth))
+                return false;
+        }
+        return true;
+    }
+
+    // As RBTree::checked.
+    static BTree checked(BTree const & t)
+    {
+#ifdef RBTREE_CHECK_INVARIANTS
+        t.checkInvariants();
+#endif
+        return t;
+    }
+
+    NodePtr root_;
+};
+
+#endif /* defined(__rbtree__btree__) */
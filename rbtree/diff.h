@@ -0,0 +1,232 @@
+//
+//  diff.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__diff__
+#define __rbtree__diff__
+
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rbtree.h"
+#include "setops.h"
+
+// Differences between two versions of a tree, in key order. Subtrees the two
+// versions share are recognised by their ids and skipped without being
+// looked at, so comparing a version with one derived from it by k updates
+// costs about O(k log n) rather than O(n).
+
+enum ChangeKind
+{
+    ADDED,
+    REMOVED,
+    CHANGED
+};
+
+template<class Tree>
+struct Change
+{
+    ChangeKind kind;
+    typename Tree::Contents before;   // empty items when ADDED
+    typename Tree::Contents after;    // empty items when REMOVED
+
+    typename Tree::Contents const & entry() const
+    {
+        return kind == REMOVED ? before : after;
+    }
+};
+
+// Items gained and lost between two item lists of a key, as multisets.
+template<class U>
+struct ItemDelta
+{
+    std::vector<U> added;
+    std::vector<U> removed;
+};
+
+namespace diffs {
+
+template<class Tree, class F>
+void all(Tree const & t, ChangeKind kind, F & visit)
+{
+    typedef typename Tree::Contents Contents;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        Contents c(it->value(), it->items());
+        visit(Change<Tree>{ kind,
+                            kind == REMOVED ? c : Contents(it->value(), typename Tree::ItemList()),
+                            kind == ADDED ? c : Contents(it->value(), typename Tree::ItemList()) });
+    }
+}
+
+template<class L>
+bool sameItems(L const & a, L const & b)
+{
+    if (a.size() != b.size())
+        return false;
+    auto j = b.begin();
+    for (auto i = a.begin(); i != a.end(); ++i, ++j){
+        if (!(*i == *j))
+            return false;
+    }
+    return true;
+}
+
+// a's root is compared with b split at its key; each side then recurses.
+// Splitting a tree at the key its own root holds takes no new nodes, so
+// where the two versions have the same shape both sides of a shared subtree
+// come out identical and are skipped. Both trees carry their black heights
+// down, so the splits need not walk a spine to find them.
+template<class Tree, class F>
+void walk(setops::Sized<Tree> const & a, setops::Sized<Tree> const & b, F & visit)
+{
+    if (a.t.id() == b.t.id())
+        return;
+    if (a.t.isEmpty()){
+        all(b.t, ADDED, visit);
+        return;
+    }
+    if (b.t.isEmpty()){
+        all(a.t, REMOVED, visit);
+        return;
+    }
+    setops::SizedSplit<Tree> s = setops::splitSized(b, a.t.value());
+    walk(setops::child(a, a.t.left()), s.left, visit);
+    typedef typename Tree::Contents Contents;
+    if (!s.found){
+        visit(Change<Tree>{ REMOVED,
+                            Contents(a.t.value(), a.t.items()),
+                            Contents(a.t.value(), typename Tree::ItemList()) });
+    } else if (!sameItems(a.t.items(), s.items)){
+        visit(Change<Tree>{ CHANGED, Contents(a.t.value(), a.t.items()), Contents(a.t.value(), s.items) });
+    }
+    walk(setops::child(a, a.t.right()), s.right, visit);
+}
+
+} // namespace diffs
+
+// Calls visit(Change) for every key whose items differ between a and b,
+// in key order.
+template<class T, class U, class P, class F>
+void diff(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b, F visit)
+{
+    diffs::walk(setops::measured(a), setops::measured(b), visit);
+}
+
+template<class T, class U, class P>
+std::vector<Change<RBTree<T, U, P>>> diff(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b)
+{
+    std::vector<Change<RBTree<T, U, P>>> v;
+    diff(a, b, [&](Change<RBTree<T, U, P>> const & c){ v.push_back(c); });
+    return v;
+}
+
+namespace diffs {
+
+// Whether items of type U can be sorted.
+template<class U, class = void>
+struct Ordered : std::false_type {};
+
+template<class U>
+struct Ordered<U, decltype(void(std::declval<U const &>() < std::declval<U const &>()))> : std::true_type {};
+
+// Middles no longer than this are matched pairwise.
+const std::size_t kPairwise = 16;
+
+// Pairs each item of a[lo, ea) with the first equal item of b[lo, eb) not
+// already taken, marking both.
+template<class U>
+void matchPairwise(std::vector<U> const & a, std::size_t ea, std::vector<U> const & b, std::size_t eb,
+                   std::size_t lo, std::vector<bool> & inA, std::vector<bool> & inB)
+{
+    for (std::size_t i = lo; i < ea; ++i){
+        std::size_t j = lo;
+        while (j < eb && (inB[j - lo] || !(b[j] == a[i])))
+            ++j;
+        if (j < eb){
+            inA[i - lo] = true;
+            inB[j - lo] = true;
+        }
+    }
+}
+
+// The same pairing by sorting both sides' positions by item and merging.
+// Equal items keep their order, so the k-th of a value in a meets the k-th
+// in b, as above.
+template<class U>
+void matchSorted(std::vector<U> const & a, std::size_t ea, std::vector<U> const & b, std::size_t eb,
+                 std::size_t lo, std::vector<bool> & inA, std::vector<bool> & inB)
+{
+    std::vector<std::size_t> ia, ib;
+    for (std::size_t i = lo; i < ea; ++i){
+        ia.push_back(i);
+    }
+    for (std::size_t j = lo; j < eb; ++j){
+        ib.push_back(j);
+    }
+    std::stable_sort(ia.begin(), ia.end(), [&](std::size_t x, std::size_t y){ return a[x] < a[y]; });
+    std::stable_sort(ib.begin(), ib.end(), [&](std::size_t x, std::size_t y){ return b[x] < b[y]; });
+    std::size_t x = 0, y = 0;
+    while (x < ia.size() && y < ib.size()){
+        U const & u = a[ia[x]];
+        U const & v = b[ib[y]];
+        if (u < v){
+            ++x;
+        } else if (v < u){
+            ++y;
+        } else {
+            inA[ia[x++] - lo] = true;
+            inB[ib[y++] - lo] = true;
+        }
+    }
+}
+
+} // namespace diffs
+
+// The items of after that are not in before and the other way round,
+// counting repeats, each in the order it appears. Lists that differ by a
+// few items at either end, as after push_front or a remove near the front,
+// are compared in time proportional to their length. What is left in the
+// middle is matched pairwise when it is short or the items have no <, and
+// otherwise by sorting, in O(m log m); < must then agree with ==.
+template<class L>
+ItemDelta<typename L::value_type> itemDelta(L const & before, L const & after)
+{
+    typedef typename L::value_type U;
+    std::vector<U> b(before.begin(), before.end());
+    std::vector<U> a(after.begin(), after.end());
+    std::size_t lo = 0;
+    while (lo < a.size() && lo < b.size() && a[lo] == b[lo])
+        ++lo;
+    std::size_t ea = a.size(), eb = b.size();
+    while (ea > lo && eb > lo && a[ea - 1] == b[eb - 1]){
+        --ea;
+        --eb;
+    }
+    std::vector<bool> inA(ea - lo, false), inB(eb - lo, false);
+    bool pairwise = true;
+    if constexpr (diffs::Ordered<U>::value){
+        pairwise = ea - lo <= diffs::kPairwise && eb - lo <= diffs::kPairwise;
+        if (!pairwise)
+            diffs::matchSorted(a, ea, b, eb, lo, inA, inB);
+    }
+    if (pairwise)
+        diffs::matchPairwise(a, ea, b, eb, lo, inA, inB);
+    ItemDelta<U> d;
+    for (std::size_t i = lo; i < ea; ++i){
+        if (!inA[i - lo])
+            d.added.push_back(a[i]);
+    }
+    for (std::size_t j = lo; j < eb; ++j){
+        if (!inB[j - lo])
+            d.removed.push_back(b[j]);
+    }
+    return d;
+}
+
+#endif /* defined(__rbtree__diff__) */
@@ -0,0 +1,292 @@
+//
+//  history.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__history__
+#define __rbtree__history__
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rbtree.h"
+
+// Committed versions of an RBTree, numbered 1, 2, 3, ... in commit order.
+// Each entry holds just a root, so versions share whatever nodes they have
+// in common. Old versions are dropped by a retention policy applied on every
+// commit, or explicitly with keepLast() and keepSince().
+template<class T, class U, class Policy = DefaultPolicy>
+class VersionHistory
+{
+public:
+    typedef RBTree<T, U, Policy> Tree;
+    typedef std::uint64_t Version;
+    typedef std::chrono::system_clock Clock;
+
+    // What commit() keeps. Zero means no limit; the latest version is always
+    // kept whatever the limits.
+    struct Retention
+    {
+        std::size_t maxVersions;
+        Clock::duration maxAge;
+    };
+
+    // How much memory the retained versions take and how much of it they
+    // share. Bytes count tree nodes only, not item chunks.
+    struct Sharing
+    {
+        std::size_t versions;
+        std::size_t distinctNodes;   // nodes in any retained version
+        std::size_t logicalNodes;    // the sum over versions of their nodes
+        std::size_t sharedNodes;     // nodes in two or more versions
+        std::size_t uniqueNodes;     // nodes in exactly one version
+        std::size_t distinctBytes;
+        std::size_t logicalBytes;
+        std::size_t sharedBytes;
+        std::size_t uniqueBytes;
+    };
+
+    VersionHistory() : next_(1), retention_(Retention{ 0, Clock::duration::zero() }) {}
+
+    explicit VersionHistory(Retention r) : next_(1), retention_(r) {}
+
+    void setRetention(Retention r)
+    {
+        retention_ = r;
+        retain(Clock::now());
+    }
+
+    // Records t as the next version and returns its number.
+    Version commit(Tree const & t, Clock::time_point when = Clock::now())
+    {
+        versions_.push_back(Entry{ next_, when, t });
+        retain(when);
+        return next_++;
+    }
+
+    bool isEmpty() const
+    {
+        return versions_.empty();
+    }
+
+    // Number of versions retained.
+    std::size_t size() const
+    {
+        return versions_.size();
+    }
+
+    bool contains(Version v) const
+    {
+        return !versions_.empty() && versions_.front().version_ <= v && v <= versions_.back().version_;
+    }
+
+    // The tree as committed in version v; throws std::out_of_range if v was
+    // never committed or has been dropped.
+    Tree const & at(Version v) const
+    {
+        if (!contains(v))
+            throw std::out_of_range("VersionHistory::at: version not retained");
+        return versions_[v - versions_.front().version_].tree_;
+    }
+
+    Clock::time_point committedAt(Version v) const
+    {
+        if (!contains(v))
+            throw std::out_of_range("VersionHistory::committedAt: version not retained");
+        return versions_[v - versions_.front().version_].when_;
+    }
+
+    // The latest version committed at or before when, or 0 if there is no
+    // such version among those retained.
+    Version versionAsOf(Clock::time_point when) const
+    {
+        std::size_t lo = 0, hi = versions_.size();
+        while (lo < hi){
+            std::size_t mid = lo + (hi - lo) / 2;
+            if (when < versions_[mid].when_){
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        return lo == 0 ? 0 : versions_[lo - 1].version_;
+    }
+
+    Version oldest() const
+    {
+        assert(!isEmpty());
+        return versions_.front().version_;
+    }
+
+    Version latest() const
+    {
+        assert(!isEmpty());
+        return versions_.back().version_;
+    }
+
+    Tree const & current() const
+    {
+        assert(!isEmpty());
+        return versions_.back().tree_;
+    }
+
+    // Drops all but the latest n versions.
+    void keepLast(std::size_t n)
+    {
+        while (versions_.size() > n && versions_.size() > 1){
+            versions_.pop_front();
+        }
+    }
+
+    // Drops versions committed before when, other than the latest.
+    void keepSince(Clock::time_point when)
+    {
+        while (versions_.size() > 1 && versions_.front().when_ < when){
+            versions_.pop_front();
+        }
+    }
+
+    // Walks every retained version once, skipping subtrees already seen, so
+    // it costs time in the number of distinct nodes.
+    Sharing sharing() const
+    {
+        std::unordered_map<void const *, Seen> seen;
+        std::vector<View> stack;
+        for (std::size_t i = 0; i < versions_.size(); ++i){
+            push(stack, versions_[i].tree_.view());
+            while (!stack.empty()){
+                View t = stack.back();
+                stack.pop_back();
+                auto it = seen.find(t.id());
+                if (it == seen.end()){
+                    seen.emplace(t.id(), Seen{ i, false, 0 });
+                    push(stack, t.left());
+                    push(stack, t.right());
+                } else if (it->second.version_ != i){
+                    // Seen in an earlier version, and with it everything below.
+                    markShared(t, seen);
+                }
+            }
+        }
+        Sharing s = Sharing();
+        s.versions = versions_.size();
+        s.distinctNodes = seen.size();
+        for (auto const & e : seen){
+            if (e.second.shared_)
+                ++s.sharedNodes;
+        }
+        s.uniqueNodes = s.distinctNodes - s.sharedNodes;
+        for (Entry const & e : versions_){
+            s.logicalNodes += sizeOf(e.tree_.view(), seen);
+        }
+        s.distinctBytes = s.distinctNodes * Tree::nodeBytes();
+        s.logicalBytes = s.logicalNodes * Tree::nodeBytes();
+        s.sharedBytes = s.sharedNodes * Tree::nodeBytes();
+        s.uniqueBytes = s.uniqueNodes * Tree::nodeBytes();
+        return s;
+    }
+
+private:
+    typedef typename Tree::View View;
+
+    struct Entry
+    {
+        Version version_;
+        Clock::time_point when_;
+        Tree tree_;
+    };
+
+    struct Seen
+    {
+        std::size_t version_;   // first version found in
+        bool shared_;
+        std::size_t size_;      // nodes in the subtree, once counted
+    };
+
+    void retain(Clock::time_point now)
+    {
+        if (retention_.maxVersions > 0)
+            keepLast(retention_.maxVersions);
+        if (retention_.maxAge > Clock::duration::zero())
+            keepSince(now - retention_.maxAge);
+    }
+
+    static void push(std::vector<View> & stack, View t)
+    {
+        if (!t.isEmpty())
+            stack.push_back(t);
+    }
+
+    // Marks t's subtree shared, stopping at subtrees already marked.
+    static void markShared(View t, std::unordered_map<void const *, Seen> & seen)
+    {
+        std::vector<View> stack(1, t);
+        while (!stack.empty()){
+            View u = stack.back();
+            stack.pop_back();
+            Seen & s = seen[u.id()];
+            if (s.shared_)
+                continue;
+            s.shared_ = true;
+            push(stack, u.left());
+            push(stack, u.right());
+        }
+    }
+
+    // Nodes in t, counting each distinct subtree once and remembering the
+    // answer.
+    static std::size_t sizeOf(View t, std::unordered_map<void const *, Seen> & seen)
+    {
+        if (t.isEmpty())
+            return 0;
+        std::vector<std::pair<View, bool>> stack(1, std::make_pair(t, false));
+        while (!stack.empty()){
+            std::pair<View, bool> top = stack.back();
+            Seen & s = seen[top.first.id()];
+            if (s.size_ > 0){
+                stack.pop_back();
+            } else if (!top.second){
+                stack.back().second = true;
+                if (!top.first.left().isEmpty())
+                    stack.push_back(std::make_pair(top.first.left(), false));
+                if (!top.first.right().isEmpty())
+                    stack.push_back(std::make_pair(top.first.right(), false));
+            } else {
+                s.size_ = 1 + known(top.first.left(), seen) + known(top.first.right(), seen);
+                stack.pop_back();
+            }
+        }
+        return seen[t.id()].size_;
+    }
+
+    static std::size_t known(View t, std::unordered_map<void const *, Seen> const & seen)
+    {
+        return t.isEmpty() ? 0 : seen.find(t.id())->second.size_;
+    }
+
+    std::deque<Entry> versions_;
+    Version next_;
+    Retention retention_;
+};
+
+// How much two versions share, as sharing() would report for a history of
+// just the two.
+template<class T, class U, class P>
+typename VersionHistory<T, U, P>::Sharing sharing(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b)
+{
+    VersionHistory<T, U, P> h;
+    h.commit(a);
+    h.commit(b);
+    return h.sharing();
+}
+
+#endif /* defined(__rbtree__history__) */
@@ -0,0 +1,418 @@
+//
+//  itemseq.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__itemseq__
+#define __rbtree__itemseq__
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "list.h"
+#include "pool.h"
+#include "refcount.h"
+#include "stats.h"
+
+// Persistent sequence of a key's items, newest first, as kept in tree nodes.
+// The newest N items live inline in the sequence itself, so a key with only a
+// few items needs no allocation of its own. Older items spill into a chain of
+// immutable chunks of up to kChunk items, shared between every version that
+// has them. size() is O(1) and scans run over contiguous memory.
+template<class U, std::size_t N = 4, class A = PoolAllocator<U>, class RC = AtomicCount>
+class ItemSeq
+{
+    static_assert(N > 0, "ItemSeq needs room for at least one inline item");
+    
+    static const std::size_t kChunk = N > 16 ? N : 16;
+    
+    struct Chunk
+    {
+        Chunk() : n_(0), next_(nullptr) {}
+        
+        U * items() { return reinterpret_cast<U *>(data_); }
+        U const * items() const { return reinterpret_cast<U const *>(data_); }
+        
+        RC refs_;
+        std::size_t n_;
+        Chunk const * next_;
+        alignas(U) unsigned char data_[kChunk * sizeof(U)];
+    };
+    typedef typename std::allocator_traits<A>::template rebind_alloc<Chunk> ChunkAlloc;
+
+public:
+    typedef U value_type;
+    
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef U value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef U const * pointer;
+        typedef U const & reference;
+        
+        const_iterator() : p_(nullptr), stop_(nullptr), next_(nullptr) {}
+        
+        reference operator*() const { return *p_; }
+        pointer operator->() const { return p_; }
+        
+        const_iterator & operator++()
+        {
+            if (++p_ == stop_){
+                enter(next_);
+            }
+            return *this;
+        }
+        
+        const_iterator operator++(int)
+        {
+            const_iterator old(*this);
+            ++*this;
+            return old;
+        }
+        
+        bool operator==(const_iterator const & other) const { return p_ == other.p_; }
+        bool operator!=(const_iterator const & other) const { return p_ != other.p_; }
+    
+    private:
+        friend class ItemSeq;
+        
+        void enter(Chunk const * c)
+        {
+            if (c){
+                p_ = c->items();
+                stop_ = p_ + c->n_;
+                next_ = c->next_;
+            } else {
+                p_ = stop_ = nullptr;
+                next_ = nullptr;
+            }
+        }
+        
+        U const * p_;
+        U const * stop_;
+        Chunk const * next_;
+    };
+    
+    ItemSeq() : size_(0), headSize_(0), trunk_(nullptr) {}
+    
+    // Cons, as for List.
+    ItemSeq(U const & v, ItemSeq const & tail) : ItemSeq(tail.push_front(v)) {}
+    ItemSeq(U && v, ItemSeq const & tail) : ItemSeq(tail.push_front(std::move(v))) {}
+    
+    ItemSeq(std::initializer_list<U> init) : ItemSeq()
+    {
+        for (auto it = std::begin(init); it != std::end(init); ++it){
+            *this = push_front(*it);
+        }
+    }
+    
+    // Same items, same order.
+    template<class B>
+    ItemSeq(List<U, B> const & lst) : ItemSeq()
+    {
+        std::vector<U> v;
+        forEach(lst, [&](U const & x){ v.push_back(x); });
+        for (auto it = v.rbegin(); it != v.rend(); ++it){
+            *this = push_front(*it);
+        }
+    }
+    
+    ItemSeq(ItemSeq const & other)
+    : size_(other.size_), headSize_(0), trunk_(retain(other.trunk_))
+    {
+        for (; headSize_ < other.headSize_; ++headSize_){
+            new (head() + headSize_) U(other.head()[headSize_]);
+        }
+    }
+    
+    ItemSeq(ItemSeq && other)
+    : size_(other.size_), headSize_(0), trunk_(other.trunk_)
+    {
+        for (; headSize_ < other.headSize_; ++headSize_){
+            new (head() + headSize_) U(std::move(other.head()[headSize_]));
+        }
+        other.clear();
+        other.trunk_ = nullptr;
+    }
+    
+    ItemSeq & operator=(ItemSeq const & other)
+    {
+        if (this != &other){
+            ItemSeq tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+    
+    ItemSeq & operator=(ItemSeq && other)
+    {
+        if (this != &other){
+            clear();
+            release(trunk_);
+            size_ = other.size_;
+            for (; headSize_ < other.headSize_; ++headSize_){
+                new (head() + headSize_) U(std::move(other.head()[headSize_]));
+            }
+            trunk_ = other.trunk_;
+            other.clear();
+            other.trunk_ = nullptr;
+        }
+        return *this;
+    }
+    
+    ~ItemSeq()
+    {
+        clear();
+        release(trunk_);
+    }
+    
+    bool isEmpty() const
+    {
+        return size_ == 0;
+    }
+    
+    std::size_t size() const
+    {
+        return size_;
+    }
+    
+    U const & front() const
+    {
+        assert(!isEmpty());
+        return headSize_ ? head()[0] : trunk_->items()[0];
+    }
+    
+    const_iterator begin() const
+    {
+        const_iterator it;
+        if (headSize_){
+            it.p_ = head();
+            it.stop_ = head() + headSize_;
+            it.next_ = trunk_;
+        } else {
+            it.enter(trunk_);
+        }
+        return it;
+    }
+    
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
+    
+    bool contains(U const & v) const
+    {
+        for (U const & x : *this){
+            if (x == v)
+                return true;
+        }
+        return false;
+    }
+    
+    ItemSeq push_front(U const & v) const
+    {
+        return emplace_front(v);
+    }
+    
+    ItemSeq push_front(U && v) const
+    {
+        return emplace_front(std::move(v));
+    }
+    
+    // With a new item built in place from args at the front.
+    template<class... Args>
+    ItemSeq emplace_front(Args &&... args) const
+    {
+        ItemSeq r;
+        r.size_ = size_ + 1;
+        if (headSize_ < N){
+            new (r.head()) U(std::forward<Args>(args)...);
+            for (r.headSize_ = 1; r.headSize_ <= headSize_; ++r.headSize_){
+                new (r.head() + r.headSize_) U(head()[r.headSize_ - 1]);
+            }
+            r.trunk_ = retain(trunk_);
+            return r;
+        }
+        // Spill the full head into the trunk, topping up its first chunk
+        // when the two fit together.
+        Chunk * c = makeChunk();
+        for (; c->n_ < headSize_; ++c->n_){
+            new (c->items() + c->n_) U(head()[c->n_]);
+        }
+        Chunk const * rest = trunk_;
+        if (trunk_ && trunk_->n_ + headSize_ <= kChunk){
+            for (std::size_t i = 0; i < trunk_->n_; ++i, ++c->n_){
+                new (c->items() + c->n_) U(trunk_->items()[i]);
+            }
+            rest = trunk_->next_;
+        }
+        c->next_ = retain(rest);
+        r.trunk_ = c;
+        new (r.head()) U(std::forward<Args>(args)...);
+        r.headSize_ = 1;
+        return r;
+    }
+    
+    // Without the first occurrence of v; unchanged if v is not there. Only
+    // the chunks up to the one holding v are copied.
+    ItemSeq remove(U const & v) const
+    {
+        for (std::size_t i = 0; i < headSize_; ++i){
+            if (head()[i] == v){
+                ItemSeq r;
+                r.size_ = size_ - 1;
+                for (std::size_t j = 0; j < headSize_; ++j){
+                    if (j != i){
+                        new (r.head() + r.headSize_++) U(head()[j]);
+                    }
+                }
+                r.trunk_ = retain(trunk_);
+                return r;
+            }
+        }
+        std::vector<Chunk const *> before;
+        for (Chunk const * c = trunk_; c; c = c->next_){
+            for (std::size_t i = 0; i < c->n_; ++i){
+                if (c->items()[i] == v){
+                    Chunk const * tail = retain(c->next_);
+                    if (c->n_ > 1){
+                        tail = copyChunk(c, i, tail);
+                    }
+                    for (auto it = before.rbegin(); it != before.rend(); ++it){
+                        tail = copyChunk(*it, kChunk, tail);
+                    }
+                    ItemSeq r(*this, tail);
+                    r.size_ = size_ - 1;
+                    return r;
+                }
+            }
+            before.push_back(c);
+        }
+        return *this;
+    }
+
+private:
+    // Same head as other, with a trunk the caller already holds a reference to.
+    ItemSeq(ItemSeq const & other, Chunk const * trunk)
+    : size_(other.size_), headSize_(0), trunk_(trunk)
+    {
+        for (; headSize_ < other.headSize_; ++headSize_){
+            new (head() + headSize_) U(other.head()[headSize_]);
+        }
+    }
+    
+    U * head() { return reinterpret_cast<U *>(head_); }
+    U const * head() const { return reinterpret_cast<U const *>(head_); }
+    
+    void clear()
+    {
+        for (std::size_t i = 0; i < headSize_; ++i){
+            head()[i].~U();
+        }
+        headSize_ = 0;
+        size_ = 0;
+    }
+    
+    static Chunk * makeChunk()
+    {
+        RBTREE_COUNT(ITEM_CHUNKS);
+        ChunkAlloc alloc;
+        Chunk * c = std::allocator_traits<ChunkAlloc>::allocate(alloc, 1);
+        new (c) Chunk();
+        c->refs_.retain();
+        return c;
+    }
+    
+    // A copy of c, less the item at skip, in front of next (whose reference
+    // it takes over).
+    static Chunk const * copyChunk(Chunk const * c, std::size_t skip, Chunk const * next)
+    {
+        Chunk * d = makeChunk();
+        for (std::size_t i = 0; i < c->n_; ++i){
+            if (i != skip){
+                new (d->items() + d->n_++) U(c->items()[i]);
+            }
+        }
+        d->next_ = next;
+        return d;
+    }
+    
+    static Chunk const * retain(Chunk const * c)
+    {
+        if (c)
+            c->refs_.retain();
+        return c;
+    }
+    
+    // Iterative, so a long chain cannot overflow the stack.
+    static void release(Chunk const * c)
+    {
+        while (c && c->refs_.release()){
+            Chunk * dead = const_cast<Chunk *>(c);
+            c = dead->next_;
+            for (std::size_t i = 0; i < dead->n_; ++i){
+                dead->items()[i].~U();
+            }
+            dead->~Chunk();
+            ChunkAlloc alloc;
+            std::allocator_traits<ChunkAlloc>::deallocate(alloc, dead, 1);
+        }
+    }
+    
+    std::size_t size_;
+    std::size_t headSize_;
+    Chunk const * trunk_;
+    alignas(U) unsigned char head_[N * sizeof(U)];
+};
+
+template<class U, std::size_t N, class A, class RC>
+ItemSeq<U, N, A, RC> concat(ItemSeq<U, N, A, RC> const & a, ItemSeq<U, N, A, RC> const & b)
+{
+    std::vector<U> v(a.begin(), a.end());
+    ItemSeq<U, N, A, RC> r = b;
+    for (auto it = v.rbegin(); it != v.rend(); ++it){
+        r = r.push_front(*it);
+    }
+    return r;
+}
+
+template<class U, std::size_t N, class A, class RC, class F>
+void forEach(ItemSeq<U, N, A, RC> const & seq, F f)
+{
+    for (U const & x : seq){
+        f(x);
+    }
+}
+
+template<class U, std::size_t N, class A, class RC, class V, class F>
+V foldl(F f, V acc, ItemSeq<U, N, A, RC> const & seq)
+{
+    for (U const & x : seq){
+        acc = f(acc, x);
+    }
+    return acc;
+}
+
+template<class U, std::size_t N, class A, class RC>
+void print(ItemSeq<U, N, A, RC> const & seq)
+{
+    std::cout << "[ ";
+    for (U const & x : seq){
+        std::cout << x << " ";
+    }
+    std::cout << "] " << std::endl;
+}
+
+#endif /* defined(__rbtree__itemseq__) */
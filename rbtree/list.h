@@ -11,44 +11,111 @@
 
 #include <iostream>
 #include <cassert>
+#include <atomic>
 #include <functional>
 #include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
 //#include <type_traits>
 
-template<class T>
+#include "pool.h"
+#include "stats.h"
+
+// Items are shared between list versions and reference counted; the last
+// list to let go of an item frees it, along with any tail it was the sole
+// owner of.
+template<class T, class A = PoolAllocator<T>>
 class List
 {
     struct Item
     {
-        Item(T v, Item const * tail) : val_(v), next_(tail) {}
+        template<class V>
+        Item(V && v, Item const * tail)
+        : refs_(1), len_(tail ? tail->len_ + 1 : 1), val_(std::forward<V>(v)), next_(tail)
+        {}
+        mutable std::atomic<long> refs_;
+        std::size_t len_;
         T val_;
         Item const * next_;
     };
     friend Item;
-    explicit List (Item const * items) : head_(items) {}
+    typedef typename std::allocator_traits<A>::template rebind_alloc<Item> ItemAlloc;
+    
+    explicit List (Item const * items) : head_(retain(items)) {}
+    
+    static Item const * retain(Item const * it)
+    {
+        if (it)
+            it->refs_.fetch_add(1, std::memory_order_relaxed);
+        return it;
+    }
+    
+    // Iterative, so dropping a long list cannot overflow the stack.
+    static void release(Item const * it)
+    {
+        while (it && it->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            Item * dead = const_cast<Item *>(it);
+            it = dead->next_;
+            ItemAlloc alloc;
+            std::allocator_traits<ItemAlloc>::destroy(alloc, dead);
+            std::allocator_traits<ItemAlloc>::deallocate(alloc, dead, 1);
+        }
+    }
+    
+    // Takes over the caller's reference to tail.
+    template<class V>
+    static Item const * cons(V && v, Item const * tail)
+    {
+        RBTREE_COUNT(LIST_CELLS);
+        ItemAlloc alloc;
+        Item * it = std::allocator_traits<ItemAlloc>::allocate(alloc, 1);
+        std::allocator_traits<ItemAlloc>::construct(alloc, it, std::forward<V>(v), tail);
+        return it;
+    }
 public:
+    typedef T value_type;
     
     // Empty list
     List() : head_(nullptr) {}
     
     // Cons
-    List(T v, List tail) : head_(new Item(v, tail.head_)) {}
+    List(T const & v, List const & tail) : head_(cons(v, retain(tail.head_))) {}
+    List(T && v, List const & tail) : head_(cons(std::move(v), retain(tail.head_))) {}
     
     // From initializer list
     List(std::initializer_list<T> init) : head_(nullptr)
     {
         for (auto it = std::begin(init); it != std::end(init); ++it)
         {
-            head_ = new Item(*it, head_);
+            head_ = cons(*it, head_);
         }
     }
     
+    List(List const & other) : head_(retain(other.head_)) {}
+    
+    List(List && other) : head_(other.head_)
+    {
+        other.head_ = nullptr;
+    }
+    
+    List & operator=(List other)
+    {
+        std::swap(head_, other.head_);
+        return *this;
+    }
+    
+    ~List()
+    {
+        release(head_);
+    }
+    
     bool isEmpty() const
     {
         return !head_;
     }
     
-    T front() const
+    T const & front() const
     {
         assert(!isEmpty());
         return head_->val_;
@@ -56,7 +123,7 @@ public:
     
     int size() const
     {
-        return foldr([](T v, int u){ return 1 + u; }, 0, *this);
+        return head_ ? static_cast<int>(head_->len_) : 0;
     }
     
     List pop_front() const
@@ -65,107 +132,139 @@ public:
         return List(head_->next_);
     }
     
-    List push_front(T v) const
+    List push_front(T const & v) const
     {
         return List(v, *this);
     }
     
-    List insertAt(int i, T v) const
+    List push_front(T && v) const
+    {
+        return List(std::move(v), *this);
+    }
+    
+    // The items of [first, last), in that order, in front of this list.
+    template<class It>
+    List prepend(It first, It last) const
+    {
+        List r = *this;
+        while (last != first){
+            r = List(*--last, r);
+        }
+        return r;
+    }
+    
+    // The list operations below walk with loops, copying the prefix they
+    // rebuild into a buffer, so no depth of recursion grows with the list.
+    List insertAt(int i, T const & v) const
     {
-        if (i == 0){
-            return push_front(v);
-        } else {
-            assert(!isEmpty());
-            return List(front(), pop_front().insertAt(i - 1, v));
+        std::vector<T> prefix;
+        Item const * it = head_;
+        for (; i > 0; --i){
+            assert(it);
+            prefix.push_back(it->val_);
+            it = it->next_;
         }
+        return List(it).push_front(v).prepend(prefix.begin(), prefix.end());
     }
     
     List removeAt(int i) const
     {
-        if (i == 0){
-            return pop_front();
-        } else {
-            assert(!isEmpty());
-            return List(front(), pop_front().removeAt(i - 1));
+        std::vector<T> prefix;
+        Item const * it = head_;
+        for (; i > 0; --i){
+            assert(it);
+            prefix.push_back(it->val_);
+            it = it->next_;
         }
+        assert(it);
+        return List(it->next_).prepend(prefix.begin(), prefix.end());
     }
     
-    List remove(T v) const
+    // Without the first occurrence of v; unchanged if v is not there.
+    List remove(T const & v) const
     {
-        if (v == head_->val_){
-            return pop_front();
-        } else {
-            assert(!isEmpty());
-            return List(front(), pop_front().remove(v));
+        std::vector<T> prefix;
+        for (Item const * it = head_; it; it = it->next_){
+            if (v == it->val_){
+                return List(it->next_).prepend(prefix.begin(), prefix.end());
+            }
+            prefix.push_back(it->val_);
         }
+        return *this;
     }
     
 private:
     Item const * head_;
 };
 
-template<class T>
-List<T> concat(List<T> a, List<T> b)
+template<class T, class A>
+List<T, A> concat(List<T, A> a, List<T, A> b)
 {
-    if (a.isEmpty())
-        return b;
-    return List<T>(a.front(), concat(a.pop_front(), b));
+    std::vector<T> v;
+    for (; !a.isEmpty(); a = a.pop_front()){
+        v.push_back(a.front());
+    }
+    return b.prepend(v.begin(), v.end());
 }
 
-template<class U, class T, class F>
-List<U> fmap(F f, List<T> lst)
+template<class U, class T, class A, class F>
+List<U> fmap(F f, List<T, A> lst)
 {
     static_assert(std::is_convertible<F, std::function<U(T)>>::value,
                   "fmap requires a function type U(T)");
-    if (lst.isEmpty())
-        return List<U>();
-    else
-        return List<U>(f(lst.front()), fmap<U>(f, lst.pop_front()));
+    std::vector<U> v;
+    for (; !lst.isEmpty(); lst = lst.pop_front()){
+        v.push_back(f(lst.front()));
+    }
+    return List<U>().prepend(v.begin(), v.end());
 }
 
-template<class T, class P>
-List<T> filter(P p, List<T> lst)
+template<class T, class A, class P>
+List<T, A> filter(P p, List<T, A> lst)
 {
     static_assert(std::is_convertible<P, std::function<bool(T)>>::value,
                   "filter requires a function type bool(T)");
-    if (lst.isEmpty())
-        return List<T>();
-    if (p(lst.front()))
-        return List<T>(lst.front(), filter(p, lst.pop_front()));
-    else
-        return filter(p, lst.pop_front());
+    std::vector<T> v;
+    for (; !lst.isEmpty(); lst = lst.pop_front()){
+        if (p(lst.front()))
+            v.push_back(lst.front());
+    }
+    return List<T, A>().prepend(v.begin(), v.end());
 }
 
-template<class T, class U, class F>
-U foldr(F f, U acc, List<T> lst)
+template<class T, class A, class U, class F>
+U foldr(F f, U acc, List<T, A> lst)
 {
     static_assert(std::is_convertible<F, std::function<U(T, U)>>::value,
                   "foldr requires a function type U(T, U)");
-    if (lst.isEmpty())
-        return acc;
-    else
-        return f(lst.front(), foldr(f, acc, lst.pop_front()));
+    std::vector<T> v;
+    for (; !lst.isEmpty(); lst = lst.pop_front()){
+        v.push_back(lst.front());
+    }
+    for (auto it = v.rbegin(); it != v.rend(); ++it){
+        acc = f(*it, acc);
+    }
+    return acc;
 }
 
-template<class T, class U, class F>
-U foldl(F f, U acc, List<T> lst)
+template<class T, class A, class U, class F>
+U foldl(F f, U acc, List<T, A> lst)
 {
     static_assert(std::is_convertible<F, std::function<U(U, T)>>::value,
                   "foldl requires a function type U(U, T)");
-    if (lst.isEmpty())
-        return acc;
-    else
-        return foldl(f, f(acc, lst.front()), lst.pop_front());
+    for (; !lst.isEmpty(); lst = lst.pop_front()){
+        acc = f(acc, lst.front());
+    }
+    return acc;
 }
 
-template<class T, class F>
-void forEach(List<T> lst, F f)
+template<class T, class A, class F>
+void forEach(List<T, A> lst, F f)
 {
     static_assert(std::is_convertible<F, std::function<void(T)>>::value,
                   "forEach requires a function type void(T)");
-    if (!lst.isEmpty()) {
+    for (; !lst.isEmpty(); lst = lst.pop_front()){
         f(lst.front());
-        forEach(lst.pop_front(), f);
     }
 }
 
@@ -173,15 +272,12 @@ template<class Beg, class End>
 auto fromIt(Beg it, End end) -> List<typename Beg::value_type>
 {
     typedef typename Beg::value_type T;
-    if (it == end){
-        return List<T>();
-        T item = *it;
-        return List<T>(item, fromIt(++it, end));
-    }
+    std::vector<T> v(it, end);
+    return List<T>().prepend(v.begin(), v.end());
 }
 
-template<class T>
-void print(List<T> lst)
+template<class T, class A>
+void print(List<T, A> lst)
 {
     std::cout << "[ ";
     forEach(lst, [](T v)
@@ -0,0 +1,411 @@
+//
+//  nodelog.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__nodelog__
+#define __rbtree__nodelog__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rbtree.h"
+
+// Append-only storage for successive versions of a tree. Committing a
+// version appends only the nodes it does not share with the version before
+// it (for an update, the O(log n) nodes on the changed path) and a commit
+// record naming its root; shared subtrees are referred to by the file offset
+// they were first written at. Any committed version can be read back by its
+// root offset.
+//
+// A commit's nodes and its commit record go out in one write, which a crash
+// may leave partly on disk, or on disk in any order. So each commit record
+// carries a checksum of everything from the end of the commit before it up
+// to its own root, and opening the log keeps the commits up to the first
+// that is cut short or does not match, cutting off everything after.
+//
+// Records, after a fixed header:
+//
+//     'N' color left right key count item...    a node; children by offset
+//     'C' root sum                              a commit
+//
+// Offsets are from the start of the file; 0 is the empty tree. Keys and
+// items are stored as raw bytes, so both must be trivially copyable.
+
+namespace nodelog {
+
+const char kMagic[8] = { 'R', 'B', 'T', 'N', 'L', 'O', 'G', '\0' };
+const std::uint32_t kFormat = 2;
+const std::uint32_t kByteOrder = 0x01020304;
+
+struct Header
+{
+    char magic_[8];
+    std::uint32_t format_;
+    std::uint32_t byteOrder_;
+    std::uint32_t keyBytes_;
+    std::uint32_t itemBytes_;
+};
+
+// 64-bit FNV-1a, continued from h over n more bytes.
+inline std::uint64_t checksum(std::uint64_t h, void const * p, std::size_t n)
+{
+    unsigned char const * c = static_cast<unsigned char const *>(p);
+    for (std::size_t i = 0; i < n; ++i){
+        h = (h ^ c[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+const std::uint64_t kChecksumSeed = 0xcbf29ce484222325ULL;
+
+} // namespace nodelog
+
+template<class T, class U, class Policy = DefaultPolicy>
+class NodeLog
+{
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<U>::value,
+                  "the log stores keys and items as raw bytes");
+
+public:
+    typedef RBTree<T, U, Policy> Tree;
+    typedef std::uint64_t Offset;
+
+    // Opens the log at path, creating it if need be.
+    explicit NodeLog(std::string const & path)
+    : fd_(::open(path.c_str(), O_RDWR | O_CREAT, 0644)), end_(0)
+    {
+        if (fd_ < 0)
+            throw std::runtime_error("NodeLog: cannot open " + path);
+        try {
+            struct stat st;
+            if (::fstat(fd_, &st) != 0)
+                throw std::runtime_error("NodeLog: cannot stat " + path);
+            if (st.st_size == 0){
+                create();
+            } else {
+                recover(static_cast<Offset>(st.st_size));
+            }
+        } catch (...) {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    NodeLog(NodeLog const &) = delete;
+    NodeLog & operator=(NodeLog const &) = delete;
+
+    ~NodeLog()
+    {
+        ::close(fd_);
+    }
+
+    // Root offsets of the committed versions, oldest first.
+    std::vector<Offset> const & commits() const
+    {
+        return commits_;
+    }
+
+    // Appends t and returns its root offset. Nodes shared with the version
+    // last committed or loaded are not written again.
+    Offset commit(Tree const & t)
+    {
+        std::vector<char> buf;
+        std::unordered_map<void const *, Offset> fresh;
+        std::unordered_set<void const *> kept;
+        std::vector<std::pair<View, bool>> stack;
+        if (!t.isEmpty())
+            stack.push_back(std::make_pair(t.view(), false));
+        while (!stack.empty()){
+            std::pair<View, bool> & top = stack.back();
+            View n = top.first;
+            if (ids_.count(n.id())){
+                kept.insert(n.id());
+                stack.pop_back();
+            } else if (!top.second){
+                top.second = true;
+                if (!n.right().isEmpty())
+                    stack.push_back(std::make_pair(n.right(), false));
+                if (!n.left().isEmpty())
+                    stack.push_back(std::make_pair(n.left(), false));
+            } else {
+                fresh[n.id()] = end_ + buf.size();
+                putNode(buf, n, offsetOf(n.left(), fresh), offsetOf(n.right(), fresh));
+                stack.pop_back();
+            }
+        }
+        Offset root = t.isEmpty() ? 0 : offsetOf(t.view(), fresh);
+        buf.push_back('C');
+        putRaw(buf, &root, sizeof(root));
+        std::uint64_t sum = nodelog::checksum(nodelog::kChecksumSeed, buf.data(), buf.size());
+        putRaw(buf, &sum, sizeof(sum));
+        append(buf);
+        commits_.push_back(root);
+        forgetDead(kept);
+        ids_.insert(fresh.begin(), fresh.end());
+        base_ = t;
+        return root;
+    }
+
+    // Reads back the version with the given root offset, and makes it the
+    // base that the next commit shares nodes with.
+    Tree load(Offset root)
+    {
+        ids_.clear();
+        base_ = Tree();
+        if (root == 0)
+            return Tree();
+        struct Frame
+        {
+            Offset at_;
+            Stored node_;
+            Tree kids_[2];
+            int done_;    // children read so far
+        };
+        std::vector<Frame> stack;
+        stack.push_back(Frame{ root, readNode(root), { Tree(), Tree() }, 0 });
+        Tree result;
+        while (!stack.empty()){
+            Frame & f = stack.back();
+            if (f.done_ < 2){
+                Offset child = f.done_ == 0 ? f.node_.left_ : f.node_.right_;
+                if (child != 0){
+                    stack.push_back(Frame{ child, readNode(child), { Tree(), Tree() }, 0 });
+                } else {
+                    ++f.done_;
+                }
+                continue;
+            }
+            result = Tree(f.node_.color_, f.kids_[0], f.node_.key_, f.node_.items_, f.kids_[1]);
+            ids_[result.id()] = f.at_;
+            stack.pop_back();
+            if (!stack.empty()){
+                Frame & parent = stack.back();
+                parent.kids_[parent.done_++] = result;
+            }
+        }
+        base_ = result;
+        return result;
+    }
+
+    // Makes everything appended so far durable.
+    void sync()
+    {
+        if (::fsync(fd_) != 0)
+            throw std::runtime_error("NodeLog: fsync failed");
+    }
+
+private:
+    typedef typename Tree::View View;
+    typedef typename Tree::ItemList ItemList;
+
+    struct Stored
+    {
+        Color color_;
+        Offset left_;
+        Offset right_;
+        T key_;
+        ItemList items_;
+    };
+
+    Offset offsetOf(View n, std::unordered_map<void const *, Offset> const & fresh) const
+    {
+        if (n.isEmpty())
+            return 0;
+        auto it = ids_.find(n.id());
+        return it != ids_.end() ? it->second : fresh.find(n.id())->second;
+    }
+
+    // Drops the offsets of base_ nodes that are not under any kept subtree;
+    // those are the nodes the new version replaced.
+    void forgetDead(std::unordered_set<void const *> const & kept)
+    {
+        std::vector<View> stack;
+        if (!base_.isEmpty())
+            stack.push_back(base_.view());
+        while (!stack.empty()){
+            View n = stack.back();
+            stack.pop_back();
+            if (kept.count(n.id()))
+                continue;
+            ids_.erase(n.id());
+            if (!n.left().isEmpty())
+                stack.push_back(n.left());
+            if (!n.right().isEmpty())
+                stack.push_back(n.right());
+        }
+    }
+
+    static void putRaw(std::vector<char> & buf, void const * p, std::size_t n)
+    {
+        char const * c = static_cast<char const *>(p);
+        buf.insert(buf.end(), c, c + n);
+    }
+
+    static void putNode(std::vector<char> & buf, View n, Offset left, Offset right)
+    {
+        buf.push_back('N');
+        buf.push_back(static_cast<char>(static_cast<signed char>(n.rootColor())));
+        putRaw(buf, &left, sizeof(left));
+        putRaw(buf, &right, sizeof(right));
+        putRaw(buf, &n.value(), sizeof(T));
+        std::uint64_t count = n.items().size();
+        putRaw(buf, &count, sizeof(count));
+        for (U const & u : n.items()){
+            putRaw(buf, &u, sizeof(U));
+        }
+    }
+
+    static const std::size_t kNodeFixed = 2 + 2 * sizeof(Offset) + sizeof(T) + sizeof(std::uint64_t);
+    static const std::size_t kCommitBytes = 1 + sizeof(Offset) + sizeof(std::uint64_t);
+
+    void read(Offset at, void * p, std::size_t n) const
+    {
+        char * c = static_cast<char *>(p);
+        while (n > 0){
+            ssize_t got = ::pread(fd_, c, n, static_cast<off_t>(at));
+            if (got <= 0)
+                throw std::runtime_error("NodeLog: read failed");
+            c += got;
+            at += got;
+            n -= got;
+        }
+    }
+
+    Stored readNode(Offset at) const
+    {
+        if (at < sizeof(nodelog::Header) || at + kNodeFixed > end_)
+            throw std::runtime_error("NodeLog: bad node offset");
+        char fixed[kNodeFixed];
+        read(at, fixed, kNodeFixed);
+        if (fixed[0] != 'N')
+            throw std::runtime_error("NodeLog: no node at offset");
+        Stored s;
+        s.color_ = static_cast<Color>(static_cast<signed char>(fixed[1]));
+        std::memcpy(&s.left_, fixed + 2, sizeof(Offset));
+        std::memcpy(&s.right_, fixed + 2 + sizeof(Offset), sizeof(Offset));
+        std::memcpy(&s.key_, fixed + 2 + 2 * sizeof(Offset), sizeof(T));
+        std::uint64_t count;
+        std::memcpy(&count, fixed + 2 + 2 * sizeof(Offset) + sizeof(T), sizeof(count));
+        if (count > (end_ - at - kNodeFixed) / sizeof(U))
+            throw std::runtime_error("NodeLog: bad node record");
+        std::vector<U> items(count);
+        if (count)
+            read(at + kNodeFixed, items.data(), count * sizeof(U));
+        for (auto it = items.rbegin(); it != items.rend(); ++it){
+            s.items_ = s.items_.push_front(*it);
+        }
+        return s;
+    }
+
+    void append(std::vector<char> const & buf)
+    {
+        char const * p = buf.data();
+        std::size_t n = buf.size();
+        while (n > 0){
+            ssize_t put = ::pwrite(fd_, p, n, static_cast<off_t>(end_));
+            if (put <= 0)
+                throw std::runtime_error("NodeLog: write failed");
+            p += put;
+            end_ += put;
+            n -= put;
+        }
+    }
+
+    void create()
+    {
+        nodelog::Header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic_, nodelog::kMagic, sizeof(h.magic_));
+        h.format_ = nodelog::kFormat;
+        h.byteOrder_ = nodelog::kByteOrder;
+        h.keyBytes_ = sizeof(T);
+        h.itemBytes_ = sizeof(U);
+        std::vector<char> buf;
+        putRaw(buf, &h, sizeof(h));
+        append(buf);
+    }
+
+    // The checksum of the file's bytes [at, at + n), continued from h.
+    std::uint64_t checksumOf(std::uint64_t h, Offset at, Offset n) const
+    {
+        char buf[64 * 1024];
+        while (n > 0){
+            std::size_t k = n < sizeof(buf) ? static_cast<std::size_t>(n) : sizeof(buf);
+            read(at, buf, k);
+            h = nodelog::checksum(h, buf, k);
+            at += k;
+            n -= k;
+        }
+        return h;
+    }
+
+    // Checks the header and finds the commits, cutting off everything after
+    // the last one that is whole and matches its checksum.
+    void recover(Offset size)
+    {
+        nodelog::Header h;
+        if (size < sizeof(h))
+            throw std::runtime_error("NodeLog: not a node log");
+        end_ = size;
+        read(0, &h, sizeof(h));
+        if (std::memcmp(h.magic_, nodelog::kMagic, sizeof(h.magic_)) != 0
+            || h.format_ != nodelog::kFormat
+            || h.byteOrder_ != nodelog::kByteOrder
+            || h.keyBytes_ != sizeof(T)
+            || h.itemBytes_ != sizeof(U))
+            throw std::runtime_error("NodeLog: not a node log of this type");
+        Offset at = sizeof(h);
+        Offset good = at;
+        while (at < size){
+            char tag;
+            read(at, &tag, 1);
+            if (tag == 'C' && at + kCommitBytes <= size){
+                Offset root;
+                std::uint64_t sum;
+                read(at + 1, &root, sizeof(root));
+                read(at + 1 + sizeof(root), &sum, sizeof(sum));
+                if (checksumOf(nodelog::kChecksumSeed, good, at + 1 + sizeof(root) - good) != sum)
+                    break;
+                commits_.push_back(root);
+                at += kCommitBytes;
+                good = at;
+            } else if (tag == 'N' && at + kNodeFixed <= size){
+                std::uint64_t count;
+                read(at + kNodeFixed - sizeof(count), &count, sizeof(count));
+                if (count > (size - at - kNodeFixed) / sizeof(U))
+                    break;
+                at += kNodeFixed + count * sizeof(U);
+            } else {
+                break;
+            }
+        }
+        if (good < size && ::ftruncate(fd_, static_cast<off_t>(good)) != 0)
+            throw std::runtime_error("NodeLog: cannot cut off partial commit");
+        end_ = good;
+    }
+
+    int fd_;
+    Offset end_;
+    std::vector<Offset> commits_;
+    // File offsets of the nodes of base_, which keeps them alive so that
+    // their addresses cannot be reused by other nodes.
+    std::unordered_map<void const *, Offset> ids_;
+    Tree base_;
+};
+
+#endif /* defined(__rbtree__nodelog__) */
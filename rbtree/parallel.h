@@ -0,0 +1,252 @@
+//
+//  parallel.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__parallel__
+#define __rbtree__parallel__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A fixed set of worker threads shared by every parallel tree operation,
+// with a deque of tasks each. Work is handed out as fork-join pairs: the
+// forking thread pushes one half onto the back of its own deque, runs the
+// other itself, and then pops its half back if nobody has stolen it, or
+// helps with other work until it is finished. An idle worker steals from
+// the front of another's deque, where the oldest and so, under a recursive
+// split, the largest pieces are. Threads outside the pool share one extra
+// deque. Each deque has its own lock, held only to push or pop, so threads
+// working on their own halves do not contend.
+class TaskPool
+{
+public:
+    struct Task
+    {
+        Task(void (*call)(void *), void * ctx)
+        : call_(call), ctx_(ctx), done_(false)
+        {}
+        
+        void run()
+        {
+            try {
+                call_(ctx_);
+            } catch (...) {
+                error_ = std::current_exception();
+            }
+            done_.store(true, std::memory_order_release);
+        }
+        
+        void (*call_)(void *);
+        void * ctx_;
+        std::atomic<bool> done_;
+        std::exception_ptr error_;
+    };
+    
+    // Never destroyed: workers simply stop with the process. The calling
+    // thread always takes part, so by default there is one worker fewer
+    // than there are cores; RBTREE_POOL_WORKERS overrides that.
+    static TaskPool & instance()
+    {
+#ifdef RBTREE_POOL_WORKERS
+        static TaskPool * p = new TaskPool(RBTREE_POOL_WORKERS);
+#else
+        static TaskPool * p = new TaskPool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+#endif
+        return *p;
+    }
+    
+    std::size_t workers() const
+    {
+        return workers_.size();
+    }
+    
+    void submit(Task * t)
+    {
+        Queue & q = own();
+        {
+            std::lock_guard<std::mutex> g(q.lock_);
+            q.tasks_.push_back(t);
+        }
+        queued_.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> g(idle_);
+        }
+        wake_.notify_one();
+    }
+    
+    // Takes t back off the calling thread's deque; false if it was stolen.
+    // On a worker t is at the back, above anything it forked since, which
+    // it has already joined; outside the pool other threads' tasks may sit
+    // above it.
+    bool retract(Task * t)
+    {
+        Queue & q = own();
+        std::lock_guard<std::mutex> g(q.lock_);
+        for (auto it = q.tasks_.rbegin(); it != q.tasks_.rend(); ++it){
+            if (*it == t){
+                q.tasks_.erase(std::next(it).base());
+                queued_.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Runs one task on the calling thread, its own newest or else one
+    // stolen, if there is one.
+    bool runOne()
+    {
+        Task * t = popOwn();
+        if (!t)
+            t = steal();
+        if (!t)
+            return false;
+        t->run();
+        return true;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex lock_;
+        std::deque<Task *> tasks_;
+    };
+    
+    explicit TaskPool(std::size_t n)
+    : queues_(n + 1), queued_(0)
+    {
+        for (std::size_t i = 0; i <= n; ++i){
+            queues_[i].reset(new Queue);
+        }
+        for (std::size_t i = 0; i < n; ++i){
+            workers_.emplace_back([this, i]{ work(i); });
+        }
+    }
+    
+    // Index of the calling thread's deque; the last is for threads outside
+    // the pool.
+    static std::size_t & self()
+    {
+        thread_local std::size_t i = ~std::size_t(0);
+        return i;
+    }
+    
+    Queue & own()
+    {
+        std::size_t i = self();
+        return *queues_[std::min(i, queues_.size() - 1)];
+    }
+    
+    Task * popOwn()
+    {
+        Queue & q = own();
+        std::lock_guard<std::mutex> g(q.lock_);
+        if (q.tasks_.empty())
+            return nullptr;
+        Task * t = q.tasks_.back();
+        q.tasks_.pop_back();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return t;
+    }
+    
+    // The oldest task of another deque, trying each once from the one after
+    // the caller's.
+    Task * steal()
+    {
+        if (queued_.load(std::memory_order_acquire) == 0)
+            return nullptr;
+        std::size_t n = queues_.size(), from = std::min(self(), n - 1);
+        for (std::size_t k = 1; k <= n; ++k){
+            Queue & q = *queues_[(from + k) % n];
+            std::lock_guard<std::mutex> g(q.lock_);
+            if (!q.tasks_.empty()){
+                Task * t = q.tasks_.front();
+                q.tasks_.pop_front();
+                queued_.fetch_sub(1, std::memory_order_relaxed);
+                return t;
+            }
+        }
+        return nullptr;
+    }
+    
+    // Sleeps only when no deque has anything in it; submit takes idle_
+    // after counting its task, so the wake-up cannot fall between the check
+    // and the wait.
+    void work(std::size_t i)
+    {
+        self() = i;
+        for (;;){
+            if (runOne())
+                continue;
+            std::unique_lock<std::mutex> g(idle_);
+            wake_.wait(g, [this]{ return queued_.load(std::memory_order_acquire) > 0; });
+        }
+    }
+    
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::atomic<std::size_t> queued_;
+    std::mutex idle_;
+    std::condition_variable wake_;
+    std::vector<std::thread> workers_;
+};
+
+// Runs f and g, possibly in parallel, returning once both are done.
+template<class F, class G>
+void forkJoin(F && f, G && g)
+{
+    TaskPool & pool = TaskPool::instance();
+    if (pool.workers() == 0){
+        f();
+        g();
+        return;
+    }
+    typedef typename std::remove_reference<F>::type Fn;
+    TaskPool::Task task([](void * ctx){ (*static_cast<Fn *>(ctx))(); },
+                        const_cast<void *>(static_cast<void const *>(std::addressof(f))));
+    pool.submit(&task);
+    std::exception_ptr error;
+    try {
+        g();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (pool.retract(&task)){
+        task.run();
+    } else {
+        while (!task.done_.load(std::memory_order_acquire)){
+            if (!pool.runOne())
+                std::this_thread::yield();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+    if (task.error_)
+        std::rethrow_exception(task.error_);
+}
+
+// How many levels of a balanced recursion to fork so that every worker has
+// a few pieces to pick from.
+inline int forkDepth()
+{
+    std::size_t n = TaskPool::instance().workers() + 1;
+    int d = 2;
+    while (n > 1){
+        n >>= 1;
+        ++d;
+    }
+    return d;
+}
+
+#endif /* defined(__rbtree__parallel__) */
@@ -0,0 +1,323 @@
+//
+//  pool.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__pool__
+#define __rbtree__pool__
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Per-thread slab pools for the small fixed-size blocks that tree nodes and
+// list items are made of. Each thread carves blocks out of its own slabs and
+// keeps its own free lists, so the common path takes no lock. Blocks freed on
+// another thread go onto that thread's free lists, which are capped: past two
+// batches of a size class, a batch is handed to a shared depot, where the
+// next thread to run dry picks it up before reserving a new slab. A thread
+// that only frees (a reader dropping old versions a writer made) so passes
+// its blocks back rather than hoarding them. Slabs are never handed back to
+// the system; when a thread exits its free blocks go to the depot too.
+
+struct PoolStats
+{
+    std::size_t liveBytes;       // handed out and not yet returned
+    std::size_t reclaimedBytes;  // returned to a free list over the lifetime
+    std::size_t slabBytes;       // reserved from the system
+};
+
+namespace pool {
+
+const std::size_t kAlign = 16;
+const std::size_t kMaxBlock = 256;
+const std::size_t kClasses = kMaxBlock / kAlign;
+const std::size_t kSlabSize = 64 * 1024;
+
+struct FreeBlock
+{
+    FreeBlock * next_;
+};
+
+inline std::size_t sizeClass(std::size_t bytes)
+{
+    return (bytes + kAlign - 1) / kAlign - 1;
+}
+
+// Blocks moved between a thread and the depot at a time: a slab's worth.
+inline std::size_t batchSize(std::size_t cls)
+{
+    return kSlabSize / ((cls + 1) * kAlign);
+}
+
+// The first n blocks of the list at head, cut off; head is left at the rest.
+inline FreeBlock * cut(FreeBlock * & head, std::size_t n)
+{
+    FreeBlock * first = head, * last = head;
+    for (std::size_t i = 1; i < n; ++i){
+        last = last->next_;
+    }
+    head = last->next_;
+    last->next_ = nullptr;
+    return first;
+}
+
+// Counters owned by one thread; other threads only ever read them.
+struct Counters
+{
+    Counters() : allocated_(0), reclaimed_(0), slabs_(0) {}
+    
+    static void bump(std::atomic<std::int64_t> & c, std::int64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    
+    std::atomic<std::int64_t> allocated_;
+    std::atomic<std::int64_t> reclaimed_;
+    std::atomic<std::int64_t> slabs_;
+};
+
+// Where threads leave the blocks they have too many of, whole batches at a
+// time, and exiting threads the rest. Deliberately never destroyed, so that
+// nodes outliving every thread-local pool can still be freed.
+struct Depot
+{
+    std::mutex lock_;
+    std::vector<FreeBlock *> batches_[kClasses];
+    FreeBlock * free_[kClasses] = {};
+    std::size_t count_[kClasses] = {};
+    std::vector<Counters *> threads_;
+    std::int64_t allocated_ = 0;
+    std::int64_t reclaimed_ = 0;
+    std::int64_t slabs_ = 0;
+    
+    static Depot & instance()
+    {
+        static Depot * d = new Depot;
+        return *d;
+    }
+    
+    void push(std::size_t cls, FreeBlock * b)
+    {
+        std::lock_guard<std::mutex> g(lock_);
+        b->next_ = free_[cls];
+        free_[cls] = b;
+        ++count_[cls];
+        reclaimed_ += (cls + 1) * kAlign;
+        allocated_ -= (cls + 1) * kAlign;
+    }
+    
+    // A batch of blocks, or as many as are loose if there is no whole batch;
+    // null if there are none. n is set to the number taken.
+    FreeBlock * take(std::size_t cls, std::size_t & n)
+    {
+        std::lock_guard<std::mutex> g(lock_);
+        if (!batches_[cls].empty()){
+            FreeBlock * b = batches_[cls].back();
+            batches_[cls].pop_back();
+            n = batchSize(cls);
+            return b;
+        }
+        n = count_[cls] < batchSize(cls) ? count_[cls] : batchSize(cls);
+        if (!n)
+            return nullptr;
+        count_[cls] -= n;
+        return cut(free_[cls], n);
+    }
+};
+
+class ThreadPool
+{
+public:
+    ThreadPool()
+    {
+        Depot & d = Depot::instance();
+        std::lock_guard<std::mutex> g(d.lock_);
+        d.threads_.push_back(&counters_);
+    }
+    
+    ~ThreadPool()
+    {
+        Depot & d = Depot::instance();
+        std::lock_guard<std::mutex> g(d.lock_);
+        for (std::size_t cls = 0; cls < kClasses; ++cls){
+            while (FreeBlock * b = free_[cls]){
+                free_[cls] = b->next_;
+                b->next_ = d.free_[cls];
+                d.free_[cls] = b;
+            }
+            d.count_[cls] += count_[cls];
+        }
+        d.allocated_ += counters_.allocated_.load();
+        d.reclaimed_ += counters_.reclaimed_.load();
+        d.slabs_ += counters_.slabs_.load();
+        for (auto it = d.threads_.begin(); it != d.threads_.end(); ++it){
+            if (*it == &counters_){
+                d.threads_.erase(it);
+                break;
+            }
+        }
+    }
+    
+    void * allocate(std::size_t cls)
+    {
+        FreeBlock * b = free_[cls];
+        if (!b){
+            b = refill(cls);
+        }
+        free_[cls] = b->next_;
+        --count_[cls];
+        Counters::bump(counters_.allocated_, (cls + 1) * kAlign);
+        return b;
+    }
+    
+    void deallocate(void * p, std::size_t cls)
+    {
+        FreeBlock * b = static_cast<FreeBlock *>(p);
+        b->next_ = free_[cls];
+        free_[cls] = b;
+        Counters::bump(counters_.allocated_, -std::int64_t((cls + 1) * kAlign));
+        Counters::bump(counters_.reclaimed_, (cls + 1) * kAlign);
+        if (++count_[cls] > 2 * batchSize(cls)){
+            flush(cls);
+        }
+    }
+
+private:
+    FreeBlock * refill(std::size_t cls)
+    {
+        std::size_t n;
+        if (FreeBlock * b = Depot::instance().take(cls, n)){
+            count_[cls] = n;
+            return free_[cls] = b;
+        }
+        std::size_t block = (cls + 1) * kAlign;
+        char * slab = static_cast<char *>(::operator new(kSlabSize));
+        Counters::bump(counters_.slabs_, kSlabSize);
+        FreeBlock * head = nullptr;
+        for (std::size_t off = kSlabSize - kSlabSize % block; off >= block; off -= block){
+            FreeBlock * b = reinterpret_cast<FreeBlock *>(slab + off - block);
+            b->next_ = head;
+            head = b;
+        }
+        count_[cls] = batchSize(cls);
+        return free_[cls] = head;
+    }
+    
+    // Hands a batch from the front of the free list to the depot.
+    void flush(std::size_t cls)
+    {
+        FreeBlock * b = cut(free_[cls], batchSize(cls));
+        count_[cls] -= batchSize(cls);
+        Depot & d = Depot::instance();
+        std::lock_guard<std::mutex> g(d.lock_);
+        d.batches_[cls].push_back(b);
+    }
+    
+    FreeBlock * free_[kClasses] = {};
+    std::size_t count_[kClasses] = {};
+    Counters counters_;
+};
+
+// Set once the calling thread's pool has been torn down; later frees on that
+// thread (static destructors, mostly) go straight to the depot.
+inline bool & threadDone()
+{
+    thread_local bool done = false;
+    return done;
+}
+
+struct ThreadPoolHolder
+{
+    ~ThreadPoolHolder() { threadDone() = true; }
+    ThreadPool pool_;
+};
+
+inline ThreadPool * threadPool()
+{
+    if (threadDone())
+        return nullptr;
+    thread_local ThreadPoolHolder holder;
+    return &holder.pool_;
+}
+
+inline void * allocate(std::size_t bytes)
+{
+    if (bytes > kMaxBlock)
+        return ::operator new(bytes);
+    ThreadPool * tp = threadPool();
+    if (!tp)
+        return ::operator new((sizeClass(bytes) + 1) * kAlign);
+    return tp->allocate(sizeClass(bytes));
+}
+
+inline void deallocate(void * p, std::size_t bytes)
+{
+    if (bytes > kMaxBlock){
+        ::operator delete(p);
+        return;
+    }
+    ThreadPool * tp = threadPool();
+    if (tp){
+        tp->deallocate(p, sizeClass(bytes));
+    } else {
+        Depot::instance().push(sizeClass(bytes), static_cast<FreeBlock *>(p));
+    }
+}
+
+} // namespace pool
+
+// Totals over every thread that has used the pool, live or exited.
+inline PoolStats poolStats()
+{
+    pool::Depot & d = pool::Depot::instance();
+    std::lock_guard<std::mutex> g(d.lock_);
+    std::int64_t allocated = d.allocated_, reclaimed = d.reclaimed_, slabs = d.slabs_;
+    for (pool::Counters * c : d.threads_){
+        allocated += c->allocated_.load(std::memory_order_relaxed);
+        reclaimed += c->reclaimed_.load(std::memory_order_relaxed);
+        slabs += c->slabs_.load(std::memory_order_relaxed);
+    }
+    PoolStats s;
+    s.liveBytes = static_cast<std::size_t>(allocated);
+    s.reclaimedBytes = static_cast<std::size_t>(reclaimed);
+    s.slabBytes = static_cast<std::size_t>(slabs);
+    return s;
+}
+
+template<class T>
+struct PoolAllocator
+{
+    typedef T value_type;
+    
+    PoolAllocator() noexcept {}
+    
+    template<class Y>
+    PoolAllocator(PoolAllocator<Y> const &) noexcept {}
+    
+    T * allocate(std::size_t n)
+    {
+        static_assert(alignof(T) <= pool::kAlign, "PoolAllocator: over-aligned type");
+        return static_cast<T *>(pool::allocate(n * sizeof(T)));
+    }
+    
+    void deallocate(T * p, std::size_t n) noexcept
+    {
+        pool::deallocate(p, n * sizeof(T));
+    }
+};
+
+template<class T, class Y>
+bool operator==(PoolAllocator<T> const &, PoolAllocator<Y> const &) { return true; }
+
+template<class T, class Y>
+bool operator!=(PoolAllocator<T> const &, PoolAllocator<Y> const &) { return false; }
+
+#endif /* defined(__rbtree__pool__) */
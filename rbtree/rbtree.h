@@ -12,9 +12,21 @@
 #include <iostream>
 #include <cassert>
 #include <memory>
+#include <algorithm>
 #include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-#include "List.h"
+#include "list.h"
+#include "itemseq.h"
+#include "pool.h"
+#include "refcount.h"
+#include "augment.h"
+#include "parallel.h"
+#include "search.h"
+#include "stats.h"
 
 enum Color
 {
@@ -47,26 +59,134 @@ inline Color operator--(Color &c, int) {
     return static_cast<Color>(c + 1);
 }
 
-template<class T, class U>
+// Compile-time knobs for RBTree. Derive from DefaultPolicy and override
+// only what differs.
+struct DefaultPolicy
+{
+    // Allocator used for tree nodes and the chunks of their item sequences.
+    template<class X> using allocator = PoolAllocator<X>;
+    // Reference count embedded in each node and item chunk.
+    typedef AtomicCount refcount;
+    // Items of a key kept inline in its node before spilling into chunks.
+    static const std::size_t inlineItems = 4;
+    // Keep subtree sizes in each node for size(), rank() and select().
+    static const bool orderStatistics = false;
+    // Monoid over items cached in each node for aggregate(); see augment.h.
+    typedef NoMonoid monoid;
+    // Bytes of keys in each BTree node; see btree.h. Nodes this wide are
+    // allocated outside the pool.
+    static const std::size_t btreeNodeBytes = 256;
+};
+
+struct HeapPolicy : DefaultPolicy
+{
+    template<class X> using allocator = std::allocator<X>;
+};
+
+// For trees confined to one thread: plain, non-atomic node counts.
+struct LocalPolicy : DefaultPolicy
+{
+    typedef LocalCount refcount;
+};
+
+struct OrderStatPolicy : DefaultPolicy
+{
+    static const bool orderStatistics = true;
+};
+
+template<class T, class U, class Policy = DefaultPolicy>
 class RBTree
 {
-    struct Node
+public:
+    typedef ItemSeq<U,
+                    Policy::inlineItems,
+                    typename Policy::template allocator<U>,
+                    typename Policy::refcount> ItemList;
+    typedef typename Policy::monoid Monoid;
+    typedef typename MonoidSummary<Monoid>::value_type Aggregate;
+    
+private:
+    struct Node;
+    typedef IntrusivePtr<const Node> NodePtr;
+    typedef typename Policy::template allocator<Node> NodeAlloc;
+    
+    struct Node : OrderStats<Policy::orderStatistics>, MonoidSummary<typename Policy::monoid>
     {
+        template<class V, class L>
         Node(Color c,
-             std::shared_ptr<const Node> const & lft,
-             T val,
-             List<U> items,
-             std::shared_ptr<const Node> const & rgt)
-        : c_(c), lft_(lft), val_(val), items_(items), rgt_(rgt)
-        {}
+             NodePtr const & lft,
+             V && val,
+             L && items,
+             NodePtr const & rgt)
+        : c_(c), lft_(lft), val_(std::forward<V>(val)), items_(std::forward<L>(items)), rgt_(rgt)
+        {
+            update();
+        }
+        
+        // src's key and items between new children; its summary of its own
+        // items is still good, so only the subtree summaries are redone.
+        Node(Color c, NodePtr const & lft, Node const * src, NodePtr const & rgt)
+        : c_(c), lft_(lft), val_(src->val_), items_(src->items_), rgt_(rgt)
+        {
+            this->count(lft_.get(), rgt_.get(), items_.size());
+            this->reuse(src, lft_.get(), rgt_.get());
+        }
+        
+        void update()
+        {
+            this->count(lft_.get(), rgt_.get(), items_.size());
+            this->reduce(lft_.get(), rgt_.get(), items_);
+        }
+        
+        // As update, for a node whose items are unchanged.
+        void relink()
+        {
+            this->count(lft_.get(), rgt_.get(), items_.size());
+            this->reuse(this, lft_.get(), rgt_.get());
+        }
+        
+        template<class V, class L>
+        static NodePtr make(Color c, NodePtr const & lft, V && val, L && items, NodePtr const & rgt)
+        {
+            RBTREE_COUNT(NODES_ALLOCATED);
+            NodeAlloc alloc;
+            Node * n = std::allocator_traits<NodeAlloc>::allocate(alloc, 1);
+            std::allocator_traits<NodeAlloc>::construct(alloc, n, c, lft,
+                                                        std::forward<V>(val),
+                                                        std::forward<L>(items),
+                                                        rgt);
+            return NodePtr(n);
+        }
+        
+        static NodePtr make(Color c, NodePtr const & lft, Node const * src, NodePtr const & rgt)
+        {
+            RBTREE_COUNT(NODES_ALLOCATED);
+            NodeAlloc alloc;
+            Node * n = std::allocator_traits<NodeAlloc>::allocate(alloc, 1);
+            std::allocator_traits<NodeAlloc>::construct(alloc, n, c, lft, src, rgt);
+            return NodePtr(n);
+        }
+        
+        static void destroy(Node const * n)
+        {
+            NodeAlloc alloc;
+            Node * p = const_cast<Node *>(n);
+            std::allocator_traits<NodeAlloc>::destroy(alloc, p);
+            std::allocator_traits<NodeAlloc>::deallocate(alloc, p, 1);
+        }
+        
+        typename Policy::refcount refs_;
         Color c_;
-        std::shared_ptr<const Node> lft_;
+        NodePtr lft_;
         T val_;
-        List<U> items_;
-        std::shared_ptr<const Node> rgt_;
+        ItemList items_;
+        NodePtr rgt_;
     };
     
-    explicit RBTree(std::shared_ptr<const Node> const & node)
+    // Red-black height is at most twice the log of the size.
+    static const int kMaxDepth = 2 * 8 * sizeof(std::size_t);
+    
+    explicit RBTree(NodePtr const & node)
     : root_(node)
     {}
     
@@ -74,36 +194,75 @@ public:
     
     RBTree() {} // empty tree
     
-    RBTree(Color c, RBTree const & lft, T val, List<U> items, RBTree const & rgt)
-    : root_(std::make_shared<const Node>(c, lft.root_, val, items, rgt.root_))
+    // The key and items are forwarded into the new node, so passing them as
+    // rvalues moves rather than copies them.
+    template<class V, class L,
+             class = typename std::enable_if<std::is_convertible<V, T>::value
+                                             && std::is_convertible<L, ItemList>::value>::type>
+    RBTree(Color c, RBTree const & lft, V && val, L && items, RBTree const & rgt)
+    : root_(Node::make(c, lft.root_, std::forward<V>(val), std::forward<L>(items), rgt.root_))
     {
-        assert(lft.isEmpty() || lft.value() < val);
-        assert(rgt.isEmpty() || val < rgt.value());
+        assert(lft.isEmpty() || lft.value() < value());
+        assert(rgt.isEmpty() || value() < rgt.value());
     }
     
-    RBTree(std::initializer_list<T> init)
+    RBTree(std::initializer_list<std::pair<T, U>> init)
     {
         RBTree t;
-        for (T v : init)
+        for (auto const & v : init)
         {
-            t = t.insert(v);
+            t = t.insert(v.first, v.second);
         }
         root_ = t.root_;
     }
     
+    // Builds a tree in O(n) from (key, items) pairs in strictly increasing
+    // key order. No rebalancing is done: the tree comes out perfectly
+    // balanced, all black but for the bottom level when that is not full.
+    template<class It>
+    static RBTree fromSorted(It first, It last)
+    {
+        return fromSortedParallel(first, last, 0);
+    }
+    
+    // As fromSorted, building the two halves of any range longer than grain
+    // on separate threads. A grain of 0 builds sequentially.
+    template<class It>
+    static RBTree fromSortedParallel(It first, It last, std::size_t grain = 1 << 16)
+    {
+        typedef typename std::iterator_traits<It>::iterator_category Category;
+        if (!std::is_base_of<std::random_access_iterator_tag, Category>::value){
+            std::vector<typename std::iterator_traits<It>::value_type> v(first, last);
+            return fromSortedParallel(v.begin(), v.end(), grain);
+        }
+        std::size_t n = std::distance(first, last);
+        return checked(build(first, n, 0, redDepth(n), grain));
+    }
+    
     struct Contents
     {
         T value_;
-        List<U> items_;
+        ItemList items_;
     public:
         Contents()
-        : value_(-1), items_(List<U>())
+        : value_(missing()), items_(ItemList())
         {}
-        Contents(T value, List<U> items)
+        Contents(T const & value, ItemList const & items)
         : value_(value), items_(items)
         {}
-        T value() const { return value_; }
-        List<U> items() const { return items_; }
+        T const & value() const { return value_; }
+        ItemList const & items() const { return items_; }
+    private:
+        // -1 for arithmetic keys, as it always was; other keys have no such
+        // value, so they get a default-constructed one.
+        static T missing()
+        {
+            if constexpr (std::is_arithmetic<T>::value){
+                return T(-1);
+            } else {
+                return T();
+            }
+        }
     };
     
     bool isEmpty() const
@@ -111,7 +270,9 @@ public:
         return !root_;
     }
     
-    T value() const
+    // value() and items() refer into the root node, which is immutable and
+    // lives as long as any tree sharing it.
+    T const & value() const
     {
         assert(!isEmpty());
         return root_->val_;
@@ -123,7 +284,7 @@ public:
         return root_->c_;
     }
     
-    List<U> items() const
+    ItemList const & items() const
     {
         assert(!isEmpty());
         return root_->items_;
@@ -141,119 +302,516 @@ public:
         return RBTree(root_->rgt_);
     }
     
-    RBTree insert(T x, U item) const
+    // Identity of the root node. Versions that share a subtree give the same
+    // id for it, and equal ids mean equal contents; null for an empty tree.
+    void const * id() const
+    {
+        return root_.get();
+    }
+    
+    // Size of one tree node, items stored inline included.
+    static std::size_t nodeBytes()
+    {
+        return sizeof(Node);
+    }
+    
+    RBTree insert(T const & x, U const & item) const
+    {
+        return emplace(x, item);
+    }
+    
+    RBTree insert(T && x, U && item) const
+    {
+        return emplace(std::move(x), std::move(item));
+    }
+    
+    // Adds an item built in place from args under key x; a new key is moved
+    // into its node when given as an rvalue.
+    template<class... Args>
+    RBTree emplace(T const & x, Args &&... args) const
     {
-        RBTree t = ins(x, item);
-        return RBTree(BLACK, t.left(), t.value(), t.items(), t.right());
+        RBTREE_COUNT(OPERATIONS);
+        return checked(blackRoot(ins(x, std::forward<Args>(args)...)));
     }
     
-    RBTree remove(T x) const
+    template<class... Args>
+    RBTree emplace(T && x, Args &&... args) const
     {
+        RBTREE_COUNT(OPERATIONS);
+        return checked(blackRoot(ins(std::move(x), std::forward<Args>(args)...)));
+    }
+    
+    RBTree remove(T const & x) const
+    {
+        RBTREE_COUNT(OPERATIONS);
+        if (isEmpty()){
+            return *this;
+        }
         if (value() == x && childless()){
             return RBTree();
         }
-        RBTree r = rem(x);
-        return RBTree(BLACK, r.left(), r.value(), r.items(), r.right());
+        return checked(blackRoot(rem(x)));
     }
     
-    RBTree remove(T x, U item) const
+    RBTree remove(T const & x, U const & item) const
     {
+        RBTREE_COUNT(OPERATIONS);
+        if (isEmpty()){
+            return *this;
+        }
         if (value() == x && childless()){
-            List<U> n = items().remove(item);
+            if (!items().contains(item)){
+                return *this;
+            }
+            ItemList n = items().remove(item);
             if (n.size() < 1){
                 return RBTree();
             } else {
-                return RBTree<T, U>(rootColor(), left(), value(), n, right());
+                return checked(RBTree(rootColor(), left(), value(), n, right()));
             }
         }
-        RBTree r = rem(x, item);
-        return RBTree(BLACK, r.left(), r.value(), r.items(), r.right());
+        return checked(blackRoot(rem(x, item)));
+    }
+    
+    // Non-owning handle on a subtree for read-only descents, which would
+    // otherwise take and drop a reference at every step. Only valid while
+    // the tree it was taken from is alive.
+    class View
+    {
+    public:
+        bool isEmpty() const
+        {
+            return !n_;
+        }
+        
+        T const & value() const
+        {
+            assert(!isEmpty());
+            return n_->val_;
+        }
+        
+        Color rootColor() const
+        {
+            assert(!isEmpty());
+            return n_->c_;
+        }
+        
+        ItemList const & items() const
+        {
+            assert(!isEmpty());
+            return n_->items_;
+        }
+        
+        View left() const
+        {
+            assert(!isEmpty());
+            return View(n_->lft_.get());
+        }
+        
+        View right() const
+        {
+            assert(!isEmpty());
+            return View(n_->rgt_.get());
+        }
+        
+        void const * id() const
+        {
+            return n_;
+        }
+        
+    private:
+        friend class RBTree;
+        explicit View(Node const * n) : n_(n) {}
+        Node const * n_;
+    };
+    
+    View view() const
+    {
+        return View(root_.get());
     }
     
-    bool member(T x) const
+    // The key and items of src's node between lft and rgt, for rebuilding a
+    // node with new children or a new colour without recomputing what it
+    // caches about its items.
+    RBTree(Color c, RBTree const & lft, View src, RBTree const & rgt)
+    : root_(Node::make(c, lft.root_, src.n_, rgt.root_))
     {
-        if (isEmpty())
-            return false;
-        T y = value();
-        if (x < y)
-            return left().member(x);
-        else if (y < x)
-            return right().member(x);
-        else
-            return true;
+        assert(lft.isEmpty() || lft.value() < value());
+        assert(rgt.isEmpty() || value() < rgt.value());
     }
     
-    List<U> getItems(T x)
+    // Batch editor that changes nodes in place; see transient.h.
+    class Transient;
+    
+    template<class, class, class> friend class VersionedRBTree;
+    
+    bool member(T const & x) const
     {
-        if (isEmpty()){
-            return NULL;
-        }
-        T y = value();
-        if (y > x){
-            return left().getItems(x);
-        } else if (x > y){
-            return right().getItems(x);
-        } else {
-            return items();
-        }
+        return !find(x).isEmpty();
     }
     
-    Contents getNodeJustGreaterThan(T x)
+    ItemList getItems(T const & x) const
     {
-        if (isEmpty()){
-            return Contents();
+        View t = find(x);
+        return t.isEmpty() ? ItemList() : t.items();
+    }
+    
+    // Lookups of many keys at once: out[i] gets member(first[i]). Several
+    // descents are interleaved, each prefetching the node it visits next, so
+    // that the cache misses of one overlap with the steps of the others.
+    // Out must be random access.
+    template<class It, class Out>
+    void memberBatch(It first, It last, Out out) const
+    {
+        findBatch(first, last, [&](std::size_t i, Node const * n){ out[i] = n != nullptr; });
+    }
+    
+    // As memberBatch, with out[i] = getItems(first[i]).
+    template<class It, class Out>
+    void getItemsBatch(It first, It last, Out out) const
+    {
+        findBatch(first, last, [&](std::size_t i, Node const * n){ out[i] = n ? n->items_ : ItemList(); });
+    }
+    
+    std::vector<bool> memberBatch(std::vector<T> const & keys) const
+    {
+        std::vector<bool> v(keys.size());
+        memberBatch(keys.begin(), keys.end(), v.begin());
+        return v;
+    }
+    
+    std::vector<ItemList> getItemsBatch(std::vector<T> const & keys) const
+    {
+        std::vector<ItemList> v(keys.size());
+        getItemsBatch(keys.begin(), keys.end(), v.begin());
+        return v;
+    }
+    
+    // In-order iteration over (key, items) entries. An iterator keeps the
+    // path from the root to its node on a fixed stack, so nodes need no
+    // parent pointers; it dereferences to a View of the node and, like a
+    // View, is only valid while the tree is alive. Copies take only the
+    // occupied part of the stack, about twice the log of the size. Views
+    // are handed out by value, never as references into the iterator, so
+    // that adaptors such as std::reverse_iterator, which dereference a
+    // temporary copy, are safe.
+    class const_iterator
+    {
+    public:
+        // What operator-> returns: a View to call through.
+        struct Arrow
+        {
+            View v_;
+            View const * operator->() const { return &v_; }
+        };
+        
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef View value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Arrow pointer;
+        typedef View reference;
+        
+        const_iterator() : root_(nullptr), depth_(0), cur_(nullptr) {}
+        
+        const_iterator(const_iterator const & other)
+        : root_(other.root_), depth_(other.depth_), cur_(other.cur_)
+        {
+            std::copy(other.path_, other.path_ + depth_, path_);
+        }
+        
+        const_iterator & operator=(const_iterator const & other)
+        {
+            root_ = other.root_;
+            depth_ = other.depth_;
+            cur_ = other.cur_;
+            std::copy(other.path_, other.path_ + depth_, path_);
+            return *this;
+        }
+        
+        reference operator*() const
+        {
+            assert(depth_ > 0);
+            return cur_;
         }
-        T y = value();
-        if (y > x){
-            if (left().isEmpty()){
-                return Contents(value(), items());
+        
+        pointer operator->() const
+        {
+            assert(depth_ > 0);
+            return Arrow{ cur_ };
+        }
+        
+        const_iterator & operator++()
+        {
+            assert(depth_ > 0);
+            Node const * n = path_[depth_ - 1];
+            if (n->rgt_){
+                push(n->rgt_.get());
+                descend(&Node::lft_);
             } else {
-                Contents lft = left().getNodeJustGreaterThan(x);
-                return lft.value() < value() ? lft : Contents(value(), items());
+                ascendFrom(&Node::rgt_);
             }
-        } else {
-            if (right().isEmpty()){
-                return Contents();
+            settle();
+            return *this;
+        }
+        
+        const_iterator operator++(int)
+        {
+            const_iterator old(*this);
+            ++*this;
+            return old;
+        }
+        
+        // Decrementing end() gives the last entry.
+        const_iterator & operator--()
+        {
+            if (depth_ == 0){
+                assert(root_);
+                push(root_);
+                descend(&Node::rgt_);
+            } else {
+                Node const * n = path_[depth_ - 1];
+                if (n->lft_){
+                    push(n->lft_.get());
+                    descend(&Node::rgt_);
+                } else {
+                    ascendFrom(&Node::lft_);
+                }
+            }
+            settle();
+            return *this;
+        }
+        
+        const_iterator operator--(int)
+        {
+            const_iterator old(*this);
+            --*this;
+            return old;
+        }
+        
+        bool operator==(const_iterator const & other) const
+        {
+            return cur_.n_ == other.cur_.n_;
+        }
+        
+        bool operator!=(const_iterator const & other) const
+        {
+            return cur_.n_ != other.cur_.n_;
+        }
+        
+    private:
+        friend class RBTree;
+        
+        explicit const_iterator(Node const * root)
+        : root_(root), depth_(0), cur_(nullptr)
+        {}
+        
+        void push(Node const * n)
+        {
+            assert(depth_ < kMaxDepth);
+            path_[depth_++] = n;
+        }
+        
+        void descend(NodePtr Node::* side)
+        {
+            while ((path_[depth_ - 1]->*side)){
+                push((path_[depth_ - 1]->*side).get());
+            }
+        }
+        
+        // Pops up past every ancestor reached through side; what is left on
+        // top is the next node in the other direction, if any.
+        void ascendFrom(NodePtr Node::* side)
+        {
+            Node const * child = path_[--depth_];
+            while (depth_ > 0 && (path_[depth_ - 1]->*side).get() == child){
+                child = path_[--depth_];
+            }
+        }
+        
+        void settle()
+        {
+            cur_ = View(depth_ > 0 ? path_[depth_ - 1] : nullptr);
+        }
+        
+        Node const * root_;
+        int depth_;
+        View cur_;
+        Node const * path_[kMaxDepth];
+    };
+    
+    typedef const_iterator iterator;
+    
+    // Entries with keys in [lo, hi), empty unless lo < hi. A Range holds the
+    // tree and the bounds, not iterators, so it is cheap to copy and keeps
+    // the tree alive; begin() and end() each descend to find their entry.
+    class Range
+    {
+    public:
+        Range(RBTree const & t, T const & lo, T const & hi) : t_(t), lo_(lo), hi_(hi) {}
+        const_iterator begin() const { return t_.lower_bound(lo_); }
+        const_iterator end() const { return lo_ < hi_ ? t_.lower_bound(hi_) : begin(); }
+        bool empty() const { return begin() == end(); }
+    private:
+        RBTree t_;
+        T lo_;
+        T hi_;
+    };
+    
+    const_iterator begin() const
+    {
+        const_iterator it(root_.get());
+        if (root_){
+            it.push(root_.get());
+            it.descend(&Node::lft_);
+        }
+        it.settle();
+        return it;
+    }
+    
+    const_iterator end() const
+    {
+        return const_iterator(root_.get());
+    }
+    
+    // First entry whose key is not less than x.
+    const_iterator lower_bound(T const & x) const
+    {
+        return bound(x, false);
+    }
+    
+    // First entry whose key is greater than x.
+    const_iterator upper_bound(T const & x) const
+    {
+        return bound(x, true);
+    }
+    
+    std::pair<const_iterator, const_iterator> equal_range(T const & x) const
+    {
+        return std::make_pair(lower_bound(x), upper_bound(x));
+    }
+    
+    Range range(T const & lo, T const & hi) const
+    {
+        return Range(*this, lo, hi);
+    }
+    
+    // Number of keys. Needs Policy::orderStatistics, as do totalItems(),
+    // rank() and select(); each is O(log n) or better.
+    std::size_t size() const
+    {
+        static_assert(Policy::orderStatistics, "size() needs a policy with orderStatistics");
+        return root_ ? root_->size_ : 0;
+    }
+    
+    // Number of items across all keys.
+    std::size_t totalItems() const
+    {
+        static_assert(Policy::orderStatistics, "totalItems() needs a policy with orderStatistics");
+        return root_ ? root_->totalItems_ : 0;
+    }
+    
+    // Number of keys less than x.
+    std::size_t rank(T const & x) const
+    {
+        static_assert(Policy::orderStatistics, "rank() needs a policy with orderStatistics");
+        std::size_t r = 0;
+        Node const * n = root_.get();
+        while (n){
+            if (n->val_ < x){
+                r += 1 + sizeOf(n->lft_);
+                n = n->rgt_.get();
             } else {
-                return right().getNodeJustGreaterThan(x);
+                n = n->lft_.get();
             }
         }
+        return r;
     }
     
-    void checkRed() const
+    // The entry with k keys before it, or end() if there are not that many.
+    const_iterator select(std::size_t k) const
     {
-        if (!isEmpty())
-        {
-            auto lft = left();
-            auto rgt = right();
-            if (rootColor() == RED)
-            {
-                assert(lft.isEmpty() || lft.rootColor() == BLACK);
-                assert(rgt.isEmpty() || rgt.rootColor() == BLACK);
+        static_assert(Policy::orderStatistics, "select() needs a policy with orderStatistics");
+        const_iterator it(root_.get());
+        Node const * n = root_.get();
+        while (n){
+            it.push(n);
+            std::size_t lft = sizeOf(n->lft_);
+            if (k < lft){
+                n = n->lft_.get();
+            } else if (k == lft){
+                it.settle();
+                return it;
+            } else {
+                k -= lft + 1;
+                n = n->rgt_.get();
             }
-            lft.checkRed();
-            rgt.checkRed();
         }
+        return end();
     }
     
-    int countBlack() const
+    // Policy::monoid over every item in the tree, in O(1).
+    Aggregate aggregate() const
     {
-        if (isEmpty())
-            return 0;
-        int lft = left().countBlack();
-        int rgt = right().countBlack();
-        assert(lft == rgt);
-        int blk;
-        if (rootColor() == BLACK){
-            blk = 1;
-        } else if (rootColor() == DOUBLE_BLACK){
-            blk = 2;
-        } else if (rootColor() == NEGATIVE_BLACK){
-            blk = -1;
-        } else {
-            blk = 0;
+        static_assert(!std::is_same<Monoid, NoMonoid>::value, "aggregate() needs a policy with a monoid");
+        return Node::totalOf(root_.get());
+    }
+    
+    // Policy::monoid over the items of keys in [lo, hi), in O(log n).
+    Aggregate aggregate(T const & lo, T const & hi) const
+    {
+        static_assert(!std::is_same<Monoid, NoMonoid>::value, "aggregate() needs a policy with a monoid");
+        Node const * n = root_.get();
+        // Find the top of the range; below it the bounds separate.
+        while (n && (n->val_ < lo || !(n->val_ < hi))){
+            n = n->val_ < lo ? n->rgt_.get() : n->lft_.get();
+        }
+        if (!n)
+            return Monoid::identity();
+        Aggregate fromLo = Monoid::identity();
+        for (Node const * m = n->lft_.get(); m; ){
+            if (m->val_ < lo){
+                m = m->rgt_.get();
+            } else {
+                fromLo = Monoid::combine(Monoid::combine(m->self_, Node::totalOf(m->rgt_.get())), fromLo);
+                m = m->lft_.get();
+            }
         }
-        return blk + lft;
+        Aggregate toHi = Monoid::identity();
+        for (Node const * m = n->rgt_.get(); m; ){
+            if (m->val_ < hi){
+                toHi = Monoid::combine(toHi, Monoid::combine(Node::totalOf(m->lft_.get()), m->self_));
+                m = m->rgt_.get();
+            } else {
+                m = m->lft_.get();
+            }
+        }
+        return Monoid::combine(Monoid::combine(fromLo, n->self_), toHi);
+    }
+    
+    Contents getNodeJustGreaterThan(T const & x) const
+    {
+        const_iterator it = upper_bound(x);
+        return it == end() ? Contents() : Contents(it->value(), it->items());
+    }
+    
+    // Single pass over the tree checking ordering, colours, the red rule
+    // and equal black heights. Returns the black height, or -1 if any
+    // invariant is broken. Usable from tests regardless of NDEBUG.
+    int blackHeight() const
+    {
+        if (!isEmpty() && rootColor() != BLACK)
+            return -1;
+        return validate(root_.get(), nullptr, nullptr, false);
+    }
+    
+    bool isValid() const
+    {
+        return blackHeight() >= 0;
+    }
+    
+    void checkInvariants() const
+    {
+        assert(isValid());
     }
     
     void printVal() const
@@ -264,8 +822,7 @@ public:
     void printTree() const
     {
         std::cout << "Checking tree..." <<std::endl;
-        checkRed();
-        countBlack();
+        checkInvariants();
         std::cout << "Printing tree..." <<std::endl;
         prTree();
     }
@@ -282,197 +839,443 @@ private:
         Z z_;
     };
     
-    RBTree ins(T x, U item) const
+    // Depth of the bottom level of a balanced tree of n nodes, or -1 if
+    // that level is full and the whole tree can be black.
+    static int redDepth(std::size_t n)
     {
-        checkRed();
-        if (isEmpty()) {
-            return RBTree(RED, RBTree(), x, List<U>(item, List<U>()), RBTree());
-        }
-        T y = value();
-        List<U> yi = items();
-        Color c = rootColor();
-        if (x < y)
-            return balance(c, left().ins(x, item), y, yi, right());
-        else if (y < x)
-            return balance(c, left(), y, yi, right().ins(x, item));
-        else
-            return RBTree(c, left(), y, yi.push_front(item), right());
+        int d = 0;
+        while ((std::size_t(2) << d) - 1 < n)
+            ++d;
+        return (std::size_t(2) << d) - 1 == n ? -1 : d;
     }
     
-    RBTree rem(T x) const
+    template<class It>
+    static RBTree build(It first, std::size_t n, int depth, int red, std::size_t grain)
     {
-        T y = value();
-        List<U> yi = items();
-        Color c = rootColor();
-        if (x < y) {
-            return balance(c, left().rem(x), y, yi, right());
-        } else if (y < x) {
-            return balance(c, left(), y, yi, right().rem(x));
+        if (n == 0)
+            return RBTree();
+        std::size_t mid = n / 2;
+        It m = std::next(first, mid);
+        RBTree lft, rgt;
+        auto buildLeft = [&]{ lft = build(first, mid, depth + 1, red, grain); };
+        auto buildRight = [&]{ rgt = build(std::next(m), n - mid - 1, depth + 1, red, grain); };
+        if (grain && n > grain){
+            forkJoin(buildLeft, buildRight);
         } else {
-            if (!left().isEmpty()){
-                StateContainer<RBTree, RBTree> s = left().getRemoveMax();
-                return balance(c, s.y_, s.z_.value(), s.z_.items(), right());
-            } else if (!right().isEmpty()){
-                StateContainer<RBTree, RBTree> s = right().getRemoveMin();
-                return balance(c, left(), s.z_.value(), s.z_.items(), s.y_);
+            buildLeft();
+            buildRight();
+        }
+        return RBTree(depth == red ? RED : BLACK, lft, m->first, ItemList(m->second), rgt);
+    }
+    
+    static std::size_t sizeOf(NodePtr const & n)
+    {
+        return n ? n->size_ : 0;
+    }
+    
+    // Descends towards x keeping the path, then cuts it back to the last
+    // node that qualified: key >= x, or key > x when strict.
+    const_iterator bound(T const & x, bool strict) const
+    {
+        const_iterator it(root_.get());
+        int keep = 0;
+        Node const * n = root_.get();
+        while (n){
+            it.push(n);
+            if (strict ? x < n->val_ : !(n->val_ < x)){
+                keep = it.depth_;
+                n = n->lft_.get();
             } else {
-                return this->paint(DOUBLE_BLACK);
+                n = n->rgt_.get();
             }
         }
+        it.depth_ = keep;
+        it.settle();
+        return it;
     }
     
-    RBTree rem(T x, U item) const
+    View find(T const & x) const
     {
-        T y = value();
-        List<U> yi = items();
-        Color c = rootColor();
-        if (x < y) {
-            return balance(c, left().rem(x, item), y, yi, right());
-        } else if (y < x) {
-            return balance(c, left(), y, yi, right().rem(x, item));
-        } else {
-            List<U> n = items().remove(item);
-            if (!n.isEmpty()){
-                return RBTree<T, U>(c, left(), y, n, right());
-            } else {
-                if (!left().isEmpty()){
-                    StateContainer<RBTree, RBTree> s = left().getRemoveMax();
-                    return balance(c, s.y_, s.z_.value(), s.z_.items(), right());
-                } else if (!right().isEmpty()){
-                    StateContainer<RBTree, RBTree> s = right().getRemoveMin();
-                    return balance(c, left(), s.z_.value(), s.z_.items(), s.y_);
-                } else {
-                    return this->paint(DOUBLE_BLACK);
-                }
+        if constexpr (std::is_arithmetic<T>::value){
+            // Runs down to the bottom remembering the last node not less
+            // than x; the selects compile to conditional moves.
+            Node const * n = root_.get();
+            Node const * cand = nullptr;
+            while (n){
+                bool right = n->val_ < x;
+                cand = right ? cand : n;
+                n = (right ? n->rgt_ : n->lft_).get();
             }
+            return View(cand && !(x < cand->val_) ? cand : nullptr);
+        }
+        View t = view();
+        while (!t.isEmpty()){
+            if (x < t.value())
+                t = t.left();
+            else if (t.value() < x)
+                t = t.right();
+            else
+                break;
         }
+        return t;
     }
     
-    StateContainer<RBTree, RBTree> getRemoveMax() const
+    // Lookups in flight at once in findBatch; enough to cover a miss to
+    // memory with the steps of the others.
+    static const std::size_t kLanes = 8;
+    
+    // Calls found(i, node holding first[i] or null) for each key, in no
+    // particular order. Each lane runs the lower-bound descent of find() and
+    // is refilled with the next key as soon as it reaches the bottom.
+    template<class It, class F>
+    void findBatch(It first, It last, F found) const
     {
-        if (right().isEmpty()){
-            if (left().isEmpty()){
-                if (rootColor() == BLACK){
-                    return StateContainer<RBTree, RBTree>(this->paint(DOUBLE_BLACK), *this);
+        struct Lane
+        {
+            Node const * n_;
+            Node const * cand_;
+            It key_;
+            std::size_t i_;
+        };
+        Node const * root = root_.get();
+        Lane lanes[kLanes];
+        std::size_t live = 0, next = 0;
+        for (; live < kLanes && first != last; ++first){
+            lanes[live++] = Lane{ root, nullptr, first, next++ };
+        }
+        while (live > 0){
+            for (std::size_t j = 0; j < live; ){
+                Lane & l = lanes[j];
+                if (l.n_){
+                    bool right = l.n_->val_ < *l.key_;
+                    l.cand_ = right ? l.cand_ : l.n_;
+                    l.n_ = (right ? l.n_->rgt_ : l.n_->lft_).get();
+                    search::prefetch(l.n_);
+                    ++j;
+                    continue;
+                }
+                found(l.i_, l.cand_ && !(*l.key_ < l.cand_->val_) ? l.cand_ : nullptr);
+                if (first != last){
+                    l = Lane{ root, nullptr, first, next++ };
+                    ++first;
+                    ++j;
                 } else {
-                    return StateContainer<RBTree, RBTree>(RBTree(), *this);
+                    l = lanes[--live];
                 }
+            }
+        }
+    }
+    
+    static int validate(Node const * n, T const * lo, T const * hi, bool parentRed)
+    {
+        if (!n)
+            return 0;
+        if (n->c_ != RED && n->c_ != BLACK)
+            return -1;
+        if (n->c_ == RED && parentRed)
+            return -1;
+        if ((lo && !(*lo < n->val_)) || (hi && !(n->val_ < *hi)))
+            return -1;
+        int lft = validate(n->lft_.get(), lo, &n->val_, n->c_ == RED);
+        if (lft < 0)
+            return -1;
+        int rgt = validate(n->rgt_.get(), &n->val_, hi, n->c_ == RED);
+        if (rgt != lft)
+            return -1;
+        return lft + (n->c_ == BLACK ? 1 : 0);
+    }
+    
+    // Whole-tree validation of every result handed back to the caller,
+    // compiled in only with RBTREE_CHECK_INVARIANTS.
+    static RBTree checked(RBTree const & t)
+    {
+#ifdef RBTREE_CHECK_INVARIANTS
+        t.checkInvariants();
+#endif
+        return t;
+    }
+    
+    // Ancestors of the subtree being rebuilt and the side taken at each,
+    // kept on a fixed stack instead of the call stack.
+    struct Path
+    {
+        Path() : depth_(0) {}
+        
+        void push(Node const * n, bool left)
+        {
+            assert(depth_ < kMaxDepth);
+            nodes_[depth_] = n;
+            left_[depth_] = left;
+            ++depth_;
+        }
+        
+        int depth_;
+        Node const * nodes_[kMaxDepth];
+        bool left_[kMaxDepth];
+    };
+    
+    // The node holding x, or null; p gets every node passed on the way.
+    Node const * descend(T const & x, Path & p) const
+    {
+        if constexpr (std::is_arithmetic<T>::value){
+            // As in find, without branching on the comparisons; the path is
+            // cut back to the node holding x once the bottom is reached.
+            Node const * n = root_.get();
+            Node const * cand = nullptr;
+            int candDepth = 0;
+            while (n){
+                assert(p.depth_ < kMaxDepth);
+                bool right = n->val_ < x;
+                cand = right ? cand : n;
+                candDepth = right ? candDepth : p.depth_;
+                p.nodes_[p.depth_] = n;
+                p.left_[p.depth_] = !right;
+                ++p.depth_;
+                n = (right ? n->rgt_ : n->lft_).get();
+            }
+            if (cand && !(x < cand->val_)){
+                p.depth_ = candDepth;
+                return cand;
+            }
+            return nullptr;
+        }
+        Node const * n = root_.get();
+        while (n){
+            if (x < n->val_){
+                p.push(n, true);
+                n = n->lft_.get();
+            } else if (n->val_ < x){
+                p.push(n, false);
+                n = n->rgt_.get();
             } else {
-                return StateContainer<RBTree, RBTree>(left().paint(BLACK), *this);
+                break;
             }
-        } else {
-            StateContainer<RBTree, RBTree> s = right().getRemoveMax();
-            return StateContainer<RBTree, RBTree>(balance(rootColor(), left(), value(), items(), s.y_), s.z_);
         }
+        return n;
     }
     
-    StateContainer<RBTree, RBTree> getRemoveMin() const
+    // Puts t in place of the subtree at the bottom of p, rebalancing each
+    // ancestor on the way back up.
+    static RBTree rebuild(Path & p, RBTree t)
     {
-        if (left().isEmpty()){
-            if (right().isEmpty()){
-                if (rootColor() == BLACK){
-                    return StateContainer<RBTree, RBTree>(this->paint(DOUBLE_BLACK), *this);
-                } else {
-                    return StateContainer<RBTree, RBTree>(RBTree(), *this);
-                }
+        while (p.depth_ > 0){
+            --p.depth_;
+            RBTREE_COUNT(PATH_COPIES);
+            Node const * n = p.nodes_[p.depth_];
+            if (p.left_[p.depth_]){
+                t = balance(n->c_, t, View(n), RBTree(n->rgt_));
             } else {
-                return StateContainer<RBTree, RBTree>(right().paint(BLACK), *this);
+                t = balance(n->c_, RBTree(n->lft_), View(n), t);
             }
+        }
+        return t;
+    }
+    
+    static RBTree wrap(Node const * n)
+    {
+        return RBTree(NodePtr(n));
+    }
+    
+    template<class K, class... Args>
+    RBTree ins(K && x, Args &&... args) const
+    {
+        Path p;
+        Node const * n = descend(x, p);
+        if (!n){
+            return rebuild(p, RBTree(RED,
+                                     RBTree(),
+                                     std::forward<K>(x),
+                                     ItemList().emplace_front(std::forward<Args>(args)...),
+                                     RBTree()));
+        }
+        return rebuild(p, RBTree(n->c_,
+                                 RBTree(n->lft_),
+                                 n->val_,
+                                 n->items_.emplace_front(std::forward<Args>(args)...),
+                                 RBTree(n->rgt_)));
+    }
+    
+    // The root painted black. A root nobody else holds yet is repainted in
+    // place rather than copied along with its key and items.
+    static RBTree blackRoot(RBTree t)
+    {
+        if (!t.isEmpty() && t.rootColor() != BLACK){
+            if (t.root_.unique()){
+                const_cast<Node *>(t.root_.get())->c_ = BLACK;
+            } else {
+                t = t.paint(BLACK);
+            }
+        }
+        return t;
+    }
+    
+    // Both rems leave the tree as it is, sharing its root, if there is
+    // nothing to take out.
+    RBTree rem(T const & x) const
+    {
+        Path p;
+        Node const * n = descend(x, p);
+        if (!n){
+            return *this;
+        }
+        return rebuild(p, wrap(n).unlink());
+    }
+    
+    RBTree rem(T const & x, U const & item) const
+    {
+        Path p;
+        Node const * n = descend(x, p);
+        if (!n || !n->items_.contains(item)){
+            return *this;
+        }
+        ItemList rest = n->items_.remove(item);
+        if (!rest.isEmpty()){
+            return rebuild(p, RBTree(n->c_, RBTree(n->lft_), n->val_, rest, RBTree(n->rgt_)));
+        }
+        return rebuild(p, wrap(n).unlink());
+    }
+    
+    // This subtree less its root, which is replaced by its predecessor or
+    // successor if it has children.
+    RBTree unlink() const
+    {
+        if (!left().isEmpty()){
+            StateContainer<RBTree, RBTree> s = left().getRemoveMax();
+            return balance(rootColor(), s.y_, s.z_.view(), right());
+        } else if (!right().isEmpty()){
+            StateContainer<RBTree, RBTree> s = right().getRemoveMin();
+            return balance(rootColor(), left(), s.z_.view(), s.y_);
         } else {
-            StateContainer<RBTree, RBTree> s = left().getRemoveMin();
-            return StateContainer<RBTree, RBTree>(balance(rootColor(), s.y_, value(), items(), right()),
-                                                  s.z_);
+            return removeLeaf();
+        }
+    }
+    
+    // (this subtree less its largest entry, that entry)
+    StateContainer<RBTree, RBTree> getRemoveMax() const
+    {
+        Path p;
+        Node const * n = root_.get();
+        while (n->rgt_){
+            p.push(n, false);
+            n = n->rgt_.get();
+        }
+        RBTree m = wrap(n);
+        RBTree rest;
+        if (n->lft_){
+            rest = m.left().paint(BLACK);
+        } else if (n->c_ == BLACK){
+            RBTREE_COUNT(DOUBLE_BLACKS);
+            rest = m.paint(DOUBLE_BLACK);
+        }
+        return StateContainer<RBTree, RBTree>(rebuild(p, rest), m);
+    }
+    
+    // (this subtree less its smallest entry, that entry)
+    StateContainer<RBTree, RBTree> getRemoveMin() const
+    {
+        Path p;
+        Node const * n = root_.get();
+        while (n->lft_){
+            p.push(n, true);
+            n = n->lft_.get();
         }
+        RBTree m = wrap(n);
+        RBTree rest;
+        if (n->rgt_){
+            rest = m.right().paint(BLACK);
+        } else if (n->c_ == BLACK){
+            RBTREE_COUNT(DOUBLE_BLACKS);
+            rest = m.paint(DOUBLE_BLACK);
+        }
+        return StateContainer<RBTree, RBTree>(rebuild(p, rest), m);
     }
     
-    static RBTree balance(Color currColor, RBTree const & lft, T x, List<U> xi, RBTree const & rgt)
+    static RBTree balance(Color currColor, RBTree const & lft, View x, RBTree const & rgt)
     {
+        RBTREE_COUNT(BALANCES);
         if (lft.doubleBlack()){
             if (lft.childless()){
-                return bubble(currColor, RBTree(), x, xi, rgt);
+                return bubble(currColor, RBTree(), x, rgt);
             } else {
-                return bubble(currColor, lft, x, xi, rgt);
+                return bubble(currColor, lft, x, rgt);
             }
         } else if (rgt.doubleBlack()){
             if (rgt.childless()){
-                return bubble(currColor, lft, x, xi, RBTree());
+                return bubble(currColor, lft, x, RBTree());
             } else {
-                return bubble(currColor, lft, x, xi, rgt);
+                return bubble(currColor, lft, x, rgt);
             }
         }
         
         if (currColor == RED){
-            return RBTree(currColor, lft, x, xi, rgt);
+            return RBTree(currColor, lft, x, rgt);
         }
         
         Color c = currColor == BLACK ? RED : BLACK;
         if (lft.negative()){
+            RBTREE_COUNT(NEGATIVE);
             return RBTree(c,
                           balance(BLACK,
                                   lft.left().paint(RED),
-                                  lft.value(),
-                                  lft.items(),
+                                  lft.view(),
                                   lft.right().left()),
-                          lft.right().value(),
-                          lft.right().items(),
+                          lft.right().view(),
                           RBTree(BLACK,
                                  lft.right().right(),
                                  x,
-                                 xi,
                                  rgt));
         } else if (rgt.negative()){
+            RBTREE_COUNT(NEGATIVE);
             return RBTree(c,
                           RBTree(BLACK,
-                                 rgt.left().left(),
+                                 lft,
                                  x,
-                                 xi,
-                                 rgt),
-                          rgt.left().value(),
-                          rgt.left().items(),
+                                 rgt.left().left()),
+                          rgt.left().view(),
                           balance(BLACK,
-                                  rgt.right().paint(RED),
-                                  rgt.value(),
-                                  rgt.items(),
-                                  rgt.left().right()));
+                                  rgt.left().right(),
+                                  rgt.view(),
+                                  rgt.right().paint(RED)));
         } else if (lft.doubledLeft()){
+            RBTREE_COUNT(DOUBLED_LEFT);
             return RBTree(c,
                           lft.left().paint(BLACK),
-                          lft.value(),
-                          lft.items(),
-                          RBTree(BLACK, lft.right(), x, xi, rgt));
+                          lft.view(),
+                          RBTree(BLACK, lft.right(), x, rgt));
         } else if (lft.doubledRight()){
+            RBTREE_COUNT(DOUBLED_RIGHT);
             return RBTree(c,
-                          RBTree(BLACK, lft.left(), lft.value(), lft.items(), lft.right().left()),
-                          lft.right().value(),
-                          lft.right().items(),
-                          RBTree(BLACK, lft.right().right(), x, xi, rgt));
+                          RBTree(BLACK, lft.left(), lft.view(), lft.right().left()),
+                          lft.right().view(),
+                          RBTree(BLACK, lft.right().right(), x, rgt));
         } else if (rgt.doubledLeft()){
+            RBTREE_COUNT(DOUBLED_LEFT);
             return RBTree(c,
-                          RBTree(BLACK, lft, x, xi, rgt.left().left()),
-                          rgt.left().value(),
-                          rgt.left().items(),
-                          RBTree(BLACK, rgt.left().right(), rgt.value(), rgt.items(), rgt.right()));
+                          RBTree(BLACK, lft, x, rgt.left().left()),
+                          rgt.left().view(),
+                          RBTree(BLACK, rgt.left().right(), rgt.view(), rgt.right()));
         } else if (rgt.doubledRight()){
+            RBTREE_COUNT(DOUBLED_RIGHT);
             return RBTree(c,
-                          RBTree(BLACK, lft, x, xi, rgt.left()),
-                          rgt.value(),
-                          rgt.items(),
+                          RBTree(BLACK, lft, x, rgt.left()),
+                          rgt.view(),
                           rgt.right().paint(BLACK));
         } else {
-            return RBTree(++c, lft, x, xi, rgt);
+            return RBTree(++c, lft, x, rgt);
         }
     }
     
-    static RBTree bubble(Color currColor, RBTree const & lft, T x, List<U> xi, RBTree const & rgt)
+    static RBTree bubble(Color currColor, RBTree const & lft, View x, RBTree const & rgt)
     {
+        RBTREE_COUNT(BUBBLES);
         if (!lft.isEmpty() && !rgt.isEmpty()){
-            return balance(++currColor, lft.paint((Color)(lft.rootColor() - 1)), x, xi, rgt.paint((Color)(rgt.rootColor() - 1)));
+            return balance(++currColor, lft.paint((Color)(lft.rootColor() - 1)), x, rgt.paint((Color)(rgt.rootColor() - 1)));
         } else if (!lft.isEmpty()){
-            return balance(++currColor, lft.paint((Color)(lft.rootColor() - 1)), x, xi, RBTree());
+            return balance(++currColor, lft.paint((Color)(lft.rootColor() - 1)), x, RBTree());
         } else if (!rgt.isEmpty()){
-            return balance(++currColor, RBTree(), x, xi, rgt.paint((Color)(rgt.rootColor() - 1)));
+            return balance(++currColor, RBTree(), x, rgt.paint((Color)(rgt.rootColor() - 1)));
         } else {
-            return balance(++currColor, RBTree(), x, xi, RBTree());
+            return balance(++currColor, RBTree(), x, RBTree());
         }
     }
     
@@ -482,6 +1285,19 @@ private:
         return left().isEmpty() && right().isEmpty();
     }
     
+    // A red leaf simply disappears; a black leaf leaves a double black
+    // marker behind for balance() to bubble up.
+    RBTree removeLeaf() const
+    {
+        assert(childless());
+        if (rootColor() == RED){
+            return RBTree();
+        } else {
+            RBTREE_COUNT(DOUBLE_BLACKS);
+            return this->paint(DOUBLE_BLACK);
+        }
+    }
+
     bool doubleBlack() const
     {
         return !isEmpty() && rootColor() == DOUBLE_BLACK;
@@ -511,7 +1327,7 @@ private:
     RBTree paint(Color c) const
     {
         assert(!isEmpty());
-        return RBTree(c, left(), value(), items(), right());
+        return RBTree(c, left(), view(), right());
     }
     
     void prTree() const
@@ -529,7 +1345,7 @@ private:
         }
     }
     
-    std::shared_ptr<const Node> root_;
+    NodePtr root_;
 };
 
 #endif /* defined(__rbtree__rbtree__) */
@@ -0,0 +1,139 @@
+//
+//  refcount.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__refcount__
+#define __rbtree__refcount__
+
+#include <atomic>
+#include <utility>
+
+// Reference counts embedded in the objects they count. AtomicCount is safe
+// for versions shared between threads; LocalCount is for trees that never
+// leave the thread that built them and saves the locked instructions.
+
+class AtomicCount
+{
+public:
+    AtomicCount() : n_(0) {}
+    AtomicCount(AtomicCount const &) : n_(0) {}
+    AtomicCount & operator=(AtomicCount const &) { return *this; }
+    
+    void retain() const
+    {
+        n_.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // True if that was the last reference.
+    bool release() const
+    {
+        return n_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    
+    long count() const
+    {
+        return n_.load(std::memory_order_relaxed);
+    }
+    
+    // True if this is the only reference. Acquire pairs with the release in
+    // release(), so everything a thread did with the object before dropping
+    // its reference happens before the caller changes it in place.
+    bool unique() const
+    {
+        return n_.load(std::memory_order_acquire) == 1;
+    }
+
+private:
+    mutable std::atomic<long> n_;
+};
+
+class LocalCount
+{
+public:
+    LocalCount() : n_(0) {}
+    LocalCount(LocalCount const &) : n_(0) {}
+    LocalCount & operator=(LocalCount const &) { return *this; }
+    
+    void retain() const
+    {
+        ++n_;
+    }
+    
+    bool release() const
+    {
+        return --n_ == 0;
+    }
+    
+    long count() const
+    {
+        return n_;
+    }
+    
+    bool unique() const
+    {
+        return n_ == 1;
+    }
+
+private:
+    mutable long n_;
+};
+
+// Owning pointer to an object with a refs_ member. When the last reference
+// goes, X::destroy(p) is called to dispose of it.
+template<class X>
+class IntrusivePtr
+{
+public:
+    IntrusivePtr() : p_(nullptr) {}
+    
+    explicit IntrusivePtr(X * p) : p_(p)
+    {
+        if (p_)
+            p_->refs_.retain();
+    }
+    
+    IntrusivePtr(IntrusivePtr const & other) : p_(other.p_)
+    {
+        if (p_)
+            p_->refs_.retain();
+    }
+    
+    IntrusivePtr(IntrusivePtr && other) : p_(other.p_)
+    {
+        other.p_ = nullptr;
+    }
+    
+    IntrusivePtr & operator=(IntrusivePtr other)
+    {
+        std::swap(p_, other.p_);
+        return *this;
+    }
+    
+    ~IntrusivePtr()
+    {
+        if (p_ && p_->refs_.release())
+            X::destroy(p_);
+    }
+    
+    X * get() const { return p_; }
+    X * operator->() const { return p_; }
+    X & operator*() const { return *p_; }
+    explicit operator bool() const { return p_ != nullptr; }
+    
+    // Sole owner; the object may be changed in place without anyone noticing.
+    bool unique() const
+    {
+        return p_ && p_->refs_.unique();
+    }
+    
+    bool operator==(IntrusivePtr const & other) const { return p_ == other.p_; }
+    bool operator!=(IntrusivePtr const & other) const { return p_ != other.p_; }
+
+private:
+    X * p_;
+};
+
+#endif /* defined(__rbtree__refcount__) */
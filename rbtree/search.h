@@ -0,0 +1,147 @@
+//
+//  search.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__search__
+#define __rbtree__search__
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Searches within a sorted block of keys, such as the keys of a BTree node.
+// Arithmetic keys are counted rather than bisected: a block is narrowed with
+// conditional moves to a few dozen keys, which are then compared all at once,
+// with AVX2 where it is available. Nothing depends on a comparison's outcome
+// but the answer, so random lookups cost no mispredicted branches. Other key
+// types use std::lower_bound and std::upper_bound as before.
+
+namespace search {
+
+// Blocks this short are compared key by key rather than halved further.
+const std::size_t kLinear = 32;
+
+// Hints that p is about to be read. Prefetching a null pointer is harmless.
+inline void prefetch(void const * p)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+#if defined(__AVX2__)
+
+// Keys less than x, or not greater than x when Upper, among k[0, n).
+template<bool Upper>
+inline std::size_t countVector(std::int64_t const * k, std::size_t n, std::int64_t x, std::size_t & done)
+{
+    __m256i xv = _mm256_set1_epi64x(x);
+    std::size_t r = 0;
+    for (done = 0; done + 4 <= n; done += 4){
+        __m256i kv = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(k + done));
+        __m256i c = Upper ? _mm256_cmpgt_epi64(kv, xv) : _mm256_cmpgt_epi64(xv, kv);
+        int m = _mm256_movemask_pd(_mm256_castsi256_pd(c));
+        r += Upper ? 4 - __builtin_popcount(m) : __builtin_popcount(m);
+    }
+    return r;
+}
+
+template<bool Upper>
+inline std::size_t countVector(std::int32_t const * k, std::size_t n, std::int32_t x, std::size_t & done)
+{
+    __m256i xv = _mm256_set1_epi32(x);
+    std::size_t r = 0;
+    for (done = 0; done + 8 <= n; done += 8){
+        __m256i kv = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(k + done));
+        __m256i c = Upper ? _mm256_cmpgt_epi32(kv, xv) : _mm256_cmpgt_epi32(xv, kv);
+        int m = _mm256_movemask_ps(_mm256_castsi256_ps(c));
+        r += Upper ? 8 - __builtin_popcount(m) : __builtin_popcount(m);
+    }
+    return r;
+}
+
+template<bool Upper>
+inline std::size_t countVector(double const * k, std::size_t n, double x, std::size_t & done)
+{
+    __m256d xv = _mm256_set1_pd(x);
+    std::size_t r = 0;
+    for (done = 0; done + 4 <= n; done += 4){
+        __m256d kv = _mm256_loadu_pd(k + done);
+        __m256d c = Upper ? _mm256_cmp_pd(xv, kv, _CMP_NLT_UQ) : _mm256_cmp_pd(kv, xv, _CMP_LT_OQ);
+        r += __builtin_popcount(_mm256_movemask_pd(c));
+    }
+    return r;
+}
+
+template<bool Upper>
+inline std::size_t countVector(float const * k, std::size_t n, float x, std::size_t & done)
+{
+    __m256 xv = _mm256_set1_ps(x);
+    std::size_t r = 0;
+    for (done = 0; done + 8 <= n; done += 8){
+        __m256 kv = _mm256_loadu_ps(k + done);
+        __m256 c = Upper ? _mm256_cmp_ps(xv, kv, _CMP_NLT_UQ) : _mm256_cmp_ps(kv, xv, _CMP_LT_OQ);
+        r += __builtin_popcount(_mm256_movemask_ps(c));
+    }
+    return r;
+}
+
+// The key types with a vector count above, give or take the name of the
+// 64-bit integer type.
+template<class T>
+struct Vectorized
+{
+    static const bool value = std::is_same<T, double>::value
+                           || std::is_same<T, float>::value
+                           || (std::is_integral<T>::value && std::is_signed<T>::value
+                               && (sizeof(T) == 8 || sizeof(T) == 4));
+};
+
+#endif
+
+// Keys among k[0, n) less than x, or not greater than x when Upper: the
+// index std::lower_bound (or std::upper_bound) would return.
+template<bool Upper, class T>
+std::size_t rank(T const * k, std::size_t n, T const & x)
+{
+    if constexpr (std::is_arithmetic<T>::value){
+        T const * base = k;
+        while (n > kLinear){
+            std::size_t half = n / 2;
+            bool past = Upper ? !(x < base[half - 1]) : base[half - 1] < x;
+            base = past ? base + half : base;
+            n -= half;
+        }
+        std::size_t r = base - k;
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        if constexpr (Vectorized<T>::value){
+            typedef typename std::conditional<std::is_floating_point<T>::value, T,
+                    typename std::conditional<sizeof(T) == 8, std::int64_t, std::int32_t>::type>::type V;
+            r += countVector<Upper>(reinterpret_cast<V const *>(base), n, static_cast<V>(x), i);
+        }
+#endif
+        for (; i < n; ++i){
+            r += Upper ? !(x < base[i]) : base[i] < x;
+        }
+        return r;
+    } else if constexpr (Upper){
+        return std::upper_bound(k, k + n, x) - k;
+    } else {
+        return std::lower_bound(k, k + n, x) - k;
+    }
+}
+
+} // namespace search
+
+#endif /* defined(__rbtree__search__) */
@@ -0,0 +1,371 @@
+//
+//  setops.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__setops__
+#define __rbtree__setops__
+
+#include "rbtree.h"
+#include "parallel.h"
+
+// Join-based split, join and set operations on RBTrees. Everything is built
+// on join(l, k, items, r), which glues two trees and a key between them in
+// O(|bh(l) - bh(r)| + 1) given their black heights. Finding a height means
+// walking a spine, so internally trees travel with their heights (Sized):
+// a child's follows from its parent's, and a join works out its result's.
+// Split then costs O(log n), and union, intersection and difference, which
+// split one tree by the other's root and recurse on the two sides
+// independently, run in O(m log(n/m + 1)) and fork the sides onto the
+// TaskPool near the top.
+
+template<class Tree>
+struct SplitResult
+{
+    Tree left;                        // keys less than the split key
+    bool found;                       // whether the key itself was there
+    typename Tree::ItemList items;    // its items, if so
+    Tree right;                       // keys greater than the split key
+};
+
+namespace setops {
+
+template<class Tree>
+bool isRed(Tree const & t)
+{
+    return !t.isEmpty() && t.rootColor() == RED;
+}
+
+template<class Tree>
+Tree blacken(Tree const & t)
+{
+    return isRed(t) ? Tree(BLACK, t.left(), t.view(), t.right()) : t;
+}
+
+// Black nodes on any path down from t, t included.
+template<class Tree>
+int blackHeight(Tree t)
+{
+    int h = 0;
+    while (!t.isEmpty()){
+        if (t.rootColor() == BLACK)
+            ++h;
+        t = t.left();
+    }
+    return h;
+}
+
+// A tree and its black height.
+template<class Tree>
+struct Sized
+{
+    Tree t;
+    int h;
+};
+
+template<class Tree>
+Sized<Tree> measured(Tree const & t)
+{
+    return Sized<Tree>{ t, blackHeight(t) };
+}
+
+// The subtree below t on one side, given t's height.
+template<class Tree>
+Sized<Tree> child(Sized<Tree> const & t, Tree const & side)
+{
+    return Sized<Tree>{ side, t.h - (t.t.rootColor() == BLACK ? 1 : 0) };
+}
+
+// The entry a join puts between its two trees is either a node already in
+// some tree, whose key, items and cached summaries are reused, or a key and
+// items of its own.
+template<class T, class L>
+struct Fresh
+{
+    T const & key;
+    L const & items;
+};
+
+template<class T, class L>
+Fresh<T, L> fresh(T const & key, L const & items)
+{
+    return Fresh<T, L>{ key, items };
+}
+
+template<class Tree>
+Tree node(Color c, Tree const & l, typename Tree::View e, Tree const & r)
+{
+    return Tree(c, l, e, r);
+}
+
+template<class Tree, class T, class L>
+Tree node(Color c, Tree const & l, Fresh<T, L> const & e, Tree const & r)
+{
+    return Tree(c, l, e.key, e.items, r);
+}
+
+// l and r have black roots and hl >= hr. Walks down l's right spine to a
+// black subtree of r's height and hangs a red node joining the two there;
+// a red-red pair this makes below a black node is fixed by a rotation.
+template<class Tree, class E>
+Tree joinRight(Tree const & l, int hl, E const & e, Tree const & r, int hr)
+{
+    if (hl == hr && !isRed(l)){
+        return node(RED, l, e, r);
+    }
+    Tree t = joinRight(l.right(), isRed(l) ? hl : hl - 1, e, r, hr);
+    if (!isRed(l) && isRed(t) && isRed(t.right())){
+        return Tree(RED,
+                    Tree(BLACK, l.left(), l.view(), t.left()),
+                    t.view(),
+                    blacken(t.right()));
+    }
+    return Tree(l.rootColor(), l.left(), l.view(), t);
+}
+
+template<class Tree, class E>
+Tree joinLeft(Tree const & l, int hl, E const & e, Tree const & r, int hr)
+{
+    if (hl == hr && !isRed(r)){
+        return node(RED, l, e, r);
+    }
+    Tree t = joinLeft(l, hl, e, r.left(), isRed(r) ? hr : hr - 1);
+    if (!isRed(r) && isRed(t) && isRed(t.left())){
+        return Tree(RED,
+                    blacken(t.left()),
+                    t.view(),
+                    Tree(BLACK, t.right(), r.view(), r.right()));
+    }
+    return Tree(r.rootColor(), t, r.view(), r.right());
+}
+
+// join with the heights known. The root of the result may be red.
+template<class Tree, class E>
+Sized<Tree> joinSized(Sized<Tree> l, E const & e, Sized<Tree> r)
+{
+    if (isRed(l.t)){
+        l.t = blacken(l.t);
+        ++l.h;
+    }
+    if (isRed(r.t)){
+        r.t = blacken(r.t);
+        ++r.h;
+    }
+    if (l.h > r.h){
+        Tree j = joinRight(l.t, l.h, e, r.t, r.h);
+        return isRed(j) && isRed(j.right()) ? Sized<Tree>{ blacken(j), l.h + 1 } : Sized<Tree>{ j, l.h };
+    } else if (r.h > l.h){
+        Tree j = joinLeft(l.t, l.h, e, r.t, r.h);
+        return isRed(j) && isRed(j.left()) ? Sized<Tree>{ blacken(j), r.h + 1 } : Sized<Tree>{ j, r.h };
+    } else {
+        return Sized<Tree>{ node(RED, l.t, e, r.t), l.h };
+    }
+}
+
+template<class Tree>
+struct SizedSplit
+{
+    Sized<Tree> left;
+    bool found;
+    typename Tree::ItemList items;
+    Sized<Tree> right;
+};
+
+template<class Tree, class T>
+SizedSplit<Tree> splitSized(Sized<Tree> const & t, T const & k)
+{
+    if (t.t.isEmpty()){
+        return SizedSplit<Tree>{ t, false, typename Tree::ItemList(), t };
+    }
+    Sized<Tree> l = child(t, t.t.left()), r = child(t, t.t.right());
+    if (k < t.t.value()){
+        SizedSplit<Tree> s = splitSized(l, k);
+        s.right = joinSized(s.right, t.t.view(), r);
+        return s;
+    } else if (t.t.value() < k){
+        SizedSplit<Tree> s = splitSized(r, k);
+        s.left = joinSized(l, t.t.view(), s.left);
+        return s;
+    } else {
+        return SizedSplit<Tree>{ l, true, t.t.items(), r };
+    }
+}
+
+// t less its last entry, and the subtree of t whose root that entry is.
+template<class Tree>
+struct LastEntry
+{
+    Sized<Tree> rest;
+    Tree last;
+};
+
+template<class Tree>
+LastEntry<Tree> splitLast(Sized<Tree> const & t)
+{
+    if (t.t.right().isEmpty()){
+        return LastEntry<Tree>{ child(t, t.t.left()), t.t };
+    }
+    LastEntry<Tree> s = splitLast(child(t, t.t.right()));
+    s.rest = joinSized(child(t, t.t.left()), t.t.view(), s.rest);
+    return s;
+}
+
+// join without a middle entry.
+template<class Tree>
+Sized<Tree> join2(Sized<Tree> const & l, Sized<Tree> const & r)
+{
+    if (l.t.isEmpty())
+        return r;
+    LastEntry<Tree> s = splitLast(l);
+    return joinSized(s.rest, s.last.view(), r);
+}
+
+template<class Tree>
+Tree join2(Tree const & l, Tree const & r)
+{
+    return join2(measured(l), measured(r)).t;
+}
+
+template<class Tree, class Merge>
+Sized<Tree> unite(Sized<Tree> const & a, Sized<Tree> const & b, Merge const & merge, int forks);
+
+template<class Tree, class Merge>
+Sized<Tree> intersect(Sized<Tree> const & a, Sized<Tree> const & b, Merge const & merge, int forks);
+
+template<class Tree>
+Sized<Tree> subtract(Sized<Tree> const & a, Sized<Tree> const & b, int forks);
+
+template<class Tree>
+struct ConcatItems
+{
+    typedef typename Tree::ItemList ItemList;
+    ItemList operator()(ItemList const & a, ItemList const & b) const
+    {
+        return concat(a, b);
+    }
+};
+
+} // namespace setops
+
+// Every key of l must be less than k and every key of r greater. The root of
+// the result may be red.
+template<class T, class U, class P>
+RBTree<T, U, P> join(RBTree<T, U, P> const & l,
+                     T const & k,
+                     typename RBTree<T, U, P>::ItemList const & items,
+                     RBTree<T, U, P> const & r)
+{
+    using namespace setops;
+    return joinSized(measured(l), fresh(k, items), measured(r)).t;
+}
+
+template<class T, class U, class P>
+SplitResult<RBTree<T, U, P>> split(RBTree<T, U, P> const & t, T const & k)
+{
+    typedef RBTree<T, U, P> Tree;
+    setops::SizedSplit<Tree> s = setops::splitSized(setops::measured(t), k);
+    return SplitResult<Tree>{ s.left.t, s.found, s.items, s.right.t };
+}
+
+// Keys in either tree. A key in both gets merge(itemsInA, itemsInB), by
+// default the two lists concatenated.
+template<class T, class U, class P, class Merge>
+RBTree<T, U, P> setUnion(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b, Merge merge)
+{
+    using namespace setops;
+    return blacken(unite(measured(a), measured(b), merge, forkDepth()).t);
+}
+
+template<class T, class U, class P>
+RBTree<T, U, P> setUnion(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b)
+{
+    return setUnion(a, b, setops::ConcatItems<RBTree<T, U, P>>());
+}
+
+// Keys in both trees, with items merged as for setUnion.
+template<class T, class U, class P, class Merge>
+RBTree<T, U, P> setIntersection(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b, Merge merge)
+{
+    using namespace setops;
+    return blacken(intersect(measured(a), measured(b), merge, forkDepth()).t);
+}
+
+template<class T, class U, class P>
+RBTree<T, U, P> setIntersection(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b)
+{
+    return setIntersection(a, b, setops::ConcatItems<RBTree<T, U, P>>());
+}
+
+// Keys of a that are not in b, with a's items.
+template<class T, class U, class P>
+RBTree<T, U, P> setDifference(RBTree<T, U, P> const & a, RBTree<T, U, P> const & b)
+{
+    using namespace setops;
+    return blacken(subtract(measured(a), measured(b), forkDepth()).t);
+}
+
+namespace setops {
+
+template<class F, class G>
+void maybeFork(int forks, F && f, G && g)
+{
+    if (forks > 0){
+        forkJoin(f, g);
+    } else {
+        f();
+        g();
+    }
+}
+
+template<class Tree, class Merge>
+Sized<Tree> unite(Sized<Tree> const & a, Sized<Tree> const & b, Merge const & merge, int forks)
+{
+    if (a.t.isEmpty())
+        return b;
+    if (b.t.isEmpty())
+        return a;
+    SizedSplit<Tree> s = splitSized(b, a.t.value());
+    Sized<Tree> l, r;
+    maybeFork(forks,
+              [&]{ l = unite(child(a, a.t.left()), s.left, merge, forks - 1); },
+              [&]{ r = unite(child(a, a.t.right()), s.right, merge, forks - 1); });
+    if (!s.found)
+        return joinSized(l, a.t.view(), r);
+    typename Tree::ItemList items = merge(a.t.items(), s.items);
+    return joinSized(l, fresh(a.t.value(), items), r);
+}
+
+template<class Tree, class Merge>
+Sized<Tree> intersect(Sized<Tree> const & a, Sized<Tree> const & b, Merge const & merge, int forks)
+{
+    if (a.t.isEmpty() || b.t.isEmpty())
+        return Sized<Tree>{ Tree(), 0 };
+    SizedSplit<Tree> s = splitSized(b, a.t.value());
+    Sized<Tree> l, r;
+    maybeFork(forks,
+              [&]{ l = intersect(child(a, a.t.left()), s.left, merge, forks - 1); },
+              [&]{ r = intersect(child(a, a.t.right()), s.right, merge, forks - 1); });
+    if (!s.found)
+        return join2(l, r);
+    typename Tree::ItemList items = merge(a.t.items(), s.items);
+    return joinSized(l, fresh(a.t.value(), items), r);
+}
+
+template<class Tree>
+Sized<Tree> subtract(Sized<Tree> const & a, Sized<Tree> const & b, int forks)
+{
+    if (a.t.isEmpty() || b.t.isEmpty())
+        return a;
+    SizedSplit<Tree> s = splitSized(a, b.t.value());
+    Sized<Tree> l, r;
+    maybeFork(forks,
+              [&]{ l = subtract(s.left, child(b, b.t.left()), forks - 1); },
+              [&]{ r = subtract(s.right, child(b, b.t.right()), forks - 1); });
+    return join2(l, r);
+}
+
+} // namespace setops
+
+#endif /* defined(__rbtree__setops__) */
@@ -0,0 +1,549 @@
+//
+//  snapshot.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__snapshot__
+#define __rbtree__snapshot__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rbtree.h"
+
+// On-disk snapshots of a tree, laid out to be searched where they lie. A
+// file holds a header, then the keys in Eytzinger order (the implicit binary
+// tree in breadth-first order, so the first levels of every search share a
+// few cache lines), then for each key the span of its items, then the items
+// of all keys in key order. Keys and items must be trivially copyable; they
+// are written in the machine's own representation, which the header records
+// so that a mismatched file is refused rather than misread.
+//
+// SnapshotWriter streams a sorted sequence of entries to a file, buffering a
+// little of each level of keys, so its memory grows with the log of the
+// size. MappedSnapshot maps a file read-only and answers
+// lookups and range scans straight from the mapping.
+
+namespace snapshot {
+
+const char kMagic[8] = { 'R', 'B', 'T', 'S', 'N', 'A', 'P', '\0' };
+const std::uint32_t kFormat = 1;
+const std::uint32_t kByteOrder = 0x01020304;
+const std::uint64_t kAlign = 64;
+
+struct Header
+{
+    char magic_[8];
+    std::uint32_t format_;
+    std::uint32_t byteOrder_;
+    std::uint32_t keyBytes_;
+    std::uint32_t itemBytes_;
+    std::uint64_t keys_;         // number of keys
+    std::uint64_t items_;        // number of items over all keys
+    std::uint64_t keysAt_;       // file offsets of the three sections
+    std::uint64_t spansAt_;
+    std::uint64_t itemsAt_;
+};
+
+// Where a key's items lie in the items section.
+struct Span
+{
+    std::uint64_t first_;
+    std::uint64_t count_;
+};
+
+inline std::uint64_t roundUp(std::uint64_t n)
+{
+    return (n + kAlign - 1) / kAlign * kAlign;
+}
+
+// Eytzinger slots are numbered from 1; slot i has children 2i and 2i + 1.
+// 0 stands for "none".
+inline std::uint64_t firstSlot(std::uint64_t n)
+{
+    std::uint64_t i = n ? 1 : 0;
+    while (i && 2 * i <= n)
+        i *= 2;
+    return i;
+}
+
+// The slot after i in key order, or 0.
+inline std::uint64_t nextSlot(std::uint64_t i, std::uint64_t n)
+{
+    if (2 * i + 1 <= n){
+        i = 2 * i + 1;
+        while (2 * i <= n)
+            i *= 2;
+        return i;
+    }
+    while (i & 1)
+        i >>= 1;
+    return i >> 1;
+}
+
+} // namespace snapshot
+
+template<class T, class U>
+class SnapshotWriter
+{
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<U>::value,
+                  "snapshots store keys and items as raw bytes");
+
+public:
+    // A file for exactly keys entries, to be given to add() in key order.
+    // The entries go to path + ".tmp", which finish() renames to path, so
+    // a snapshot already at path stays whole, and readable by whoever has
+    // it mapped, until the new one is complete.
+    SnapshotWriter(std::string const & path, std::uint64_t keys)
+    : path_(path), temp_(path + ".tmp"), fd_(::open(temp_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+      items_(0), slot_(snapshot::firstSlot(keys)), added_(0), count_(0)
+    {
+        if (fd_ < 0)
+            throw std::runtime_error("SnapshotWriter: cannot create " + temp_);
+        std::memset(&header_, 0, sizeof(header_));
+        std::memcpy(header_.magic_, snapshot::kMagic, sizeof(header_.magic_));
+        header_.format_ = snapshot::kFormat;
+        header_.byteOrder_ = snapshot::kByteOrder;
+        header_.keyBytes_ = sizeof(T);
+        header_.itemBytes_ = sizeof(U);
+        header_.keys_ = keys;
+        header_.keysAt_ = snapshot::roundUp(sizeof(snapshot::Header));
+        header_.spansAt_ = snapshot::roundUp(header_.keysAt_ + keys * sizeof(T));
+        header_.itemsAt_ = snapshot::roundUp(header_.spansAt_ + keys * sizeof(snapshot::Span));
+        // Each level of the Eytzinger tree is a run of slots that an in-order
+        // walk fills from left to right, so its keys and spans are written
+        // as two sequential streams. Memory goes with the number of levels,
+        // not with the number of keys.
+        for (std::uint64_t first = 1; first <= keys; first *= 2){
+            keys_.push_back(Stream(header_.keysAt_ + (first - 1) * sizeof(T)));
+            spans_.push_back(Stream(header_.spansAt_ + (first - 1) * sizeof(snapshot::Span)));
+        }
+        items_.at_ = header_.itemsAt_;
+    }
+
+    SnapshotWriter(SnapshotWriter const &) = delete;
+    SnapshotWriter & operator=(SnapshotWriter const &) = delete;
+
+    // A writer not finished leaves no file behind, and the one at path as
+    // it was.
+    ~SnapshotWriter()
+    {
+        if (fd_ >= 0){
+            ::close(fd_);
+            ::unlink(temp_.c_str());
+        }
+    }
+
+    // The next entry: its key and its items, from any range of U.
+    template<class Items>
+    void add(T const & key, Items const & items)
+    {
+        if (added_ == header_.keys_)
+            throw std::logic_error("SnapshotWriter: more entries than declared");
+        if (added_ > 0 && !(last_ < key))
+            throw std::logic_error("SnapshotWriter: keys out of order");
+        snapshot::Span span = { count_, 0 };
+        for (U const & u : items){
+            put(items_, &u, sizeof(U));
+            ++span.count_;
+        }
+        count_ += span.count_;
+        std::size_t level = 63 - __builtin_clzll(slot_);
+        put(keys_[level], &key, sizeof(T));
+        put(spans_[level], &span, sizeof(span));
+        slot_ = snapshot::nextSlot(slot_, header_.keys_);
+        last_ = key;
+        ++added_;
+    }
+
+    // Makes the file durable before the header that declares it whole is
+    // written, and the header durable before the file takes the place of
+    // the old one, so that after a crash path holds either snapshot in full.
+    void finish()
+    {
+        if (added_ != header_.keys_)
+            throw std::logic_error("SnapshotWriter: fewer entries than declared");
+        header_.items_ = count_;
+        for (Stream & s : keys_){
+            flush(s);
+        }
+        for (Stream & s : spans_){
+            flush(s);
+        }
+        flush(items_);
+        // Sections left unwritten, such as the items of an empty tree, still
+        // have to be inside the file.
+        std::uint64_t bytes = header_.itemsAt_ + count_ * sizeof(U);
+        if (::ftruncate(fd_, static_cast<off_t>(bytes)) != 0 || ::fsync(fd_) != 0)
+            fail();
+        Stream head(0);
+        put(head, &header_, sizeof(header_));
+        flush(head);
+        if (::fsync(fd_) != 0)
+            fail();
+        int fd = fd_;
+        fd_ = -1;
+        if (::close(fd) != 0 || std::rename(temp_.c_str(), path_.c_str()) != 0){
+            ::unlink(temp_.c_str());
+            throw std::runtime_error("SnapshotWriter: cannot replace " + path_);
+        }
+        syncDirectory();
+    }
+
+private:
+    // Bytes bound for consecutive offsets from at_, written when there are
+    // enough of them to be worth a call.
+    struct Stream
+    {
+        explicit Stream(std::uint64_t at) : at_(at) {}
+        std::uint64_t at_;
+        std::vector<char> buf_;
+    };
+
+    static const std::size_t kBuffer = 64 * 1024;
+
+    void put(Stream & s, void const * p, std::size_t n)
+    {
+        char const * c = static_cast<char const *>(p);
+        s.buf_.insert(s.buf_.end(), c, c + n);
+        if (s.buf_.size() >= kBuffer)
+            flush(s);
+    }
+
+    void flush(Stream & s)
+    {
+        std::size_t done = 0;
+        while (done < s.buf_.size()){
+            ssize_t w = ::pwrite(fd_, s.buf_.data() + done, s.buf_.size() - done,
+                                 static_cast<off_t>(s.at_ + done));
+            if (w <= 0)
+                fail();
+            done += static_cast<std::size_t>(w);
+        }
+        s.at_ += done;
+        s.buf_.clear();
+    }
+
+    // The rename is only durable once the directory holding it is synced.
+    void syncDirectory()
+    {
+        std::string::size_type slash = path_.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path_.substr(0, slash);
+        int fd = ::open(dir.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("SnapshotWriter: cannot open " + dir);
+        int r = ::fsync(fd);
+        ::close(fd);
+        if (r != 0)
+            throw std::runtime_error("SnapshotWriter: cannot sync " + dir);
+    }
+
+    void fail()
+    {
+        throw std::runtime_error("SnapshotWriter: write failed");
+    }
+
+    std::string path_;
+    std::string temp_;
+    int fd_;
+    snapshot::Header header_;
+    std::vector<Stream> keys_;    // one per level
+    std::vector<Stream> spans_;
+    Stream items_;
+    std::uint64_t slot_;
+    std::uint64_t added_;
+    std::uint64_t count_;         // items written
+    T last_;
+};
+
+// Writes every entry of t to path.
+template<class T, class U, class P>
+void writeSnapshot(RBTree<T, U, P> const & t, std::string const & path)
+{
+    std::uint64_t n = 0;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        ++n;
+    }
+    SnapshotWriter<T, U> w(path, n);
+    for (auto it = t.begin(); it != t.end(); ++it){
+        w.add(it->value(), it->items());
+    }
+    w.finish();
+}
+
+template<class T, class U>
+class MappedSnapshot
+{
+    static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_copyable<U>::value,
+                  "snapshots store keys and items as raw bytes");
+
+public:
+    // A key's items, in the order they had in the tree, newest first.
+    class Items
+    {
+    public:
+        typedef U const * const_iterator;
+        U const * begin() const { return first_; }
+        U const * end() const { return last_; }
+        std::size_t size() const { return last_ - first_; }
+        bool isEmpty() const { return first_ == last_; }
+    private:
+        friend class MappedSnapshot;
+        Items(U const * first, U const * last) : first_(first), last_(last) {}
+        U const * first_;
+        U const * last_;
+    };
+
+    class Entry
+    {
+    public:
+        T const & value() const { return s_->keys_[i_ - 1]; }
+        Items items() const { return s_->itemsAt(i_); }
+    private:
+        friend class MappedSnapshot;
+        Entry(MappedSnapshot const * s, std::uint64_t i) : s_(s), i_(i) {}
+        MappedSnapshot const * s_;
+        std::uint64_t i_;
+    };
+
+    // Entries in key order, handed out by value so that a temporary
+    // iterator may be dereferenced.
+    class const_iterator
+    {
+    public:
+        // What operator-> returns: an Entry to call through.
+        struct Arrow
+        {
+            Entry e_;
+            Entry const * operator->() const { return &e_; }
+        };
+
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Arrow pointer;
+        typedef Entry reference;
+
+        const_iterator() : cur_(nullptr, 0) {}
+
+        reference operator*() const { return cur_; }
+        pointer operator->() const { return Arrow{ cur_ }; }
+
+        const_iterator & operator++()
+        {
+            cur_.i_ = snapshot::nextSlot(cur_.i_, cur_.s_->n_);
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator old(*this);
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const_iterator const & other) const { return cur_.i_ == other.cur_.i_; }
+        bool operator!=(const_iterator const & other) const { return cur_.i_ != other.cur_.i_; }
+
+    private:
+        friend class MappedSnapshot;
+        const_iterator(MappedSnapshot const * s, std::uint64_t i) : cur_(s, i) {}
+        Entry cur_;
+    };
+
+    class Range
+    {
+    public:
+        Range(const_iterator b, const_iterator e) : begin_(b), end_(e) {}
+        const_iterator begin() const { return begin_; }
+        const_iterator end() const { return end_; }
+        bool empty() const { return begin_ == end_; }
+    private:
+        const_iterator begin_;
+        const_iterator end_;
+    };
+
+    // Maps path read-only; throws std::runtime_error if it cannot be read or
+    // is not a complete snapshot of this key and item type.
+    explicit MappedSnapshot(std::string const & path)
+    : base_(nullptr), bytes_(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("MappedSnapshot: cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(snapshot::Header))){
+            ::close(fd);
+            throw std::runtime_error("MappedSnapshot: not a snapshot: " + path);
+        }
+        bytes_ = static_cast<std::size_t>(st.st_size);
+        void * p = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw std::runtime_error("MappedSnapshot: cannot map " + path);
+        base_ = static_cast<char const *>(p);
+        snapshot::Header const & h = *reinterpret_cast<snapshot::Header const *>(base_);
+        // Counts are bounded by the file size before they are multiplied,
+        // so that no product can wrap round.
+        if (std::memcmp(h.magic_, snapshot::kMagic, sizeof(h.magic_)) != 0
+            || h.format_ != snapshot::kFormat
+            || h.byteOrder_ != snapshot::kByteOrder
+            || h.keyBytes_ != sizeof(T)
+            || h.itemBytes_ != sizeof(U)
+            || h.keys_ > bytes_ / sizeof(snapshot::Span)
+            || h.items_ > bytes_ / sizeof(U)
+            || h.keysAt_ > bytes_ || h.spansAt_ > bytes_ || h.itemsAt_ > bytes_
+            || h.keysAt_ % alignof(T) != 0
+            || h.spansAt_ % alignof(snapshot::Span) != 0
+            || h.itemsAt_ % alignof(U) != 0
+            || h.itemsAt_ + h.items_ * sizeof(U) > bytes_
+            || h.spansAt_ + h.keys_ * sizeof(snapshot::Span) > h.itemsAt_
+            || h.keysAt_ + h.keys_ * sizeof(T) > h.spansAt_){
+            unmap();
+            throw std::runtime_error("MappedSnapshot: not a snapshot of this type: " + path);
+        }
+        n_ = h.keys_;
+        keys_ = reinterpret_cast<T const *>(base_ + h.keysAt_);
+        spans_ = reinterpret_cast<snapshot::Span const *>(base_ + h.spansAt_);
+        items_ = reinterpret_cast<U const *>(base_ + h.itemsAt_);
+        itemCount_ = h.items_;
+        // Lookups trust the spans, so each must lie within the items.
+        for (std::uint64_t i = 0; i < n_; ++i){
+            snapshot::Span const & s = spans_[i];
+            if (s.first_ > itemCount_ || s.count_ > itemCount_ - s.first_){
+                unmap();
+                throw std::runtime_error("MappedSnapshot: corrupt item span in " + path);
+            }
+        }
+    }
+
+    MappedSnapshot(MappedSnapshot const &) = delete;
+    MappedSnapshot & operator=(MappedSnapshot const &) = delete;
+
+    ~MappedSnapshot()
+    {
+        unmap();
+    }
+
+    bool isEmpty() const
+    {
+        return n_ == 0;
+    }
+
+    std::size_t size() const
+    {
+        return n_;
+    }
+
+    bool member(T const & x) const
+    {
+        std::uint64_t i = bound(x, false);
+        return i && !(x < keys_[i - 1]);
+    }
+
+    Items getItems(T const & x) const
+    {
+        std::uint64_t i = bound(x, false);
+        return i && !(x < keys_[i - 1]) ? itemsAt(i) : Items(nullptr, nullptr);
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(this, snapshot::firstSlot(n_));
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator lower_bound(T const & x) const
+    {
+        return const_iterator(this, bound(x, false));
+    }
+
+    const_iterator upper_bound(T const & x) const
+    {
+        return const_iterator(this, bound(x, true));
+    }
+
+    // Entries with keys in [lo, hi); none if hi is not above lo.
+    Range range(T const & lo, T const & hi) const
+    {
+        if (!(lo < hi))
+            return Range(end(), end());
+        return Range(lower_bound(lo), lower_bound(hi));
+    }
+
+    // The snapshot as a tree, built in O(n).
+    template<class P = DefaultPolicy>
+    RBTree<T, U, P> toTree() const
+    {
+        typedef typename RBTree<T, U, P>::ItemList ItemList;
+        std::vector<std::pair<T, ItemList>> v;
+        v.reserve(n_);
+        for (auto it = begin(); it != end(); ++it){
+            Items items = it->items();
+            ItemList l;
+            for (U const * u = items.end(); u != items.begin(); ){
+                l = l.push_front(*--u);
+            }
+            v.emplace_back(it->value(), std::move(l));
+        }
+        return RBTree<T, U, P>::fromSorted(v.begin(), v.end());
+    }
+
+private:
+    // The slot of the first key not less than x (greater than x when
+    // strict), or 0. The descent always runs to the bottom; the answer is
+    // the last slot where it turned left.
+    std::uint64_t bound(T const & x, bool strict) const
+    {
+        std::uint64_t i = 1;
+        while (i <= n_){
+            T const & k = keys_[i - 1];
+            i = 2 * i + (strict ? !(x < k) : k < x);
+        }
+        while (i & 1)
+            i >>= 1;
+        return i >> 1;
+    }
+
+    Items itemsAt(std::uint64_t i) const
+    {
+        snapshot::Span const & s = spans_[i - 1];
+        return Items(items_ + s.first_, items_ + s.first_ + s.count_);
+    }
+
+    void unmap()
+    {
+        if (base_)
+            ::munmap(const_cast<char *>(base_), bytes_);
+        base_ = nullptr;
+    }
+
+    char const * base_;
+    std::size_t bytes_;
+    std::uint64_t n_;
+    std::uint64_t itemCount_;
+    T const * keys_;
+    snapshot::Span const * spans_;
+    U const * items_;
+};
+
+#endif /* defined(__rbtree__snapshot__) */
@@ -0,0 +1,168 @@
+//
+//  stats.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__stats__
+#define __rbtree__stats__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Counters on the hot paths of RBTree and its item lists, compiled in only
+// when RBTREE_STATS is defined; otherwise RBTREE_COUNT expands to nothing and
+// costs nothing. Define it for the whole program or not at all, since the
+// tree templates differ with it. Each thread bumps its own counters with
+// plain loads and stores; stats::local() reads the calling thread's,
+// stats::total() adds up every thread's, including threads that have exited.
+
+namespace stats {
+
+enum Counter
+{
+    OPERATIONS,        // insert, emplace and remove calls on RBTree
+    NODES_ALLOCATED,   // tree nodes constructed
+    PATH_COPIES,       // ancestors rebuilt on the way back up from an update
+    BALANCES,          // balance() calls
+    NEGATIVE,          // balance() finding a negative black child
+    DOUBLED_LEFT,      // ... a red child with a red left child
+    DOUBLED_RIGHT,     // ... a red child with a red right child
+    DOUBLE_BLACKS,     // double black markers left by removing a black leaf
+    BUBBLES,           // steps a double black is pushed up by bubble()
+    LIST_CELLS,        // List cells consed
+    ITEM_CHUNKS,       // ItemSeq chunks allocated
+    kCounters
+};
+
+struct Snapshot
+{
+    std::uint64_t counts[kCounters];
+
+    std::uint64_t operator[](Counter c) const
+    {
+        return counts[c];
+    }
+
+    // Counts since an earlier snapshot.
+    Snapshot operator-(Snapshot const & earlier) const
+    {
+        Snapshot d;
+        for (int i = 0; i < kCounters; ++i){
+            d.counts[i] = counts[i] - earlier.counts[i];
+        }
+        return d;
+    }
+
+    double nodesPerOperation() const
+    {
+        return counts[OPERATIONS] ? double(counts[NODES_ALLOCATED]) / counts[OPERATIONS] : 0;
+    }
+
+    double pathCopiesPerOperation() const
+    {
+        return counts[OPERATIONS] ? double(counts[PATH_COPIES]) / counts[OPERATIONS] : 0;
+    }
+};
+
+struct Counters
+{
+    std::atomic<std::uint64_t> counts_[kCounters];
+};
+
+struct Registry
+{
+    std::mutex lock_;
+    std::vector<Counters const *> live_;
+    std::uint64_t exited_[kCounters];
+};
+
+inline Registry & registry()
+{
+    static Registry * r = new Registry();
+    return *r;
+}
+
+// Registers the thread's counters while it runs, and folds them into the
+// totals of exited threads when it ends.
+struct Holder
+{
+    Holder()
+    {
+        for (std::atomic<std::uint64_t> & c : c_.counts_){
+            c.store(0, std::memory_order_relaxed);
+        }
+        Registry & r = registry();
+        std::lock_guard<std::mutex> g(r.lock_);
+        r.live_.push_back(&c_);
+    }
+
+    ~Holder()
+    {
+        Registry & r = registry();
+        std::lock_guard<std::mutex> g(r.lock_);
+        for (int i = 0; i < kCounters; ++i){
+            r.exited_[i] += c_.counts_[i].load(std::memory_order_relaxed);
+        }
+        for (std::size_t i = 0; i < r.live_.size(); ++i){
+            if (r.live_[i] == &c_){
+                r.live_[i] = r.live_.back();
+                r.live_.pop_back();
+                break;
+            }
+        }
+    }
+
+    Counters c_;
+};
+
+inline Counters & mine()
+{
+    thread_local Holder holder;
+    return holder.c_;
+}
+
+// Only the owning thread writes a counter, so no locked add is needed.
+inline void bump(Counter c, std::uint64_t n = 1)
+{
+    std::atomic<std::uint64_t> & v = mine().counts_[c];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline Snapshot local()
+{
+    Snapshot s;
+    Counters & c = mine();
+    for (int i = 0; i < kCounters; ++i){
+        s.counts[i] = c.counts_[i].load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+inline Snapshot total()
+{
+    Snapshot s;
+    Registry & r = registry();
+    std::lock_guard<std::mutex> g(r.lock_);
+    for (int i = 0; i < kCounters; ++i){
+        s.counts[i] = r.exited_[i];
+        for (Counters const * c : r.live_){
+            s.counts[i] += c->counts_[i].load(std::memory_order_relaxed);
+        }
+    }
+    return s;
+}
+
+} // namespace stats
+
+#ifdef RBTREE_STATS
+#define RBTREE_COUNT(counter) ::stats::bump(::stats::counter)
+#else
+#define RBTREE_COUNT(counter) ((void)0)
+#endif
+
+#endif /* defined(__rbtree__stats__) */
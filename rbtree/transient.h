@@ -0,0 +1,320 @@
+//
+//  transient.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__transient__
+#define __rbtree__transient__
+
+#include <vector>
+#include <utility>
+
+#include "rbtree.h"
+
+// A mutable editor over an RBTree, for applying a batch of updates when only
+// the final version is wanted:
+//
+//     RBTree<int, int>::Transient t(std::move(tree));
+//     for (...) t.insert(k, v);
+//     tree = t.persistent();
+//
+// A node is changed in place when the transient holds the only reference to
+// it (and so to every node above it); anything still shared with another
+// version is copied once, the first time it is touched, and is then owned by
+// the transient for the rest of the batch. persistent() shares the root with
+// the returned tree, so later edits copy again rather than disturb it.
+template<class T, class U, class Policy>
+class RBTree<T, U, Policy>::Transient
+{
+public:
+    explicit Transient(RBTree tree)
+    : root_(std::move(tree.root_))
+    {}
+    
+    RBTree persistent() const
+    {
+        return checked(RBTree(root_));
+    }
+    
+    bool isEmpty() const
+    {
+        return !root_;
+    }
+    
+    void insert(T const & x, U const & item)
+    {
+        emplace(x, item);
+    }
+    
+    void insert(T && x, U && item)
+    {
+        emplace(std::move(x), std::move(item));
+    }
+    
+    // Adds an item built in place from args under key x.
+    template<class... Args>
+    void emplace(T const & x, Args &&... args)
+    {
+        put(x, std::forward<Args>(args)...);
+    }
+    
+    template<class... Args>
+    void emplace(T && x, Args &&... args)
+    {
+        put(std::move(x), std::forward<Args>(args)...);
+    }
+    
+    void remove(T const & x)
+    {
+        if (find(x)){
+            erase();
+        }
+    }
+    
+    void remove(T const & x, U const & item)
+    {
+        if (find(x)){
+            Node * n = mut(*path_.back());
+            n->items_ = n->items_.remove(item);
+            if (n->items_.isEmpty()){
+                erase();
+            } else {
+                n->update();
+                updatePath();
+            }
+        }
+    }
+
+private:
+    template<class K, class... Args>
+    void put(K && x, Args &&... args)
+    {
+        path_.clear();
+        NodePtr * s = &root_;
+        while (*s){
+            Node * n = own(*s);
+            path_.push_back(s);
+            if (x < n->val_){
+                s = &n->lft_;
+            } else if (n->val_ < x){
+                s = &n->rgt_;
+            } else {
+                n->items_ = n->items_.emplace_front(std::forward<Args>(args)...);
+                n->update();
+                updatePath();
+                return;
+            }
+        }
+        *s = Node::make(RED, NodePtr(), std::forward<K>(x),
+                        ItemList().emplace_front(std::forward<Args>(args)...), NodePtr());
+        updatePath();
+        path_.push_back(s);
+        fixInsert();
+    }
+    
+    static Node * mut(NodePtr const & p)
+    {
+        return const_cast<Node *>(p.get());
+    }
+    
+    // Makes the node in slot s exclusively ours, copying it if need be.
+    static Node * own(NodePtr & s)
+    {
+        if (!s.unique()){
+            s = Node::make(s->c_, s->lft_, s.get(), s->rgt_);
+        }
+        return mut(s);
+    }
+    
+    static bool isBlack(NodePtr const & p)
+    {
+        return !p || p->c_ == BLACK;
+    }
+    
+    static void rotateLeft(NodePtr & s)
+    {
+        own(mut(s)->rgt_);
+        NodePtr x = std::move(s);
+        NodePtr y = std::move(mut(x)->rgt_);
+        mut(x)->rgt_ = std::move(mut(y)->lft_);
+        mut(x)->relink();
+        mut(y)->lft_ = std::move(x);
+        mut(y)->relink();
+        s = std::move(y);
+    }
+    
+    static void rotateRight(NodePtr & s)
+    {
+        own(mut(s)->lft_);
+        NodePtr x = std::move(s);
+        NodePtr y = std::move(mut(x)->lft_);
+        mut(x)->lft_ = std::move(mut(y)->rgt_);
+        mut(x)->relink();
+        mut(y)->rgt_ = std::move(x);
+        mut(y)->relink();
+        s = std::move(y);
+    }
+    
+    // Refreshes the subtree summaries of every node on path_, deepest first.
+    // A node whose own items changed must have been update()d already.
+    void updatePath()
+    {
+        for (auto it = path_.rbegin(); it != path_.rend(); ++it){
+            mut(**it)->relink();
+        }
+    }
+    
+    // Leaves path_ holding the slots from the root down to x's node, each
+    // node on it owned.
+    bool find(T const & x)
+    {
+        path_.clear();
+        NodePtr * s = &root_;
+        while (*s){
+            Node * n = own(*s);
+            path_.push_back(s);
+            if (x < n->val_){
+                s = &n->lft_;
+            } else if (n->val_ < x){
+                s = &n->rgt_;
+            } else {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // path_ ends with a freshly inserted red node.
+    void fixInsert()
+    {
+        std::size_t i = path_.size() - 1;
+        while (i >= 2 && (*path_[i - 1])->c_ == RED){
+            Node * p = mut(*path_[i - 1]);
+            Node * g = mut(*path_[i - 2]);
+            bool parentLeft = path_[i - 1] == &g->lft_;
+            NodePtr & uncle = parentLeft ? g->rgt_ : g->lft_;
+            if (!isBlack(uncle)){
+                own(uncle)->c_ = BLACK;
+                p->c_ = BLACK;
+                g->c_ = RED;
+                i -= 2;
+                continue;
+            }
+            bool childLeft = path_[i] == &p->lft_;
+            if (parentLeft){
+                if (!childLeft){
+                    rotateLeft(*path_[i - 1]);
+                }
+                rotateRight(*path_[i - 2]);
+            } else {
+                if (childLeft){
+                    rotateRight(*path_[i - 1]);
+                }
+                rotateLeft(*path_[i - 2]);
+            }
+            mut(*path_[i - 2])->c_ = BLACK;
+            g->c_ = RED;
+            break;
+        }
+        mut(root_)->c_ = BLACK;
+    }
+    
+    // Unlinks the node at the end of path_.
+    void erase()
+    {
+        Node * z = mut(*path_.back());
+        if (z->lft_ && z->rgt_){
+            // Pull up the successor's contents and unlink the successor.
+            NodePtr * s = &z->rgt_;
+            for (;;){
+                Node * n = own(*s);
+                path_.push_back(s);
+                if (!n->lft_)
+                    break;
+                s = &n->lft_;
+            }
+            Node * y = mut(*path_.back());
+            z->val_ = std::move(y->val_);
+            z->items_ = std::move(y->items_);
+            z->reuse(y, z->lft_.get(), z->rgt_.get());
+        }
+        NodePtr * ys = path_.back();
+        path_.pop_back();
+        Node * y = mut(*ys);
+        Color removed = y->c_;
+        NodePtr child = y->lft_ ? y->lft_ : y->rgt_;
+        *ys = std::move(child);
+        updatePath();
+        if (removed == RED)
+            return;
+        if (*ys){
+            own(*ys)->c_ = BLACK;
+            return;
+        }
+        fixErase(ys);
+    }
+    
+    // xs holds a subtree one black short; path_ ends with its parent's slot.
+    void fixErase(NodePtr * xs)
+    {
+        while (xs != &root_ && isBlack(*xs)){
+            NodePtr * ps = path_.back();
+            Node * p = mut(*ps);
+            bool xLeft = xs == &p->lft_;
+            NodePtr & ws = xLeft ? p->rgt_ : p->lft_;
+            Node * w = own(ws);
+            if (w->c_ == RED){
+                w->c_ = BLACK;
+                p->c_ = RED;
+                if (xLeft){
+                    rotateLeft(*ps);
+                    path_.push_back(&w->lft_);
+                } else {
+                    rotateRight(*ps);
+                    path_.push_back(&w->rgt_);
+                }
+                continue;
+            }
+            if (isBlack(w->lft_) && isBlack(w->rgt_)){
+                w->c_ = RED;
+                xs = ps;
+                path_.pop_back();
+                continue;
+            }
+            if (xLeft){
+                if (isBlack(w->rgt_)){
+                    own(w->lft_)->c_ = BLACK;
+                    w->c_ = RED;
+                    rotateRight(ws);
+                    w = mut(ws);
+                }
+                w->c_ = p->c_;
+                p->c_ = BLACK;
+                own(w->rgt_)->c_ = BLACK;
+                rotateLeft(*ps);
+            } else {
+                if (isBlack(w->lft_)){
+                    own(w->rgt_)->c_ = BLACK;
+                    w->c_ = RED;
+                    rotateLeft(ws);
+                    w = mut(ws);
+                }
+                w->c_ = p->c_;
+                p->c_ = BLACK;
+                own(w->lft_)->c_ = BLACK;
+                rotateRight(*ps);
+            }
+            return;
+        }
+        if (*xs){
+            own(*xs)->c_ = BLACK;
+        }
+    }
+    
+    NodePtr root_;
+    std::vector<NodePtr *> path_;
+};
+
+#endif /* defined(__rbtree__transient__) */
@@ -0,0 +1,144 @@
+//
+//  traverse.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__traverse__
+#define __rbtree__traverse__
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rbtree.h"
+#include "parallel.h"
+
+// Whole-tree traversals split by subtree onto the TaskPool. The top few
+// levels of the tree fork their two sides, as the set operations do; below
+// that each piece is walked on one thread. A red-black tree's two sides are
+// within a factor of two of each other in height, so the pieces come out of
+// similar size.
+
+namespace traverse {
+
+// The sequential walks take Views, which move about the tree without
+// touching reference counts; the forking levels above them take trees.
+
+template<class V, class F>
+void walk(V const & t, F & f)
+{
+    if (t.isEmpty())
+        return;
+    walk(t.left(), f);
+    walk(t.right(), f);
+    f(t.value(), t.items());
+}
+
+template<class Tree, class F>
+void forEach(Tree const & t, F & f, int forks)
+{
+    if (forks <= 0 || t.isEmpty()){
+        walk(t.view(), f);
+        return;
+    }
+    forkJoin([&]{ forEach(t.left(), f, forks - 1); },
+             [&]{ forEach(t.right(), f, forks - 1); });
+    f(t.value(), t.items());
+}
+
+template<class R, class V, class M, class C>
+R fold(V const & t, R const & identity, M & map, C & combine)
+{
+    if (t.isEmpty())
+        return identity;
+    R l = fold(t.left(), identity, map, combine);
+    R r = fold(t.right(), identity, map, combine);
+    return combine(combine(l, map(t.value(), t.items())), r);
+}
+
+template<class R, class Tree, class M, class C>
+R reduce(Tree const & t, R const & identity, M & map, C & combine, int forks)
+{
+    if (forks <= 0 || t.isEmpty())
+        return fold(t.view(), identity, map, combine);
+    R l = identity, r = identity;
+    forkJoin([&]{ l = reduce(t.left(), identity, map, combine, forks - 1); },
+             [&]{ r = reduce(t.right(), identity, map, combine, forks - 1); });
+    return combine(combine(l, map(t.value(), t.items())), r);
+}
+
+template<class Out, class V, class F>
+typename Out::ItemList mapItems(V const & t, F & f)
+{
+    // Lists are built from the back, so all but single items go through a
+    // buffer.
+    if (t.items().size() == 1)
+        return typename Out::ItemList().push_front(f(t.items().front()));
+    std::vector<typename Out::ItemList::value_type> mapped;
+    for (auto const & u : t.items()){
+        mapped.push_back(f(u));
+    }
+    typename Out::ItemList items;
+    for (auto it = mapped.rbegin(); it != mapped.rend(); ++it){
+        items = items.push_front(std::move(*it));
+    }
+    return items;
+}
+
+template<class Out, class V, class F>
+Out copy(V const & t, F & f)
+{
+    if (t.isEmpty())
+        return Out();
+    Out l = copy<Out>(t.left(), f);
+    Out r = copy<Out>(t.right(), f);
+    return Out(t.rootColor(), l, t.value(), mapItems<Out>(t, f), r);
+}
+
+template<class Out, class Tree, class F>
+Out mapValues(Tree const & t, F & f, int forks)
+{
+    if (forks <= 0 || t.isEmpty())
+        return copy<Out>(t.view(), f);
+    Out l, r;
+    forkJoin([&]{ l = mapValues<Out>(t.left(), f, forks - 1); },
+             [&]{ r = mapValues<Out>(t.right(), f, forks - 1); });
+    return Out(t.rootColor(), l, t.value(), mapItems<Out>(t, f), r);
+}
+
+} // namespace traverse
+
+// Calls f(key, items) for every entry, from several threads at once and in
+// no particular order; f must be safe to call concurrently.
+template<class T, class U, class P, class F>
+void parallelForEach(RBTree<T, U, P> const & t, F f)
+{
+    traverse::forEach(t, f, forkDepth());
+}
+
+// combine over map(key, items) of every entry, in key order:
+//
+//     combine(...combine(combine(identity, map(k0, i0)), map(k1, i1))..., map(kn, in))
+//
+// up to regrouping, so combine must be associative with identity as its
+// identity. map and combine are called from several threads at once.
+template<class T, class U, class P, class R, class M, class C>
+R parallelReduce(RBTree<T, U, P> const & t, R const & identity, M map, C combine)
+{
+    return traverse::reduce(t, identity, map, combine, forkDepth());
+}
+
+// t with every item u replaced by f(u): same keys, same item order and the
+// same shape, so nothing is rebalanced. Subtrees are built in parallel; f is
+// called from several threads at once.
+template<class T, class U, class P, class F>
+RBTree<T, typename std::decay<typename std::invoke_result<F, U const &>::type>::type, P>
+mapValues(RBTree<T, U, P> const & t, F f)
+{
+    typedef RBTree<T, typename std::decay<typename std::invoke_result<F, U const &>::type>::type, P> Out;
+    return traverse::mapValues<Out>(t, f, forkDepth());
+}
+
+#endif /* defined(__rbtree__traverse__) */
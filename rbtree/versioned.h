@@ -0,0 +1,215 @@
+//
+//  versioned.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__versioned__
+#define __rbtree__versioned__
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rbtree.h"
+
+// A "current" RBTree shared between threads. Readers take snapshots without
+// locking or writing to anything shared but their own hazard slot; writers
+// publish new versions with a compare-and-swap on the root. A root that has
+// been replaced is only let go of once no reader can still be in the middle
+// of taking a snapshot of it, after which the snapshots themselves keep it
+// alive for as long as they need it.
+
+namespace hazard {
+
+// One per thread that has ever taken a snapshot, reused after the thread
+// exits. Records are never freed, so scanning them needs no lock.
+struct Record
+{
+    alignas(64) std::atomic<void const *> ptr_;
+    std::atomic<bool> active_;
+    Record * next_;
+};
+
+inline std::atomic<Record *> & records()
+{
+    static std::atomic<Record *> head(nullptr);
+    return head;
+}
+
+inline Record * claim()
+{
+    for (Record * r = records().load(std::memory_order_acquire); r; r = r->next_){
+        bool idle = false;
+        if (!r->active_.load(std::memory_order_relaxed)
+            && r->active_.compare_exchange_strong(idle, true, std::memory_order_acquire)){
+            return r;
+        }
+    }
+    Record * r = new Record;
+    r->ptr_.store(nullptr, std::memory_order_relaxed);
+    r->active_.store(true, std::memory_order_relaxed);
+    r->next_ = records().load(std::memory_order_relaxed);
+    while (!records().compare_exchange_weak(r->next_, r, std::memory_order_release)) {}
+    return r;
+}
+
+struct RecordHolder
+{
+    RecordHolder() : r_(claim()) {}
+    ~RecordHolder() { r_->active_.store(false, std::memory_order_release); }
+    Record * r_;
+};
+
+// The calling thread's hazard slot.
+inline std::atomic<void const *> & slot()
+{
+    thread_local RecordHolder holder;
+    return holder.r_->ptr_;
+}
+
+// Every pointer some thread is currently protecting, sorted.
+inline std::vector<void const *> protectedNow()
+{
+    std::vector<void const *> v;
+    for (Record * r = records().load(std::memory_order_acquire); r; r = r->next_){
+        if (void const * p = r->ptr_.load(std::memory_order_seq_cst))
+            v.push_back(p);
+    }
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+} // namespace hazard
+
+template<class T, class U, class Policy = DefaultPolicy>
+class VersionedRBTree
+{
+public:
+    typedef RBTree<T, U, Policy> Tree;
+
+private:
+    typedef typename Tree::Node Node;
+    typedef typename Tree::NodePtr NodePtr;
+
+    static_assert(std::is_same<typename Policy::refcount, AtomicCount>::value,
+                  "VersionedRBTree shares nodes between threads and needs atomic counts");
+
+public:
+    VersionedRBTree() : root_(nullptr) {}
+
+    explicit VersionedRBTree(Tree const & initial) : root_(take(initial)) {}
+
+    VersionedRBTree(VersionedRBTree const &) = delete;
+    VersionedRBTree & operator=(VersionedRBTree const &) = delete;
+
+    // No snapshot may be in progress; snapshots already taken stay valid.
+    ~VersionedRBTree()
+    {
+        drop(root_.load(std::memory_order_relaxed));
+        for (Node const * n : retired_){
+            drop(n);
+        }
+    }
+
+    // The current version. Lock-free: a reader only retries if a writer
+    // replaced the root while it was looking.
+    Tree snapshot() const
+    {
+        std::atomic<void const *> & hp = hazard::slot();
+        Node const * n = root_.load(std::memory_order_acquire);
+        for (;;){
+            hp.store(n, std::memory_order_seq_cst);
+            Node const * again = root_.load(std::memory_order_seq_cst);
+            if (again == n)
+                break;
+            n = again;
+        }
+        Tree t = Tree(NodePtr(n));
+        hp.store(nullptr, std::memory_order_release);
+        return t;
+    }
+
+    // Makes next the current version, whatever it was before.
+    void publish(Tree const & next)
+    {
+        retire(root_.exchange(take(next), std::memory_order_seq_cst));
+    }
+
+    // Makes next the current version if expected still is; false, and no
+    // change, if some other writer got there first.
+    bool compareAndPublish(Tree const & expected, Tree const & next)
+    {
+        Node const * old = expected.root_.get();
+        Node const * n = take(next);
+        if (root_.compare_exchange_strong(old, n, std::memory_order_seq_cst)){
+            retire(old);
+            return true;
+        }
+        drop(n);
+        return false;
+    }
+
+    // Publishes f(current), retrying with the new current version if another
+    // writer publishes first. Returns the version published.
+    template<class F>
+    Tree update(F f)
+    {
+        for (;;){
+            Tree cur = snapshot();
+            Tree next = f(cur);
+            if (compareAndPublish(cur, next))
+                return next;
+        }
+    }
+
+private:
+    // A reference for root_ to own.
+    static Node const * take(Tree const & t)
+    {
+        Node const * n = t.root_.get();
+        if (n)
+            n->refs_.retain();
+        return n;
+    }
+
+    static void drop(Node const * n)
+    {
+        if (n && n->refs_.release())
+            Node::destroy(n);
+    }
+
+    // Lets go of a replaced root once no reader is protecting it. Roots are
+    // checked against the hazard slots in batches.
+    void retire(Node const * n)
+    {
+        if (!n)
+            return;
+        std::lock_guard<std::mutex> g(lock_);
+        retired_.push_back(n);
+        if (retired_.size() < kScanAfter)
+            return;
+        std::vector<void const *> busy = hazard::protectedNow();
+        std::vector<Node const *> keep;
+        for (Node const * r : retired_){
+            if (std::binary_search(busy.begin(), busy.end(), static_cast<void const *>(r))){
+                keep.push_back(r);
+            } else {
+                drop(r);
+            }
+        }
+        retired_.swap(keep);
+    }
+
+    static const std::size_t kScanAfter = 64;
+
+    std::atomic<Node const *> root_;
+    std::mutex lock_;
+    std::vector<Node const *> retired_;
+};
+
+#endif /* defined(__rbtree__versioned__) */
@@ -0,0 +1,237 @@
+//
+//  augment_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+#include "transient.h"
+
+namespace {
+
+// Affine maps x -> a x + b mod 2^64 under composition: associative, and not
+// commutative, so any entry or item taken out of order changes the result.
+struct Affine
+{
+    std::uint64_t a, b;
+
+    bool operator==(Affine const & o) const
+    {
+        return a == o.a && b == o.b;
+    }
+};
+
+struct AffineMonoid
+{
+    typedef Affine value_type;
+
+    static Affine identity()
+    {
+        return Affine{ 1, 0 };
+    }
+
+    // f then g.
+    static Affine combine(Affine const & f, Affine const & g)
+    {
+        return Affine{ g.a * f.a, g.a * f.b + g.b };
+    }
+
+    static std::size_t & measured()
+    {
+        static std::size_t n = 0;
+        return n;
+    }
+
+    static Affine measure(int item)
+    {
+        ++measured();
+        return Affine{ std::uint64_t(2 * item + 3), std::uint64_t(item) };
+    }
+};
+
+struct AffinePolicy : DefaultPolicy
+{
+    typedef AffineMonoid monoid;
+};
+
+typedef RBTree<int, int, AffinePolicy> ATree;
+
+// The aggregate of the keys in [lo, hi) worked out by walking the tree.
+Affine walked(ATree const & t, int lo, int hi)
+{
+    Affine f = AffineMonoid::identity();
+    for (auto it = t.lower_bound(lo); it != t.end() && it->value() < hi; ++it){
+        for (int u : it->items()){
+            f = AffineMonoid::combine(f, Affine{ std::uint64_t(2 * u + 3), std::uint64_t(u) });
+        }
+    }
+    return f;
+}
+
+void checkAggregates(ATree const & t, std::mt19937 & rng)
+{
+    CHECK(t.aggregate() == walked(t, -1, 1 << 30));
+    for (int i = 0; i < 20; ++i){
+        int lo = rng() % 420 - 10, hi = lo + rng() % 200;
+        CHECK(t.aggregate(lo, hi) == walked(t, lo, hi));
+    }
+    CHECK(t.aggregate(50, 50) == AffineMonoid::identity());
+    CHECK(t.aggregate(60, 40) == AffineMonoid::identity());
+}
+
+void testUpdates()
+{
+    std::mt19937 rng(29);
+    ATree t;
+    Model m;
+    std::vector<ATree> old;
+    for (int step = 0; step < 5000; ++step){
+        int k = rng() % 400, item = rng() % 8;
+        switch (rng() % 4){
+            case 0:
+                t = t.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                t = t.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                t = t.insert(k, item);
+                m.emplace(k, item);
+        }
+        if (step % 250 == 0){
+            CHECK(contents(t) == contents(m));
+            checkAggregates(t, rng);
+            old.push_back(t);
+        }
+    }
+    for (ATree const & v : old){
+        checkAggregates(v, rng);
+    }
+    CHECK(ATree().aggregate() == AffineMonoid::identity());
+    CHECK(ATree().aggregate(0, 10) == AffineMonoid::identity());
+}
+
+void testTransientAndFromSorted()
+{
+    std::mt19937 rng(31);
+    std::vector<std::pair<int, ATree::ItemList>> sorted;
+    for (int k = 0; k < 400; k += 2){
+        sorted.push_back(std::make_pair(k, ATree::ItemList({ k % 7, k % 5, k % 3 })));
+    }
+    ATree built = ATree::fromSorted(sorted.begin(), sorted.end());
+    checkAggregates(built, rng);
+    checkAggregates(ATree::fromSortedParallel(sorted.begin(), sorted.end(), 8), rng);
+
+    ATree::Transient tr(built);
+    Model m;
+    for (auto const & p : sorted){
+        for (int u : p.second){
+            m.emplace(p.first, u);
+        }
+    }
+    for (int step = 0; step < 3000; ++step){
+        int k = rng() % 400, item = rng() % 8;
+        switch (rng() % 4){
+            case 0:
+                tr.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                tr.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                tr.insert(k, item);
+                m.emplace(k, item);
+        }
+    }
+    ATree t = tr.persistent();
+    CHECK(contents(t) == contents(m));
+    checkAggregates(t, rng);
+    checkAggregates(built, rng);
+}
+
+// Rebuilding nodes on the way back up an update, recolouring and rotating
+// them, keeps what each already knew of its own items: only the key the
+// update touched is measured again.
+void testNoRemeasuring()
+{
+    ATree t;
+    for (int k = 0; k < 2000; ++k){
+        for (int u = 0; u < 20; ++u){
+            t = t.insert(k, u);
+        }
+    }
+    std::size_t before = AffineMonoid::measured();
+    ATree u = t.insert(5000, 1);
+    for (int k = 5001; k < 5100; ++k){
+        u = u.insert(k, 1);
+    }
+    CHECK(AffineMonoid::measured() - before == 100);
+    before = AffineMonoid::measured();
+    for (int k = 0; k < 2000; k += 20){
+        u = u.remove(k);
+    }
+    CHECK(AffineMonoid::measured() == before);
+
+    ATree::Transient tr(u);
+    before = AffineMonoid::measured();
+    for (int k = 6000; k < 6100; ++k){
+        tr.insert(k, 1);
+    }
+    for (int k = 1; k < 2000; k += 20){
+        tr.remove(k);
+    }
+    CHECK(AffineMonoid::measured() - before == 100);
+    CHECK(tr.persistent().aggregate() == walked(tr.persistent(), -1, 1 << 30));
+}
+
+template<class M>
+struct FloatPolicy : DefaultPolicy
+{
+    typedef M monoid;
+};
+
+typedef RBTree<int, float, FloatPolicy<MinMonoid<float>>> MinTree;
+typedef RBTree<int, float, FloatPolicy<MaxMonoid<float>>> MaxTree;
+
+// Float items at the infinities: the empty aggregate is the far infinity,
+// not the largest or lowest finite float, so an item of infinity shows.
+void testInfinities()
+{
+    float const inf = std::numeric_limits<float>::infinity();
+    CHECK(MinTree().aggregate() == inf);
+    CHECK(MaxTree().aggregate() == -inf);
+
+    MinTree lo = MinTree().insert(1, inf).insert(2, inf);
+    MaxTree hi = MaxTree().insert(1, -inf).insert(2, -inf);
+    CHECK(lo.aggregate() == inf && lo.aggregate(0, 2) == inf);
+    CHECK(hi.aggregate() == -inf && hi.aggregate(0, 2) == -inf);
+
+    lo = lo.insert(3, 2.5f).insert(2, -inf);
+    hi = hi.insert(3, 2.5f).insert(2, inf);
+    CHECK(lo.aggregate() == -inf && lo.aggregate(0, 2) == inf && lo.aggregate(3, 4) == 2.5f);
+    CHECK(hi.aggregate() == inf && hi.aggregate(0, 2) == -inf && hi.aggregate(3, 4) == 2.5f);
+    CHECK(lo.aggregate(5, 9) == inf && hi.aggregate(5, 9) == -inf);
+}
+
+} // namespace
+
+int main()
+{
+    testUpdates();
+    testTransientAndFromSorted();
+    testNoRemeasuring();
+    testInfinities();
+    return checkResult();
+}
@@ -0,0 +1,85 @@
+//
+//  batch_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+#include "batch.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+void testBatchUpdates()
+{
+    std::mt19937 rng(9);
+    for (int round = 0; round < 20; ++round){
+        Tree base;
+        for (int i = 0; i < 2000; ++i){
+            base = base.insert(rng() % 4000, i);
+        }
+        auto before = exactly(base);
+        // Small batches in the first rounds, then ones big enough to fork.
+        std::size_t k = round < 10 ? 1 + rng() % 50 : 5000 + rng() % 5000;
+        std::vector<std::pair<int, int>> ins;
+        for (std::size_t i = 0; i < k; ++i){
+            ins.push_back(std::make_pair(rng() % 8000, static_cast<int>(i)));
+        }
+        std::stable_sort(ins.begin(), ins.end(),
+                         [](std::pair<int, int> const & a, std::pair<int, int> const & b){ return a.first < b.first; });
+        Tree one = base;
+        for (auto const & p : ins){
+            one = one.insert(p.first, p.second);
+        }
+        Tree batched = insertBatch(base, ins.begin(), ins.end());
+        CHECK(batched.isValid());
+        CHECK(exactly(batched) == exactly(one));
+
+        std::vector<int> keys;
+        for (std::size_t i = 0; i < k; ++i){
+            keys.push_back(rng() % 8000);
+        }
+        std::sort(keys.begin(), keys.end());
+        Tree gone = batched;
+        for (int x : keys){
+            gone = gone.remove(x);
+        }
+        Tree gone2 = removeBatch(batched, keys.begin(), keys.end());
+        CHECK(gone2.isValid());
+        CHECK(exactly(gone2) == exactly(gone));
+
+        Tree less = batched;
+        for (auto const & p : ins){
+            less = less.remove(p.first, p.second);
+        }
+        Tree less2 = removeBatch(batched, ins.begin(), ins.end());
+        CHECK(less2.isValid());
+        CHECK(exactly(less2) == exactly(less));
+        CHECK(exactly(less2) == before);
+        CHECK(exactly(base) == before);
+    }
+    Tree t = { { 1, 1 } };
+    std::vector<int> none;
+    CHECK(removeBatch(t, none.begin(), none.end()).id() == t.id());
+    std::vector<int> absent = { 5, 6 };
+    CHECK(removeBatch(t, absent.begin(), absent.end()).id() == t.id());
+    std::vector<std::pair<int, int>> nothing;
+    CHECK(insertBatch(Tree(), nothing.begin(), nothing.end()).isEmpty());
+}
+
+} // namespace
+
+int main()
+{
+    testBatchUpdates();
+    return checkResult();
+}
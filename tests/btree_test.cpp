@@ -0,0 +1,258 @@
+//
+//  btree_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <iterator>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "btree.h"
+
+namespace {
+
+typedef BTree<int, int> Tree;
+
+// Four keys to a node and at least two in each but the root, so that a few
+// dozen keys go through every split and merge at several levels.
+struct SmallNodes : DefaultPolicy
+{
+    static const std::size_t btreeNodeBytes = 4 * sizeof(int);
+};
+
+typedef BTree<int, int, SmallNodes> SmallTree;
+
+template<class Tr>
+std::vector<int> keys(Tr const & t)
+{
+    std::vector<int> v;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        v.push_back(it->value());
+    }
+    return v;
+}
+
+template<class Tr>
+std::vector<int> keysBackwards(Tr const & t)
+{
+    std::vector<int> v;
+    for (auto it = t.end(); it != t.begin(); ){
+        --it;
+        v.push_back(it->value());
+    }
+    return v;
+}
+
+template<class Tr>
+void checkAgainst(Tr const & t, Model const & m)
+{
+    CHECK(t.isValid());
+    CHECK(contents(t) == contents(m));
+    std::vector<int> forward = keys(t);
+    std::vector<int> backward = keysBackwards(t);
+    CHECK(std::vector<int>(forward.rbegin(), forward.rend()) == backward);
+    CHECK(t.isEmpty() == m.empty());
+}
+
+template<class Tr>
+void randomUpdates(unsigned seed, int steps, int range)
+{
+    std::mt19937 rng(seed);
+    Tr t;
+    Model m;
+    std::vector<std::pair<Tr, Model>> old;
+    for (int step = 0; step < steps; ++step){
+        int k = rng() % range, item = rng() % 4;
+        switch (rng() % 4){
+            case 0:
+                t = t.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                t = t.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                t = t.insert(k, item);
+                m.emplace(k, item);
+        }
+        if (step % 250 == 0){
+            checkAgainst(t, m);
+            old.push_back(std::make_pair(t, m));
+        }
+    }
+    checkAgainst(t, m);
+    // Earlier versions are untouched by what came after.
+    for (auto const & v : old){
+        checkAgainst(v.first, v.second);
+    }
+}
+
+void testAgainstMultimap()
+{
+    randomUpdates<Tree>(3, 5000, 1000);
+    randomUpdates<Tree>(5, 20000, 5000);
+    randomUpdates<SmallTree>(7, 5000, 300);
+    randomUpdates<SmallTree>(11, 3000, 40);
+}
+
+void testRemoveItem()
+{
+    Tree t = { { 1, 10 }, { 1, 11 }, { 2, 20 } };
+    // An item that is not there, under a key that is or is not, changes
+    // nothing.
+    CHECK(keys(t.remove(1, 12)) == std::vector<int>({ 1, 2 }));
+    CHECK(t.remove(1, 12).getItems(1).size() == 2);
+    CHECK(keys(t.remove(3, 10)) == std::vector<int>({ 1, 2 }));
+    CHECK(keys(Tree().remove(1, 10)).empty());
+    // Taking one of two items keeps the key; taking the last drops it.
+    Tree u = t.remove(1, 10);
+    CHECK(u.getItems(1).size() == 1 && u.getItems(1).front() == 11);
+    CHECK(u.member(1));
+    u = u.remove(1, 11);
+    CHECK(!u.member(1));
+    CHECK(keys(u) == std::vector<int>({ 2 }));
+    u = u.remove(2, 20);
+    CHECK(u.isEmpty());
+    CHECK(t.getItems(1).size() == 2 && t.member(2));
+}
+
+void testIterators()
+{
+    std::mt19937 rng(13);
+    SmallTree t;
+    std::set<int> model;
+    for (int i = 0; i < 2000; ++i){
+        int k = rng() % 3000;
+        if (rng() % 4 == 0){
+            t = t.remove(k);
+            model.erase(k);
+        } else {
+            t = t.insert(k, i);
+            model.insert(k);
+        }
+    }
+    std::vector<int> forward(model.begin(), model.end());
+    std::vector<int> backward(model.rbegin(), model.rend());
+    CHECK(keys(t) == forward);
+    CHECK(keysBackwards(t) == backward);
+    std::vector<int> viaReverse;
+    for (auto it = std::make_reverse_iterator(t.end()); it != std::make_reverse_iterator(t.begin()); ++it){
+        viaReverse.push_back(it->value());
+    }
+    CHECK(viaReverse == backward);
+    CHECK(std::distance(t.begin(), t.end()) == static_cast<std::ptrdiff_t>(model.size()));
+
+    // Back and forth across leaf and inner node edges from every key.
+    for (auto it = std::next(t.begin()); it != t.end(); ++it){
+        int k = it->value();
+        SmallTree::const_iterator old = it--;
+        CHECK(old->value() == k);
+        CHECK(it->value() == *std::prev(model.find(k)));
+        CHECK((++it)->value() == k);
+    }
+
+    // Bounds and the entry just past a key, at, between and beyond keys.
+    for (int x = -2; x < 3002; x += 7){
+        auto lo = model.lower_bound(x), hi = model.upper_bound(x);
+        SmallTree::const_iterator l = t.lower_bound(x), h = t.upper_bound(x);
+        CHECK(lo == model.end() ? l == t.end() : l->value() == *lo);
+        CHECK(hi == model.end() ? h == t.end() : h->value() == *hi);
+        SmallTree::Contents c = t.getNodeJustGreaterThan(x);
+        if (hi == model.end()){
+            CHECK(c.items().isEmpty());
+        } else {
+            CHECK(c.value() == *hi);
+            CHECK(c.items().size() == t.getItems(*hi).size());
+        }
+        CHECK(t.member(x) == (model.count(x) > 0));
+    }
+
+    SmallTree one = { { 5, 1 } };
+    CHECK((--one.end())->value() == 5);
+    CHECK(--one.end() == one.begin());
+    CHECK(++one.begin() == one.end());
+    CHECK(SmallTree().begin() == SmallTree().end());
+    CHECK(SmallTree().lower_bound(1) == SmallTree().end());
+    CHECK(SmallTree().getNodeJustGreaterThan(1).items().isEmpty());
+}
+
+// Ascending and descending runs up to and past each multiple of the fan-out,
+// so that leaves and inner nodes split when one more key than fits arrives
+// and merge or borrow when one falls below the minimum; checked after every
+// step.
+template<class Tr>
+void fillAndDrain(int n, bool descending)
+{
+    Tr t;
+    Model m;
+    for (int i = 0; i < n; ++i){
+        int k = descending ? n - 1 - i : i;
+        t = t.insert(k, k);
+        m.emplace(k, k);
+        CHECK(t.isValid());
+    }
+    checkAgainst(t, m);
+    // Drain from the front, the back and the middle in turn.
+    std::vector<int> order;
+    for (int lo = 0, hi = n - 1; lo <= hi; ){
+        order.push_back(lo++);
+        if (lo <= hi)
+            order.push_back(hi--);
+    }
+    for (int k : order){
+        t = t.remove(k);
+        m.erase(k);
+        CHECK(t.isValid());
+        CHECK(!t.member(k));
+    }
+    checkAgainst(t, m);
+    CHECK(t.isEmpty());
+}
+
+void testFanout()
+{
+    // Small nodes: 4 keys, at least 2. 5 keys split the root leaf, 13 go to
+    // three levels, 41 to four.
+    for (int n : { 1, 3, 4, 5, 8, 9, 12, 13, 16, 17, 40, 41, 42, 200 }){
+        fillAndDrain<SmallTree>(n, false);
+        fillAndDrain<SmallTree>(n, true);
+    }
+    // The default: 256 bytes of int keys, so 64 keys and at least 32.
+    const int kKeys = 256 / sizeof(int);
+    for (int n : { kKeys, kKeys + 1, 2 * kKeys, 2 * kKeys + 1, kKeys * (kKeys / 2 + 1) + 1 }){
+        fillAndDrain<Tree>(n, false);
+        fillAndDrain<Tree>(n, true);
+    }
+}
+
+// Nodes are too big for the pool and come from the heap; see btree.h. With
+// no more items under a key than fit inline, the pool is not touched.
+void testAllocation()
+{
+    std::size_t before = poolStats().liveBytes;
+    Tree t;
+    for (int k = 0; k < 1000; ++k){
+        t = t.insert(k, k).insert(k, -k);
+    }
+    CHECK(poolStats().liveBytes == before);
+    t = Tree();
+    CHECK(poolStats().liveBytes == before);
+}
+
+} // namespace
+
+int main()
+{
+    testAgainstMultimap();
+    testRemoveItem();
+    testIterators();
+    testFanout();
+    testAllocation();
+    return checkResult();
+}
@@ -0,0 +1,40 @@
+//
+//  check.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__check__
+#define __rbtree__check__
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal test support: CHECK records a failure and carries on, and each
+// test's main returns checkResult().
+
+inline int & checkFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)){ \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++checkFailures(); \
+        } \
+    } while (0)
+
+inline int checkResult()
+{
+    if (checkFailures()){
+        std::fprintf(stderr, "%d check(s) failed\n", checkFailures());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif /* defined(__rbtree__check__) */
@@ -0,0 +1,229 @@
+//
+//  diff_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+#include "diff.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+typedef std::map<int, std::vector<int>> Entries;
+
+Tree range(int lo, int hi)
+{
+    Tree t;
+    for (int i = lo; i < hi; ++i){
+        t = t.insert(i, i);
+    }
+    return t;
+}
+
+Entries entries(Tree const & t)
+{
+    Entries m;
+    for (auto const & p : exactly(t)){
+        m[p.first] = p.second;
+    }
+    return m;
+}
+
+void testDiff()
+{
+    Tree a = range(0, 1000);
+    Tree b = a.insert(5000, 1).remove(10).insert(20, 7);
+    std::vector<Change<Tree>> d = diff(a, b);
+    CHECK(d.size() == 3);
+    CHECK(d[0].kind == REMOVED && d[0].entry().value() == 10);
+    CHECK(d[1].kind == CHANGED && d[1].entry().value() == 20);
+    CHECK(d[2].kind == ADDED && d[2].entry().value() == 5000);
+    CHECK(diff(b, b).empty());
+    CHECK(diff(Tree(), Tree()).empty());
+    CHECK(diff(Tree(), a).size() == 1000);
+    CHECK(diff(a, Tree()).size() == 1000);
+}
+
+// Versions apart by a few to many random updates, against the entries
+// read out of both.
+void testRandomVersions()
+{
+    std::mt19937 rng(47);
+    Tree base;
+    for (int i = 0; i < 2000; ++i){
+        base = base.insert(rng() % 3000, rng() % 5);
+    }
+    for (int updates : { 1, 5, 50, 500, 5000 }){
+        Tree t = base;
+        for (int i = 0; i < updates; ++i){
+            int k = rng() % 3000, item = rng() % 5;
+            switch (rng() % 4){
+                case 0:
+                    t = t.remove(k);
+                    break;
+                case 1:
+                    t = t.remove(k, item);
+                    break;
+                default:
+                    t = t.insert(k, item);
+            }
+        }
+        Entries before = entries(base), after = entries(t);
+        Entries changed;
+        for (auto const & p : before){
+            auto it = after.find(p.first);
+            if (it == after.end() || it->second != p.second)
+                changed[p.first] = p.second;
+        }
+        for (auto const & p : after){
+            if (!before.count(p.first))
+                changed[p.first] = p.second;
+        }
+        std::vector<Change<Tree>> d = diff(base, t);
+        CHECK(d.size() == changed.size());
+        int last = -1;
+        for (Change<Tree> const & c : d){
+            int k = c.entry().value();
+            CHECK(k > last && changed.count(k));
+            last = k;
+            std::vector<int> was(c.before.items().begin(), c.before.items().end());
+            std::vector<int> now(c.after.items().begin(), c.after.items().end());
+            CHECK(c.kind == (!before.count(k) ? ADDED : !after.count(k) ? REMOVED : CHANGED));
+            CHECK(before.count(k) ? was == before[k] : was.empty());
+            CHECK(after.count(k) ? now == after[k] : now.empty());
+        }
+    }
+}
+
+// Items with == and no <, so that itemDelta has to match them pairwise.
+struct Tag
+{
+    std::string s;
+
+    bool operator==(Tag const & o) const
+    {
+        return s == o.s;
+    }
+};
+
+int key(int u)
+{
+    return u;
+}
+
+std::string key(Tag const & t)
+{
+    return t.s;
+}
+
+template<class U>
+std::vector<U> sorted(std::vector<U> v)
+{
+    std::sort(v.begin(), v.end(), [](U const & x, U const & y){ return key(x) < key(y); });
+    return v;
+}
+
+// The multiset difference a - b, sorted.
+template<class U>
+std::vector<U> without(std::vector<U> a, std::vector<U> const & b)
+{
+    for (U const & u : b){
+        auto it = std::find(a.begin(), a.end(), u);
+        if (it != a.end())
+            a.erase(it);
+    }
+    return sorted(a);
+}
+
+template<class U>
+bool isSubsequence(std::vector<U> const & part, std::vector<U> const & whole)
+{
+    std::size_t i = 0;
+    for (std::size_t j = 0; i < part.size() && j < whole.size(); ++j){
+        if (part[i] == whole[j])
+            ++i;
+    }
+    return i == part.size();
+}
+
+// The same items gained and lost as the multiset difference, each in the
+// order its list has them.
+template<class U>
+void checkDelta(std::vector<U> const & before, std::vector<U> const & after)
+{
+    ItemDelta<U> d = itemDelta(before, after);
+    CHECK(sorted(d.added) == without(after, before));
+    CHECK(sorted(d.removed) == without(before, after));
+    CHECK(isSubsequence(d.added, after));
+    CHECK(isSubsequence(d.removed, before));
+}
+
+void testItemDelta()
+{
+    typedef std::vector<int> V;
+    checkDelta(V(), V());
+    checkDelta(V({ 1, 2, 3 }), V({ 1, 2, 3 }));
+    checkDelta(V({ 1, 2, 3 }), V({ 0, 1, 2, 3 }));
+    checkDelta(V({ 1, 2, 3 }), V({ 2, 3 }));
+    // Reordered: nothing gained or lost.
+    checkDelta(V({ 1, 2, 3, 4 }), V({ 4, 3, 2, 1 }));
+    CHECK(itemDelta(V({ 1, 2, 3, 4 }), V({ 4, 3, 2, 1 })).added.empty());
+    // Repeats count: one more 2 and one fewer 3.
+    ItemDelta<int> d = itemDelta(V({ 2, 3, 3, 5 }), V({ 3, 2, 2, 5 }));
+    CHECK(d.added == V({ 2 }) && d.removed == V({ 3 }));
+
+    // Long lists go through the sorted match, short ones and items with no
+    // < through the pairwise one; all agree with the multiset difference.
+    std::mt19937 rng(53);
+    for (std::size_t n : { std::size_t(3), diffs::kPairwise, diffs::kPairwise + 1, std::size_t(200), std::size_t(3000) }){
+        for (int trial = 0; trial < 5; ++trial){
+            V before, after;
+            for (std::size_t i = 0; i < n; ++i){
+                before.push_back(rng() % (n / 2 + 2));
+            }
+            after = before;
+            std::shuffle(after.begin() + after.size() / 4, after.end() - after.size() / 4, rng);
+            for (std::size_t i = 0; i < n / 10 + 1; ++i){
+                after[rng() % n] = rng() % n;
+            }
+            after.push_back(rng() % n);
+            checkDelta(before, after);
+            checkDelta(after, before);
+
+            std::vector<Tag> tb, ta;
+            for (int u : before){
+                tb.push_back(Tag{ std::to_string(u) });
+            }
+            for (int u : after){
+                ta.push_back(Tag{ std::to_string(u) });
+            }
+            checkDelta(tb, ta);
+        }
+    }
+
+    // Item lists of the tree itself.
+    Tree t = Tree().insert(1, 5).insert(1, 6).insert(1, 6);
+    Tree u = t.remove(1, 6).insert(1, 7);
+    d = itemDelta(t.getItems(1), u.getItems(1));
+    CHECK(d.added == V({ 7 }) && d.removed == V({ 6 }));
+}
+
+} // namespace
+
+int main()
+{
+    testDiff();
+    testRandomVersions();
+    testItemDelta();
+    return checkResult();
+}
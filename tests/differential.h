@@ -0,0 +1,176 @@
+//
+//  differential.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__differential__
+#define __rbtree__differential__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rbtree.h"
+
+// Runs a sequence of updates on an RBTree and on a std::multimap side by side,
+// checking after every step that the tree is a valid red-black tree, that
+// it holds what the multimap does, that lookups agree, and that the last
+// few versions it replaced still hold what they did. Used by the
+// differential test and the libFuzzer target alike; both drive it with
+// bytes, three per step.
+template<class Policy = DefaultPolicy>
+class Differential
+{
+public:
+    typedef RBTree<int, int, Policy> Tree;
+    typedef std::multimap<int, int> Model;
+
+    // Small key and item ranges, so that steps keep hitting the same keys.
+    static const int kKeys = 64;
+    static const int kItems = 8;
+    static const std::size_t kKept = 8;
+
+    Differential() : steps_(0) {}
+
+    // Applies one step; false, with failure() saying why, once anything
+    // disagrees.
+    bool step(std::uint8_t op, std::uint8_t key, std::uint8_t item)
+    {
+        int k = key % kKeys, u = item % kItems;
+        kept_.push_back(std::make_pair(tree_, model_));
+        if (kept_.size() > kKept)
+            kept_.pop_front();
+        switch (op % 4){
+            case 0:
+                tree_ = tree_.remove(k);
+                model_.erase(k);
+                break;
+            case 1:
+                tree_ = tree_.remove(k, u);
+                eraseOne(k, u);
+                break;
+            default:
+                tree_ = tree_.insert(k, u);
+                model_.emplace(k, u);
+        }
+        ++steps_;
+        return check(k);
+    }
+
+    bool run(std::uint8_t const * data, std::size_t size)
+    {
+        for (std::size_t i = 0; i + 3 <= size; i += 3){
+            if (!step(data[i], data[i + 1], data[i + 2]))
+                return false;
+        }
+        return true;
+    }
+
+    std::string const & failure() const
+    {
+        return failure_;
+    }
+
+    Tree const & tree() const
+    {
+        return tree_;
+    }
+
+private:
+    void eraseOne(int k, int u)
+    {
+        auto r = model_.equal_range(k);
+        for (auto it = r.first; it != r.second; ++it){
+            if (it->second == u){
+                model_.erase(it);
+                return;
+            }
+        }
+    }
+
+    static std::vector<int> sorted(std::vector<int> v)
+    {
+        std::sort(v.begin(), v.end());
+        return v;
+    }
+
+    // Item order differs between the two (the tree puts new items first), so
+    // items are compared as multisets.
+    static bool same(Tree const & t, Model const & m)
+    {
+        auto it = t.begin();
+        auto mt = m.begin();
+        while (mt != m.end()){
+            if (it == t.end() || it->value() != mt->first)
+                return false;
+            auto r = m.equal_range(mt->first);
+            std::vector<int> want;
+            for (; r.first != r.second; ++r.first){
+                want.push_back(r.first->second);
+            }
+            if (sorted(std::vector<int>(it->items().begin(), it->items().end())) != sorted(want))
+                return false;
+            mt = r.second;
+            ++it;
+        }
+        return it == t.end();
+    }
+
+    bool fail(char const * what)
+    {
+        failure_ = std::string(what) + " after step " + std::to_string(steps_);
+        return false;
+    }
+
+    bool check(int k)
+    {
+        if (!tree_.isValid())
+            return fail("red-black invariants broken");
+        if (!same(tree_, model_))
+            return fail("contents differ from std::multimap");
+        if (tree_.member(k) != (model_.count(k) > 0))
+            return fail("member() disagrees");
+        if (tree_.getItems(k).size() != model_.count(k))
+            return fail("getItems() disagrees");
+        if constexpr (Policy::orderStatistics){
+            if (tree_.totalItems() != model_.size())
+                return fail("totalItems() disagrees");
+            std::size_t keys = 0, below = 0;
+            for (auto it = model_.begin(); it != model_.end(); it = model_.upper_bound(it->first)){
+                below += it->first < k;
+                ++keys;
+            }
+            if (tree_.size() != keys)
+                return fail("size() disagrees");
+            if (tree_.rank(k) != below)
+                return fail("rank() disagrees");
+            auto at = tree_.select(below);
+            if (model_.count(k) ? at == tree_.end() || at->value() != k : at != tree_.lower_bound(k))
+                return fail("select() disagrees");
+        }
+        auto above = model_.upper_bound(k);
+        typename Tree::Contents next = tree_.getNodeJustGreaterThan(k);
+        if (above == model_.end() ? !next.items().isEmpty() : next.value() != above->first)
+            return fail("getNodeJustGreaterThan() disagrees");
+        for (auto const & v : kept_){
+            if (!v.first.isValid() || !same(v.first, v.second))
+                return fail("an earlier version changed");
+        }
+        return true;
+    }
+
+    Tree tree_;
+    Model model_;
+    std::deque<std::pair<Tree, Model>> kept_;
+    std::size_t steps_;
+    std::string failure_;
+};
+
+#endif /* defined(__rbtree__differential__) */
@@ -0,0 +1,59 @@
+//
+//  differential_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "differential.h"
+
+namespace {
+
+// Long random runs, each from its own seed so a failure can be replayed.
+template<class Policy>
+void runSeeds(char const * name, int seeds, int steps)
+{
+    for (int seed = 0; seed < seeds; ++seed){
+        std::mt19937 rng(seed);
+        std::vector<std::uint8_t> bytes(3 * steps);
+        for (std::uint8_t & b : bytes){
+            b = static_cast<std::uint8_t>(rng());
+        }
+        Differential<Policy> d;
+        bool ok = d.run(bytes.data(), bytes.size());
+        if (!ok)
+            std::fprintf(stderr, "%s seed %d: %s\n", name, seed, d.failure().c_str());
+        CHECK(ok);
+    }
+}
+
+// Edge cases the random runs are unlikely to hit in this order.
+void runEdges()
+{
+    Differential<DefaultPolicy> d;
+    CHECK(d.step(0, 1, 0));    // remove from an empty tree
+    CHECK(d.step(1, 1, 0));    // remove an item from an empty tree
+    CHECK(d.step(2, 1, 3));
+    CHECK(d.step(1, 1, 4));    // remove an item the key does not have
+    CHECK(d.step(1, 2, 3));    // remove an item under a missing key
+    CHECK(d.step(1, 1, 3));    // remove the last item, and with it the key
+    CHECK(d.tree().isEmpty());
+}
+
+} // namespace
+
+int main()
+{
+    runEdges();
+    runSeeds<DefaultPolicy>("default", 20, 2000);
+    runSeeds<HeapPolicy>("heap", 5, 2000);
+    runSeeds<LocalPolicy>("local", 5, 2000);
+    runSeeds<OrderStatPolicy>("order statistics", 5, 2000);
+    return checkResult();
+}
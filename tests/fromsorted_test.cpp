@@ -0,0 +1,74 @@
+//
+//  fromsorted_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+typedef std::vector<std::pair<int, Tree::ItemList>> Sorted;
+
+Sorted sorted(int n)
+{
+    Sorted v;
+    for (int i = 0; i < n; ++i){
+        v.push_back(std::make_pair(3 * i, i % 5 ? Tree::ItemList({ i }) : Tree::ItemList({ i, -i })));
+    }
+    return v;
+}
+
+// Sizes around the powers of two, where the red bottom level starts and
+// stops, and ones large enough to fork at the grains used.
+void testSizes()
+{
+    std::vector<int> sizes = { 0, 1, 2, 3, 4, 7, 8, 9, 15, 16, 17, 100, 1023, 1024, 1025, 5000, 200000 };
+    for (int n : sizes){
+        Sorted v = sorted(n);
+        Tree one = Tree::fromSorted(v.begin(), v.end());
+        CHECK(one.isValid());
+        Tree inserted;
+        for (auto it = v.rbegin(); it != v.rend(); ++it){
+            for (int u : it->second){
+                inserted = inserted.insert(it->first, u);
+            }
+        }
+        CHECK(contents(one) == contents(inserted));
+        // Grain 0 is fromSorted itself; the others fork at every range
+        // longer than the grain, down to very short ones.
+        for (std::size_t grain : { std::size_t(1), std::size_t(16), std::size_t(4096), std::size_t(1) << 16 }){
+            Tree par = Tree::fromSortedParallel(v.begin(), v.end(), grain);
+            CHECK(par.isValid());
+            CHECK(par.blackHeight() == one.blackHeight());
+            CHECK(exactly(par) == exactly(one));
+        }
+    }
+}
+
+// Input iterators that are not random access are copied first.
+void testListInput()
+{
+    Sorted v = sorted(3000);
+    std::list<std::pair<int, Tree::ItemList>> l(v.begin(), v.end());
+    Tree a = Tree::fromSortedParallel(l.begin(), l.end(), 64);
+    CHECK(a.isValid());
+    CHECK(exactly(a) == exactly(Tree::fromSorted(v.begin(), v.end())));
+}
+
+} // namespace
+
+int main()
+{
+    testSizes();
+    testListInput();
+    return checkResult();
+}
@@ -0,0 +1,46 @@
+//
+//  rbtree_fuzz.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+// libFuzzer target for the differential harness. Built with
+// -DRBTREE_FUZZER=ON under Clang it links against libFuzzer; otherwise it
+// gets a main() that replays the inputs named on the command line, so a
+// crashing input can be debugged with any compiler.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "differential.h"
+
+extern "C" int LLVMFuzzerTestOneInput(std::uint8_t const * data, std::size_t size)
+{
+    Differential<DefaultPolicy> d;
+    if (!d.run(data, size)){
+        std::fprintf(stderr, "%s\n", d.failure().c_str());
+        std::abort();
+    }
+    return 0;
+}
+
+#ifndef RBTREE_LIBFUZZER
+int main(int argc, char ** argv)
+{
+    for (int i = 1; i < argc; ++i){
+        std::ifstream in(argv[i], std::ios::binary);
+        if (!in){
+            std::fprintf(stderr, "cannot read %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(reinterpret_cast<std::uint8_t const *>(bytes.data()), bytes.size());
+    }
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,50 @@
+//
+//  history_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include "check.h"
+#include "rbtree.h"
+#include "history.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+std::size_t count(Tree const & t)
+{
+    std::size_t n = 0;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        ++n;
+    }
+    return n;
+}
+
+void testHistory()
+{
+    VersionHistory<int, int> h;
+    Tree t;
+    for (int i = 0; i < 10; ++i){
+        t = t.insert(i, i);
+        h.commit(t);
+    }
+    CHECK(h.size() == 10);
+    CHECK(count(h.at(3)) == 3);
+    CHECK(count(h.current()) == 10);
+    VersionHistory<int, int>::Sharing s = h.sharing();
+    CHECK(s.versions == 10);
+    CHECK(s.distinctNodes < s.logicalNodes);
+    h.keepLast(2);
+    CHECK(h.oldest() == 9);
+    CHECK(!h.contains(3));
+}
+
+} // namespace
+
+int main()
+{
+    testHistory();
+    return checkResult();
+}
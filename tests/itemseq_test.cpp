@@ -0,0 +1,47 @@
+//
+//  itemseq_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "itemseq.h"
+
+namespace {
+
+template<class U, std::size_t N, class A, class C>
+std::vector<U> toVector(ItemSeq<U, N, A, C> const & s)
+{
+    return std::vector<U>(s.begin(), s.end());
+}
+
+void testItemSeq()
+{
+    typedef ItemSeq<std::string, 4, PoolAllocator<std::string>, AtomicCount> Seq;
+    Seq s;
+    std::vector<std::string> expect;
+    for (int i = 0; i < 50; ++i){
+        s = s.push_front(std::to_string(i));
+        expect.insert(expect.begin(), std::to_string(i));
+    }
+    CHECK(s.size() == 50);
+    CHECK(toVector(s) == expect);
+    Seq t = s.remove("25");
+    CHECK(t.size() == 49);
+    CHECK(!t.contains("25"));
+    CHECK(s.contains("25"));
+    CHECK(s.remove("missing").size() == 50);
+    CHECK(s.emplace_front(3, 'x').front() == "xxx");
+}
+
+} // namespace
+
+int main()
+{
+    testItemSeq();
+    return checkResult();
+}
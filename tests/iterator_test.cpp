@@ -0,0 +1,163 @@
+//
+//  iterator_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <iterator>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "check.h"
+#include "rbtree.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+template<class It>
+std::vector<int> keys(It first, It last)
+{
+    std::vector<int> v;
+    for (; first != last; ++first){
+        v.push_back(first->value());
+    }
+    return v;
+}
+
+// Keys walked backwards from last, which is decremented first.
+template<class It>
+std::vector<int> keysBackwards(It first, It last)
+{
+    std::vector<int> v;
+    while (last != first){
+        --last;
+        v.push_back(last->value());
+    }
+    return v;
+}
+
+void testReverse()
+{
+    std::mt19937 rng(17);
+    Tree t;
+    std::set<int> model;
+    for (int i = 0; i < 3000; ++i){
+        int k = rng() % 5000;
+        if (rng() % 4 == 0){
+            t = t.remove(k);
+            model.erase(k);
+        } else {
+            t = t.insert(k, i);
+            model.insert(k);
+        }
+    }
+    std::vector<int> forward(model.begin(), model.end());
+    std::vector<int> backward(model.rbegin(), model.rend());
+    CHECK(keys(t.begin(), t.end()) == forward);
+    CHECK(keysBackwards(t.begin(), t.end()) == backward);
+    std::vector<int> viaReverse;
+    for (auto it = std::make_reverse_iterator(t.end()); it != std::make_reverse_iterator(t.begin()); ++it){
+        viaReverse.push_back(it->value());
+    }
+    CHECK(viaReverse == backward);
+
+    // Back and forth from the middle, and the postfix forms.
+    Tree::const_iterator it = t.lower_bound(2500);
+    int k = it->value();
+    Tree::const_iterator old = it++;
+    CHECK(old->value() == k);
+    CHECK((it--)->value() == *model.upper_bound(k));
+    CHECK(it->value() == k);
+    CHECK((--it)->value() == *std::prev(model.find(k)));
+    CHECK((++it)->value() == k);
+    CHECK(std::distance(t.begin(), t.end()) == static_cast<std::ptrdiff_t>(model.size()));
+
+    // Copies walk on independently of the original.
+    Tree::const_iterator a = t.begin(), b = a;
+    ++b;
+    CHECK(a->value() == forward[0] && b->value() == forward[1]);
+    a = b;
+    ++b;
+    CHECK(a->value() == forward[1] && b->value() == forward[2]);
+
+    Tree one = { { 5, 1 } };
+    CHECK((--one.end())->value() == 5);
+    CHECK(--one.end() == one.begin());
+    CHECK(++one.begin() == one.end());
+}
+
+void testBounds()
+{
+    Tree t;
+    CHECK(t.lower_bound(1) == t.end());
+    CHECK(t.upper_bound(1) == t.end());
+    CHECK(t.range(0, 10).empty());
+    for (int k = 10; k <= 100; k += 10){
+        t = t.insert(k, k).insert(k, -k);
+    }
+    // Below the first key and past the last.
+    CHECK(t.lower_bound(-5) == t.begin());
+    CHECK(t.upper_bound(-5) == t.begin());
+    CHECK(t.lower_bound(101) == t.end());
+    CHECK(t.upper_bound(100) == t.end());
+    CHECK(t.lower_bound(100)->value() == 100);
+    CHECK((--t.upper_bound(100))->value() == 100);
+    // On and between keys.
+    CHECK(t.lower_bound(40)->value() == 40);
+    CHECK(t.upper_bound(40)->value() == 50);
+    CHECK(t.lower_bound(41)->value() == 50);
+    CHECK(t.upper_bound(41)->value() == 50);
+
+    auto hit = t.equal_range(30);
+    CHECK(keys(hit.first, hit.second) == std::vector<int>({ 30 }));
+    CHECK(hit.first->items().size() == 2);
+    auto miss = t.equal_range(35);
+    CHECK(miss.first == miss.second && miss.first->value() == 40);
+    auto past = t.equal_range(500);
+    CHECK(past.first == t.end() && past.second == t.end());
+    auto before = t.equal_range(0);
+    CHECK(before.first == t.begin() && before.second == t.begin());
+}
+
+void testRanges()
+{
+    Tree t;
+    for (int k = 10; k <= 100; k += 10){
+        t = t.insert(k, k);
+    }
+    Tree::Range r = t.range(25, 75);
+    CHECK(!r.empty());
+    CHECK(keys(r.begin(), r.end()) == std::vector<int>({ 30, 40, 50, 60, 70 }));
+    CHECK(keysBackwards(r.begin(), r.end()) == std::vector<int>({ 70, 60, 50, 40, 30 }));
+    CHECK(keys(t.range(30, 70).begin(), t.range(30, 70).end()) == std::vector<int>({ 30, 40, 50, 60 }));
+    CHECK(keys(t.range(0, 1000).begin(), t.range(0, 1000).end()).size() == 10);
+
+    // Empty: between two keys, at one key's half-open edge, past either
+    // end, and with the bounds equal or the wrong way round.
+    CHECK(t.range(41, 49).empty());
+    CHECK(t.range(40, 40).empty());
+    CHECK(t.range(101, 200).empty());
+    CHECK(t.range(-10, 10).empty());
+    CHECK(t.range(70, 30).empty());
+    CHECK(keys(t.range(70, 30).begin(), t.range(70, 30).end()).empty());
+
+    // A range keeps its tree alive after the tree it came from is gone.
+    Tree::Range kept = Tree(t).range(45, 65);
+    t = Tree();
+    CHECK(keys(kept.begin(), kept.end()) == std::vector<int>({ 50, 60 }));
+    Tree::Range copy = kept;
+    CHECK(keys(copy.begin(), copy.end()) == std::vector<int>({ 50, 60 }));
+}
+
+} // namespace
+
+int main()
+{
+    testReverse();
+    testBounds();
+    testRanges();
+    return checkResult();
+}
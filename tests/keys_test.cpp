@@ -0,0 +1,88 @@
+//
+//  keys_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <string>
+#include <utility>
+
+#include "check.h"
+#include "rbtree.h"
+
+namespace {
+
+// Counts how often values of the type are copied.
+struct Counted
+{
+    static int & copies()
+    {
+        static int n = 0;
+        return n;
+    }
+
+    explicit Counted(int v = 0) : v_(v) {}
+    Counted(int a, int b) : v_(a * 100 + b) {}
+    Counted(Counted const & o) : v_(o.v_) { ++copies(); }
+    Counted(Counted && o) : v_(o.v_) {}
+    Counted & operator=(Counted const & o) { v_ = o.v_; ++copies(); return *this; }
+    Counted & operator=(Counted && o) { v_ = o.v_; return *this; }
+
+    bool operator<(Counted const & o) const { return v_ < o.v_; }
+    bool operator==(Counted const & o) const { return v_ == o.v_; }
+
+    int v_;
+};
+
+void testStringKeys()
+{
+    RBTree<std::string, int> t;
+    for (int i = 0; i < 100; ++i){
+        t = t.insert("key" + std::to_string(i), i);
+    }
+    CHECK(t.isValid());
+    CHECK(t.member("key42"));
+    CHECK(t.getNodeJustGreaterThan("key42").value() == "key43");
+    // Past the last key there is no entry: no items, and a key that is
+    // default-constructed for non-arithmetic types and -1 for arithmetic ones.
+    RBTree<std::string, int>::Contents none = t.getNodeJustGreaterThan("key99");
+    CHECK(none.items().isEmpty());
+    CHECK(none.value().empty());
+    typedef RBTree<int, int> IntTree;
+    typedef RBTree<double, int> DoubleTree;
+    CHECK(IntTree().getNodeJustGreaterThan(5).value() == -1);
+    CHECK(DoubleTree().getNodeJustGreaterThan(5).value() == -1.0);
+}
+
+// New keys and items given as rvalues, or items built in place, are moved
+// into their node rather than copied.
+void testMoves()
+{
+    typedef RBTree<Counted, Counted> Tree;
+    Counted::copies() = 0;
+    Tree t = Tree().insert(Counted(1), Counted(2));
+    CHECK(Counted::copies() == 0);
+    Tree u = t.emplace(Counted(5), 3, 4);
+    // The path copy copies the root's key and item, but not the new ones.
+    CHECK(Counted::copies() == 2);
+    CHECK(u.getItems(Counted(5)).front() == Counted(304));
+    // Adding to a key copies its node, key and existing item included, and
+    // the root's; the new item is built in place.
+    Counted::copies() = 0;
+    Tree v = u.emplace(Counted(5), 7, 8);
+    CHECK(Counted::copies() == 4);
+    CHECK(v.getItems(Counted(5)).size() == 2);
+    CHECK(v.getItems(Counted(5)).front() == Counted(708));
+    CHECK(u.getItems(Counted(5)).size() == 1);
+    CHECK(v.isValid());
+}
+
+} // namespace
+
+int main()
+{
+    testStringKeys();
+    testMoves();
+    return checkResult();
+}
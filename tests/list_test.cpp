@@ -0,0 +1,62 @@
+//
+//  list_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <vector>
+
+#include "check.h"
+#include "list.h"
+
+namespace {
+
+template<class T, class A>
+std::vector<T> toVector(List<T, A> const & lst)
+{
+    std::vector<T> v;
+    forEach(lst, [&](T x){ v.push_back(x); });
+    return v;
+}
+
+void testList()
+{
+    List<int> a = List<int>().push_front(3).push_front(2).push_front(1);
+    CHECK(a.size() == 3);
+    CHECK(a.front() == 1);
+    List<int> b = a.push_front(0);
+    CHECK(toVector(b) == std::vector<int>({ 0, 1, 2, 3 }));
+    CHECK(toVector(a) == std::vector<int>({ 1, 2, 3 }));
+    CHECK(toVector(b.insertAt(2, 9)) == std::vector<int>({ 0, 1, 9, 2, 3 }));
+    CHECK(toVector(b.removeAt(3)) == std::vector<int>({ 0, 1, 2 }));
+    CHECK(toVector(b.remove(2)) == std::vector<int>({ 0, 1, 3 }));
+    CHECK(toVector(b.remove(7)) == toVector(b));
+    CHECK(List<int>().remove(7).isEmpty());
+    CHECK(toVector(concat(a, b)) == std::vector<int>({ 1, 2, 3, 0, 1, 2, 3 }));
+    CHECK(toVector(filter([](int x){ return x % 2 == 1; }, b)) == std::vector<int>({ 1, 3 }));
+    CHECK(toVector(fmap<int>([](int x){ return 10 * x; }, a)) == std::vector<int>({ 10, 20, 30 }));
+    CHECK(foldl([](int acc, int x){ return acc * 10 + x; }, 0, a) == 123);
+    CHECK(foldr([](int x, int acc){ return acc * 10 + x; }, 0, a) == 321);
+}
+
+void testLongList()
+{
+    // Long enough that recursion over it would overflow the stack.
+    List<int> big;
+    for (int i = 0; i < 1000000; ++i){
+        big = big.push_front(i);
+    }
+    CHECK(big.size() == 1000000);
+    CHECK(big.remove(0).size() == 999999);
+    CHECK(foldl([](long acc, int x){ return acc + x; }, 0L, big) == 499999500000L);
+}
+
+} // namespace
+
+int main()
+{
+    testList();
+    testLongList();
+    return checkResult();
+}
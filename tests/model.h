@@ -0,0 +1,68 @@
+//
+//  model.h
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef __rbtree__model__
+#define __rbtree__model__
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// std::multimap as the model the trees are checked against, and ways of
+// reading either side out for comparison.
+
+typedef std::multimap<int, int> Model;
+
+// Items under each key, sorted, so that item order does not matter.
+template<class Tr>
+std::map<int, std::vector<int>> contents(Tr const & t)
+{
+    std::map<int, std::vector<int>> m;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        std::vector<int> & v = m[it->value()];
+        v.assign(it->items().begin(), it->items().end());
+        std::sort(v.begin(), v.end());
+    }
+    return m;
+}
+
+inline std::map<int, std::vector<int>> contents(Model const & model)
+{
+    std::map<int, std::vector<int>> m;
+    for (auto const & p : model){
+        m[p.first].push_back(p.second);
+    }
+    for (auto & p : m){
+        std::sort(p.second.begin(), p.second.end());
+    }
+    return m;
+}
+
+// Keys and items in order, item order included.
+template<class Tr>
+std::vector<std::pair<int, std::vector<int>>> exactly(Tr const & t)
+{
+    std::vector<std::pair<int, std::vector<int>>> v;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        v.push_back(std::make_pair(it->value(), std::vector<int>(it->items().begin(), it->items().end())));
+    }
+    return v;
+}
+
+inline void eraseOne(Model & m, int k, int item)
+{
+    auto r = m.equal_range(k);
+    for (auto it = r.first; it != r.second; ++it){
+        if (it->second == item){
+            m.erase(it);
+            return;
+        }
+    }
+}
+
+#endif /* defined(__rbtree__model__) */
@@ -0,0 +1,215 @@
+//
+//  nodelog_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "check.h"
+#include "rbtree.h"
+#include "nodelog.h"
+
+namespace {
+
+typedef RBTree<std::int64_t, int> Tree;
+typedef NodeLog<std::int64_t, int> Log;
+
+char const * const kPath = "nodelog_test.log";
+
+Tree sample(int n)
+{
+    Tree t;
+    for (int i = 0; i < n; ++i){
+        t = t.insert(3 * i, i);
+        if (i % 7 == 0)
+            t = t.insert(3 * i, -i);
+    }
+    return t;
+}
+
+bool sameTree(Tree const & a, Tree const & b)
+{
+    auto i = a.begin(), j = b.begin();
+    for (; i != a.end() && j != b.end(); ++i, ++j){
+        if (i->value() != j->value())
+            return false;
+        std::vector<int> x(i->items().begin(), i->items().end());
+        std::vector<int> y(j->items().begin(), j->items().end());
+        if (x != y)
+            return false;
+    }
+    return i == a.end() && j == b.end();
+}
+
+void testNodeLog()
+{
+    char const * path = kPath;
+    std::remove(path);
+    std::vector<Tree> versions;
+    std::vector<Log::Offset> roots;
+    {
+        Log log(path);
+        Tree t = sample(500);
+        for (int v = 0; v < 50; ++v){
+            t = t.insert(v * 11, v).remove(v * 6);
+            versions.push_back(t);
+            roots.push_back(log.commit(t));
+        }
+        Tree loaded = log.load(roots[10]);
+        CHECK(sameTree(loaded, versions[10]));
+        Tree next = loaded.insert(-1, -1);
+        versions.push_back(next);
+        roots.push_back(log.commit(next));
+    }
+    // A partial record after the last commit is dropped on reopening.
+    std::FILE * f = std::fopen(path, "ab");
+    std::fputs("N\x01", f);
+    std::fclose(f);
+    Log log(path);
+    CHECK(log.commits() == roots);
+    for (std::size_t i = 0; i < roots.size(); ++i){
+        Tree t = log.load(roots[i]);
+        CHECK(t.isValid());
+        CHECK(sameTree(t, versions[i]));
+    }
+    CHECK(log.commit(Tree()) == 0);
+    CHECK(log.load(0).isEmpty());
+    std::remove(path);
+}
+
+std::vector<char> readFile()
+{
+    std::vector<char> bytes;
+    std::FILE * f = std::fopen(kPath, "rb");
+    char buf[4096];
+    std::size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0){
+        bytes.insert(bytes.end(), buf, buf + n);
+    }
+    std::fclose(f);
+    return bytes;
+}
+
+void writeFile(std::vector<char> const & bytes, std::size_t n)
+{
+    std::FILE * f = std::fopen(kPath, "wb");
+    std::fwrite(bytes.data(), 1, n, f);
+    std::fclose(f);
+}
+
+// A log of a few versions, with the versions, their roots and the size of
+// the file after each commit.
+struct Written
+{
+    std::vector<Tree> versions;
+    std::vector<Log::Offset> roots;
+    std::vector<std::size_t> ends;
+    std::vector<char> bytes;
+};
+
+Written writeLog()
+{
+    std::remove(kPath);
+    Written w;
+    {
+        Log log(kPath);
+        Tree t = sample(200);
+        for (int v = 0; v < 8; ++v){
+            t = t.insert(1000 + v, v).remove(v * 9);
+            w.versions.push_back(t);
+            w.roots.push_back(log.commit(t));
+            w.ends.push_back(readFile().size());
+        }
+    }
+    w.bytes = readFile();
+    return w;
+}
+
+// Reopens the log and checks that it holds exactly the first n commits, that
+// each reads back whole, and that it takes new ones after them.
+void checkKept(Written const & w, std::size_t n)
+{
+    {
+        Log log(kPath);
+        std::vector<Log::Offset> want(w.roots.begin(), w.roots.begin() + n);
+        CHECK(log.commits() == want);
+        for (std::size_t i = 0; i < n; ++i){
+            CHECK(sameTree(log.load(w.roots[i]), w.versions[i]));
+        }
+        Tree next = n ? w.versions[n - 1].insert(-5, 5) : sample(3);
+        log.commit(next);
+    }
+    Log log(kPath);
+    CHECK(log.commits().size() == n + 1);
+    Tree back = log.load(log.commits().back());
+    CHECK(back.isValid());
+    CHECK(sameTree(back, n ? w.versions[n - 1].insert(-5, 5) : sample(3)));
+}
+
+// A crash in the middle of a commit can leave any prefix of it on disk;
+// reopening keeps the commits before it.
+void testTornTail()
+{
+    Written w = writeLog();
+    std::size_t last = w.ends.size() - 1;
+    for (std::size_t cut = w.ends[last - 1]; cut < w.ends[last]; ++cut){
+        writeFile(w.bytes, cut);
+        checkKept(w, last);
+    }
+    // Cut inside the first commit, or back to the bare header.
+    writeFile(w.bytes, w.ends[0] - 1);
+    checkKept(w, 0);
+    writeFile(w.bytes, sizeof(nodelog::Header));
+    checkKept(w, 0);
+    std::remove(kPath);
+}
+
+// The commit record may reach the disk while some of the nodes before it do
+// not: any byte of a commit that is wrong, nodes, root or checksum, makes
+// its checksum fail, and it and everything after it are dropped.
+void testCorruptCommit()
+{
+    Written w = writeLog();
+    for (std::size_t j : { std::size_t(3), w.ends.size() - 1 }){
+        for (std::size_t at = w.ends[j - 1]; at < w.ends[j]; ++at){
+            std::vector<char> bad = w.bytes;
+            bad[at] ^= 0x20;
+            writeFile(bad, bad.size());
+            checkKept(w, j);
+        }
+    }
+    // Zeroes in place of a commit's nodes, as a file extended but not yet
+    // written reads back.
+    std::vector<char> zeroed = w.bytes;
+    std::fill(zeroed.begin() + w.ends[5], zeroed.begin() + w.ends[6] - 17, 0);
+    writeFile(zeroed, zeroed.size());
+    checkKept(w, 6);
+
+    // A damaged header is refused outright.
+    std::vector<char> header = w.bytes;
+    header[0] = 'X';
+    writeFile(header, header.size());
+    bool threw = false;
+    try {
+        Log log(kPath);
+    } catch (std::runtime_error const &) {
+        threw = true;
+    }
+    CHECK(threw);
+    std::remove(kPath);
+}
+
+} // namespace
+
+int main()
+{
+    testNodeLog();
+    testTornTail();
+    testCorruptCommit();
+    return checkResult();
+}
@@ -0,0 +1,126 @@
+//
+//  orderstat_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <random>
+#include <set>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+#include "transient.h"
+
+namespace {
+
+typedef RBTree<int, int, OrderStatPolicy> OTree;
+
+// size, totalItems, rank and select against the model, at every key and
+// every position.
+void checkAgainst(OTree const & t, Model const & m)
+{
+    std::set<int> keys;
+    for (auto const & p : m){
+        keys.insert(p.first);
+    }
+    CHECK(t.size() == keys.size());
+    CHECK(t.totalItems() == m.size());
+    std::vector<int> sorted(keys.begin(), keys.end());
+    for (std::size_t i = 0; i < sorted.size(); ++i){
+        CHECK(t.select(i)->value() == sorted[i]);
+        CHECK(t.rank(sorted[i]) == i);
+        CHECK(t.rank(sorted[i] + 1) == i + 1);
+    }
+    CHECK(t.select(sorted.size()) == t.end());
+    CHECK(t.rank(-1) == 0);
+}
+
+void testFromSorted()
+{
+    std::vector<std::pair<int, OTree::ItemList>> sorted;
+    for (int i = 0; i < 1000; ++i){
+        sorted.push_back(std::make_pair(2 * i, OTree::ItemList({ i })));
+    }
+    OTree t = OTree::fromSorted(sorted.begin(), sorted.end());
+    CHECK(t.isValid());
+    CHECK(t.size() == 1000);
+    CHECK(t.totalItems() == 1000);
+    CHECK(t.rank(500) == 250);
+    CHECK(t.select(10)->value() == 20);
+    CHECK(t.select(1000) == t.end());
+    CHECK(OTree().size() == 0 && OTree().totalItems() == 0);
+    CHECK(OTree().select(0) == OTree().end());
+}
+
+// Random updates, so that the counts are kept through every balance and
+// bubble case rather than only through a perfectly built tree.
+void testUpdates()
+{
+    std::mt19937 rng(19);
+    OTree t;
+    Model m;
+    std::vector<std::pair<OTree, Model>> old;
+    for (int step = 0; step < 6000; ++step){
+        int k = rng() % 400, item = rng() % 4;
+        switch (rng() % 4){
+            case 0:
+                t = t.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                t = t.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                t = t.insert(k, item);
+                m.emplace(k, item);
+        }
+        CHECK(t.size() == contents(m).size());
+        CHECK(t.totalItems() == m.size());
+        if (step % 500 == 0){
+            checkAgainst(t, m);
+            old.push_back(std::make_pair(t, m));
+        }
+    }
+    checkAgainst(t, m);
+    for (auto const & v : old){
+        checkAgainst(v.first, v.second);
+    }
+}
+
+void testTransient()
+{
+    std::mt19937 rng(23);
+    OTree::Transient tr((OTree()));
+    Model m;
+    for (int step = 0; step < 4000; ++step){
+        int k = rng() % 400, item = rng() % 4;
+        switch (rng() % 4){
+            case 0:
+                tr.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                tr.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                tr.insert(k, item);
+                m.emplace(k, item);
+        }
+    }
+    checkAgainst(tr.persistent(), m);
+}
+
+} // namespace
+
+int main()
+{
+    testFromSorted();
+    testUpdates();
+    testTransient();
+    return checkResult();
+}
@@ -0,0 +1,128 @@
+//
+//  rbtree_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+void testAgainstMultimap()
+{
+    std::mt19937 rng(7);
+    Tree t;
+    Model m;
+    std::vector<std::pair<Tree, Model>> old;
+    for (int step = 0; step < 4000; ++step){
+        int k = rng() % 200, item = rng() % 4;
+        switch (rng() % 4){
+            case 0:
+                t = t.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                t = t.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                t = t.insert(k, item);
+                m.emplace(k, item);
+        }
+        CHECK(t.isValid());
+        if (step % 400 == 0)
+            old.push_back(std::make_pair(t, m));
+    }
+    CHECK(contents(t) == contents(m));
+    // Earlier versions are unchanged by everything since.
+    for (auto const & v : old){
+        CHECK(contents(v.first) == contents(v.second));
+    }
+    for (int k = 0; k < 200; ++k){
+        CHECK(t.member(k) == (m.count(k) > 0));
+        CHECK(t.getItems(k).size() == m.count(k));
+        auto above = m.upper_bound(k);
+        Tree::Contents c = t.getNodeJustGreaterThan(k);
+        if (above == m.end()){
+            CHECK(c.items().isEmpty());
+        } else {
+            CHECK(c.value() == above->first);
+        }
+    }
+}
+
+void testEmpty()
+{
+    Tree t;
+    CHECK(t.isEmpty());
+    CHECK(t.remove(1).isEmpty());
+    CHECK(t.remove(1, 2).isEmpty());
+    CHECK(!t.member(1));
+    CHECK(t.getItems(1).isEmpty());
+    CHECK(t.getNodeJustGreaterThan(1).items().isEmpty());
+    CHECK(t.begin() == t.end());
+}
+
+// Removing what is not there gives back the same root, so that diff and
+// VersionHistory see the versions as sharing everything.
+void testRemoveNothing()
+{
+    Tree one = Tree().insert(1, 10);
+    CHECK(one.remove(1, 11).id() == one.id());
+    CHECK(one.remove(2).id() == one.id());
+    Tree t;
+    for (int k = 0; k < 100; ++k){
+        t = t.insert(k, k).insert(k, -k);
+    }
+    for (int k : { 0, 37, 99 }){
+        CHECK(t.remove(k, 1000).id() == t.id());
+        CHECK(t.remove(k + 1000, k).id() == t.id());
+        CHECK(t.remove(k, k).id() != t.id());
+    }
+}
+
+void testBatchLookups()
+{
+    std::mt19937 rng(5);
+    Tree t;
+    for (int i = 0; i < 3000; ++i){
+        t = t.insert(rng() % 5000, i);
+    }
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; ++i){
+        keys.push_back(rng() % 6000);
+    }
+    std::vector<bool> in = t.memberBatch(keys);
+    std::vector<Tree::ItemList> items = t.getItemsBatch(keys);
+    CHECK(in.size() == keys.size() && items.size() == keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i){
+        CHECK(in[i] == t.member(keys[i]));
+        CHECK(items[i].size() == t.getItems(keys[i]).size());
+    }
+    CHECK(Tree().memberBatch(keys) == std::vector<bool>(keys.size(), false));
+    CHECK(t.memberBatch(std::vector<int>()).empty());
+
+    RBTree<std::string, int> s = { { "b", 1 }, { "d", 2 } };
+    std::vector<std::string> names = { "a", "b", "c", "d", "e" };
+    CHECK(s.memberBatch(names) == std::vector<bool>({ false, true, false, true, false }));
+}
+
+} // namespace
+
+int main()
+{
+    testAgainstMultimap();
+    testEmpty();
+    testRemoveNothing();
+    testBatchLookups();
+    return checkResult();
+}
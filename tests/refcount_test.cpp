@@ -0,0 +1,104 @@
+//
+//  refcount_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "refcount.h"
+#include "rbtree.h"
+
+namespace {
+
+template<class RC>
+struct Counted
+{
+    static void destroy(Counted * p)
+    {
+        ++destroyed();
+        delete p;
+    }
+
+    static int & destroyed()
+    {
+        static int n = 0;
+        return n;
+    }
+
+    RC refs_;
+};
+
+template<class RC>
+void testIntrusivePtr()
+{
+    typedef IntrusivePtr<Counted<RC>> Ptr;
+    int before = Counted<RC>::destroyed();
+    {
+        Ptr a(new Counted<RC>());
+        CHECK(a.unique());
+        {
+            Ptr b = a;
+            CHECK(!a.unique() && !b.unique());
+            CHECK(a->refs_.count() == 2);
+        }
+        CHECK(a.unique());
+        Ptr c = std::move(a);
+        CHECK(!a && c.unique());
+        CHECK(!Ptr().unique());
+    }
+    CHECK(Counted<RC>::destroyed() == before + 1);
+}
+
+// LocalPolicy trees share nodes between versions exactly as atomic ones do;
+// only the counts differ. Old versions must survive in-place updates of
+// uniquely held roots.
+void testLocalPolicy()
+{
+    typedef RBTree<int, int, LocalPolicy> LTree;
+    typedef RBTree<int, int> Tree;
+    std::mt19937 rng(13);
+    LTree l;
+    Tree t;
+    std::vector<std::pair<LTree, Tree>> old;
+    for (int step = 0; step < 3000; ++step){
+        int k = rng() % 100, item = rng() % 4;
+        if (rng() % 3 == 0){
+            l = l.remove(k, item);
+            t = t.remove(k, item);
+        } else {
+            l = l.insert(k, item);
+            t = t.insert(k, item);
+        }
+        CHECK(l.isValid());
+        if (step % 300 == 0)
+            old.push_back(std::make_pair(l, t));
+    }
+    old.push_back(std::make_pair(l, t));
+    for (auto const & v : old){
+        auto i = v.first.begin();
+        auto j = v.second.begin();
+        for (; i != v.first.end() && j != v.second.end(); ++i, ++j){
+            CHECK(i->value() == j->value());
+            CHECK(std::vector<int>(i->items().begin(), i->items().end()) ==
+                  std::vector<int>(j->items().begin(), j->items().end()));
+        }
+        CHECK(i == v.first.end() && j == v.second.end());
+    }
+    for (int k = 0; k < 100; ++k){
+        CHECK(l.member(k) == t.member(k));
+    }
+}
+
+} // namespace
+
+int main()
+{
+    testIntrusivePtr<AtomicCount>();
+    testIntrusivePtr<LocalCount>();
+    testLocalPolicy();
+    return checkResult();
+}
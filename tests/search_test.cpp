@@ -0,0 +1,130 @@
+//
+//  search_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "search.h"
+
+// Built twice: as search_test with the default flags, and where the compiler
+// takes -mavx2 as search_avx2_test, which defines RBTREE_EXPECT_AVX2 and
+// goes through the vector counts.
+
+namespace {
+
+template<class T>
+void checkRanks(std::vector<T> const & keys, std::size_t first, std::size_t n, T const & x)
+{
+    T const * k = keys.data() + first;
+    std::size_t lo = std::lower_bound(k, k + n, x) - k;
+    std::size_t hi = std::upper_bound(k, k + n, x) - k;
+    CHECK((search::rank<false>(k, n, x) == lo));
+    CHECK((search::rank<true>(k, n, x) == hi));
+}
+
+// Every block length up to a few times kLinear, so that the narrowing loop
+// runs zero, one and several times and the vector count meets blocks that
+// are and are not a whole number of vectors, at every offset within a
+// vector. Keys repeat, and are looked up at, between and beyond themselves.
+template<class T>
+void testType(std::mt19937 & rng, T spread)
+{
+    std::size_t const maxN = 3 * search::kLinear + 5;
+    for (std::size_t n = 0; n <= maxN; ++n){
+        for (std::size_t first = 0; first < 3; ++first){
+            std::vector<T> keys;
+            for (std::size_t i = 0; i < first + n; ++i){
+                keys.push_back(static_cast<T>(static_cast<T>(rng() % 64) - spread));
+            }
+            std::sort(keys.begin() + first, keys.end());
+            T lowest = std::numeric_limits<T>::lowest(), highest = std::numeric_limits<T>::max();
+            std::vector<T> probes = { lowest, highest, static_cast<T>(-spread - 1), static_cast<T>(64) };
+            for (std::size_t i = first; i < keys.size(); ++i){
+                probes.push_back(keys[i]);
+                probes.push_back(static_cast<T>(keys[i] + 1));
+                probes.push_back(static_cast<T>(keys[i] - 1));
+            }
+            for (T const & x : probes){
+                checkRanks(keys, first, n, x);
+            }
+        }
+    }
+}
+
+template<class T>
+void testFloating(std::mt19937 & rng)
+{
+    testType<T>(rng, 32);
+    // Halves between whole keys, and the infinities.
+    std::vector<T> keys;
+    for (std::size_t i = 0; i < 2 * search::kLinear + 3; ++i){
+        keys.push_back(static_cast<T>(static_cast<int>(rng() % 100) - 50));
+    }
+    std::sort(keys.begin(), keys.end());
+    for (std::size_t n : { search::kLinear - 1, search::kLinear, search::kLinear + 1, keys.size() }){
+        for (int h = -103; h <= 103; ++h){
+            checkRanks(keys, 0, n, static_cast<T>(h / T(2)));
+        }
+        checkRanks(keys, 0, n, std::numeric_limits<T>::infinity());
+        checkRanks(keys, 0, n, -std::numeric_limits<T>::infinity());
+    }
+}
+
+void testTypes()
+{
+    std::mt19937 rng(43);
+    testType<std::int32_t>(rng, 32);
+    testType<std::int64_t>(rng, 32);
+    testType<long long>(rng, 32);
+    testType<std::uint32_t>(rng, 0);
+    testType<short>(rng, 32);
+    testFloating<float>(rng);
+    testFloating<double>(rng);
+    // Keys at the far ends of the range, where a subtraction would overflow.
+    std::vector<std::int64_t> wide = { std::numeric_limits<std::int64_t>::min(), -1, 0, 1,
+                                       std::numeric_limits<std::int64_t>::max() };
+    for (std::int64_t x : wide){
+        checkRanks(wide, 0, wide.size(), x);
+    }
+}
+
+void testOtherKeys()
+{
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100; ++i){
+        keys.push_back(std::to_string(1000 + 2 * (i / 2)));
+    }
+    for (std::size_t n : { std::size_t(0), search::kLinear, keys.size() }){
+        checkRanks(keys, 0, n, std::string("1040"));
+        checkRanks(keys, 0, n, std::string("1041"));
+        checkRanks(keys, 0, n, std::string("0"));
+        checkRanks(keys, 0, n, std::string("2"));
+    }
+}
+
+} // namespace
+
+int main()
+{
+#if defined(RBTREE_EXPECT_AVX2)
+#if !defined(__AVX2__)
+    CHECK(!"built for AVX2 without __AVX2__");
+    return checkResult();
+#else
+    if (!__builtin_cpu_supports("avx2"))
+        return 77; // skipped, as ctest reads it
+#endif
+#endif
+    testTypes();
+    testOtherKeys();
+    return checkResult();
+}
@@ -0,0 +1,163 @@
+//
+//  setops_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+#include "setops.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+typedef std::map<int, std::vector<int>> Entries;
+
+Entries entries(Tree const & t)
+{
+    Entries m;
+    for (auto const & p : exactly(t)){
+        m[p.first] = p.second;
+    }
+    return m;
+}
+
+// n keys drawn from [0, range), each with one to three items.
+Tree randomTree(std::mt19937 & rng, int n, int range)
+{
+    Tree t;
+    for (int i = 0; i < n; ++i){
+        int k = rng() % range;
+        t = t.insert(k, static_cast<int>(rng() % 100));
+        if (rng() % 3 == 0)
+            t = t.insert(k, static_cast<int>(rng() % 100));
+    }
+    return t;
+}
+
+// Not symmetric in its arguments, so a merge applied the wrong way round
+// shows.
+struct FirstOfEach
+{
+    Tree::ItemList operator()(Tree::ItemList const & a, Tree::ItemList const & b) const
+    {
+        return Tree::ItemList({ 1000 * a.front() + b.front() });
+    }
+};
+
+void checkSetOps(Tree const & a, Tree const & b)
+{
+    Entries ea = entries(a), eb = entries(b);
+    Entries u = ea, i, d;
+    Entries um = ea, im;
+    for (auto const & p : eb){
+        auto in = ea.find(p.first);
+        if (in == ea.end()){
+            u[p.first] = p.second;
+            um[p.first] = p.second;
+        } else {
+            std::vector<int> both = in->second;
+            both.insert(both.end(), p.second.begin(), p.second.end());
+            u[p.first] = both;
+            i[p.first] = both;
+            um[p.first] = { 1000 * in->second.front() + p.second.front() };
+            im[p.first] = um[p.first];
+        }
+    }
+    for (auto const & p : ea){
+        if (!eb.count(p.first))
+            d[p.first] = p.second;
+    }
+
+    Tree tu = setUnion(a, b), ti = setIntersection(a, b), td = setDifference(a, b);
+    CHECK(tu.isValid() && ti.isValid() && td.isValid());
+    CHECK(entries(tu) == u);
+    CHECK(entries(ti) == i);
+    CHECK(entries(td) == d);
+    Tree mu = setUnion(a, b, FirstOfEach()), mi = setIntersection(a, b, FirstOfEach());
+    CHECK(mu.isValid() && mi.isValid());
+    CHECK(entries(mu) == um);
+    CHECK(entries(mi) == im);
+    // The arguments are left as they were.
+    CHECK(entries(a) == ea && entries(b) == eb);
+}
+
+void testSetOps()
+{
+    std::mt19937 rng(37);
+    // Equal sizes, very different sizes, empty sides, disjoint ranges, and
+    // small key ranges where nearly every key collides.
+    std::vector<std::vector<int>> shapes = {
+        { 500, 500, 1000 }, { 2000, 20, 3000 }, { 20, 2000, 3000 },
+        { 0, 300, 500 }, { 300, 0, 500 }, { 400, 400, 50 }, { 5000, 5000, 20000 }
+    };
+    for (auto const & s : shapes){
+        Tree a = randomTree(rng, s[0], s[2]), b = randomTree(rng, s[1], s[2]);
+        checkSetOps(a, b);
+        checkSetOps(b, a);
+        checkSetOps(a, a);
+    }
+    Tree low = randomTree(rng, 300, 1000), high;
+    for (int k = 2000; k < 2300; ++k){
+        high = high.insert(k, k);
+    }
+    checkSetOps(low, high);
+    checkSetOps(high, low);
+}
+
+void testSplitJoin()
+{
+    std::mt19937 rng(41);
+    for (int n : { 0, 1, 2, 10, 100, 3000 }){
+        Tree t = randomTree(rng, n, 4 * n + 1);
+        Entries et = entries(t);
+        for (int trial = 0; trial < 20; ++trial){
+            int k = rng() % (4 * n + 3) - 1;
+            SplitResult<Tree> s = split(t, k);
+            // The two sides may come out with red roots.
+            CHECK(setops::blacken(s.left).isValid() && setops::blacken(s.right).isValid());
+            Entries el = entries(s.left), er = entries(s.right);
+            CHECK(el.empty() || el.rbegin()->first < k);
+            CHECK(er.empty() || k < er.begin()->first);
+            CHECK(s.found == (et.count(k) > 0));
+            CHECK(el.size() + er.size() + s.found == et.size());
+            if (s.found){
+                CHECK(std::vector<int>(s.items.begin(), s.items.end()) == et[k]);
+                Tree back = setops::blacken(join(s.left, k, s.items, s.right));
+                CHECK(back.isValid());
+                CHECK(entries(back) == et);
+            } else {
+                Tree back = setops::blacken(setops::join2(s.left, s.right));
+                CHECK(back.isValid());
+                CHECK(entries(back) == et);
+            }
+        }
+    }
+
+    // Joins of trees of very different heights.
+    Tree small = randomTree(rng, 3, 10), big;
+    for (int k = 100; k < 20000; ++k){
+        big = big.insert(k, k);
+    }
+    Tree j = setops::blacken(join(small, 50, Tree::ItemList({ 5 }), big));
+    CHECK(j.isValid());
+    CHECK(entries(j).size() == entries(small).size() + 1 + 19900);
+    j = setops::blacken(join(big, 30000, Tree::ItemList({ 5 }), Tree()));
+    CHECK(j.isValid());
+    CHECK((--j.end())->value() == 30000);
+}
+
+} // namespace
+
+int main()
+{
+    testSetOps();
+    testSplitJoin();
+    return checkResult();
+}
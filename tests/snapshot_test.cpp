@@ -0,0 +1,238 @@
+//
+//  snapshot_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "check.h"
+#include "rbtree.h"
+#include "snapshot.h"
+
+namespace {
+
+typedef RBTree<std::int64_t, int> Tree;
+typedef MappedSnapshot<std::int64_t, int> Mapped;
+
+char const * const kPath = "snapshot_test.snap";
+
+Tree sample(int n)
+{
+    Tree t;
+    for (int i = 0; i < n; ++i){
+        t = t.insert(3 * i, i);
+        if (i % 7 == 0)
+            t = t.insert(3 * i, -i);
+    }
+    return t;
+}
+
+std::vector<int> itemsOf(Mapped::Items const & items)
+{
+    return std::vector<int>(items.begin(), items.end());
+}
+
+bool sameTree(Tree const & a, Tree const & b)
+{
+    auto i = a.begin(), j = b.begin();
+    for (; i != a.end() && j != b.end(); ++i, ++j){
+        if (i->value() != j->value())
+            return false;
+        std::vector<int> x(i->items().begin(), i->items().end());
+        std::vector<int> y(j->items().begin(), j->items().end());
+        if (x != y)
+            return false;
+    }
+    return i == a.end() && j == b.end();
+}
+
+bool fileExists(char const * path)
+{
+    std::FILE * f = std::fopen(path, "rb");
+    if (f)
+        std::fclose(f);
+    return f != nullptr;
+}
+
+bool opens(char const * path)
+{
+    try {
+        Mapped m(path);
+        return true;
+    } catch (std::runtime_error const &) {
+        return false;
+    }
+}
+
+// Sizes on either side of a full Eytzinger tree, and big enough that the
+// lower levels of keys and spans are written out in several pieces.
+void testRoundTrip()
+{
+    for (int n : { 0, 1, 2, 3, 7, 8, 1000, 50000 }){
+        Tree t = sample(n);
+        writeSnapshot(t, kPath);
+        CHECK(!fileExists((std::string(kPath) + ".tmp").c_str()));
+        Mapped m(kPath);
+        CHECK(m.size() == static_cast<std::size_t>(n));
+        CHECK(m.isEmpty() == (n == 0));
+        CHECK(sameTree(m.toTree<DefaultPolicy>(), t));
+        for (std::int64_t k = -1; k < 3 * n + 2; k += n > 1000 ? 97 : 1){
+            CHECK(m.member(k) == t.member(k));
+            std::vector<int> want;
+            for (int u : t.getItems(k)){
+                want.push_back(u);
+            }
+            CHECK(itemsOf(m.getItems(k)) == want);
+            auto lo = m.lower_bound(k);
+            auto tlo = t.lower_bound(k);
+            CHECK(tlo == t.end() ? lo == m.end() : lo->value() == tlo->value());
+            auto hi = m.upper_bound(k);
+            auto thi = t.upper_bound(k);
+            CHECK(thi == t.end() ? hi == m.end() : hi->value() == thi->value());
+        }
+    }
+    std::remove(kPath);
+}
+
+void testRanges()
+{
+    writeSnapshot(sample(100), kPath);
+    Mapped m(kPath);
+    std::vector<std::int64_t> keys;
+    for (auto const & e : m.range(10, 31)){
+        keys.push_back(e.value());
+    }
+    CHECK(keys == std::vector<std::int64_t>({ 12, 15, 18, 21, 24, 27, 30 }));
+    CHECK(m.range(13, 15).empty());
+    CHECK(m.range(15, 15).empty());
+    // Bounds the wrong way round are empty, not a run to the end.
+    CHECK(m.range(200, 10).empty());
+    CHECK(m.range(1000, -5).empty());
+    CHECK(!m.range(-5, 1000).empty());
+    // Entries come by value, so dereferencing a temporary iterator is safe.
+    CHECK(std::next(m.begin())->value() == 3);
+    CHECK(std::next(m.begin())->items().size() == 1);
+    CHECK((*std::next(m.range(10, 31).begin(), 2)).value() == 18);
+    std::remove(kPath);
+}
+
+template<class T, class U>
+bool opensAs()
+{
+    try {
+        MappedSnapshot<T, U> m(kPath);
+        return true;
+    } catch (std::runtime_error const &) {
+        return false;
+    }
+}
+
+// A new snapshot is written beside the old one and renamed over it: a
+// mapping of the old one reads on undisturbed, and a writer given up on
+// leaves the old file as it was.
+void testReplace()
+{
+    Tree a = sample(500), b = sample(2000).insert(-7, 7);
+    writeSnapshot(a, kPath);
+    Mapped old(kPath);
+    writeSnapshot(b, kPath);
+    CHECK(sameTree(old.toTree<DefaultPolicy>(), a));
+    CHECK(sameTree(Mapped(kPath).toTree<DefaultPolicy>(), b));
+
+    {
+        SnapshotWriter<std::int64_t, int> w(kPath, 3);
+        w.add(1, std::vector<int>({ 1 }));
+        w.add(2, std::vector<int>({ 2 }));
+    }
+    CHECK(!fileExists((std::string(kPath) + ".tmp").c_str()));
+    CHECK(sameTree(Mapped(kPath).toTree<DefaultPolicy>(), b));
+
+    bool threw = false;
+    try {
+        SnapshotWriter<std::int64_t, int> w(kPath, 2);
+        w.add(5, std::vector<int>({ 1 }));
+        w.add(4, std::vector<int>({ 2 }));
+    } catch (std::logic_error const &) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(sameTree(Mapped(kPath).toTree<DefaultPolicy>(), b));
+    std::remove(kPath);
+}
+
+// Overwrites bytes of the file at offset at.
+void patch(std::uint64_t at, void const * p, std::size_t n)
+{
+    std::FILE * f = std::fopen(kPath, "r+b");
+    std::fseek(f, static_cast<long>(at), SEEK_SET);
+    std::fwrite(p, 1, n, f);
+    std::fclose(f);
+}
+
+snapshot::Header header()
+{
+    snapshot::Header h;
+    std::FILE * f = std::fopen(kPath, "rb");
+    CHECK(std::fread(&h, sizeof(h), 1, f) == 1);
+    std::fclose(f);
+    return h;
+}
+
+// Damaged files are refused when opened rather than read out of bounds.
+void testCorrupt()
+{
+    writeSnapshot(sample(100), kPath);
+    snapshot::Header h = header();
+    CHECK(opens(kPath));
+    CHECK(!opens("snapshot_test.missing"));
+    // Of another key or item type.
+    CHECK((!opensAs<std::int32_t, int>()));
+
+    // A span running past the items, and one starting past them.
+    snapshot::Span bad = { 0, h.items_ + 1 };
+    patch(h.spansAt_ + 5 * sizeof(snapshot::Span), &bad, sizeof(bad));
+    CHECK(!opens(kPath));
+    bad = { h.items_, 1 };
+    patch(h.spansAt_ + 5 * sizeof(snapshot::Span), &bad, sizeof(bad));
+    CHECK(!opens(kPath));
+    // One so long that first + count wraps round.
+    bad = { 1, ~std::uint64_t(0) };
+    patch(h.spansAt_, &bad, sizeof(bad));
+    CHECK(!opens(kPath));
+
+    // Counts in the header too big for the file, or big enough to wrap.
+    writeSnapshot(sample(100), kPath);
+    snapshot::Header big = h;
+    big.items_ = ~std::uint64_t(0) / sizeof(int) + 2;
+    patch(0, &big, sizeof(big));
+    CHECK(!opens(kPath));
+    big = h;
+    big.keys_ = h.keys_ + 1000;
+    patch(0, &big, sizeof(big));
+    CHECK(!opens(kPath));
+
+    // Cut short, down to less than a header.
+    writeSnapshot(sample(100), kPath);
+    CHECK(::truncate(kPath, static_cast<off_t>(h.itemsAt_ + 4)) == 0);
+    CHECK(!opens(kPath));
+    CHECK(::truncate(kPath, 10) == 0);
+    CHECK(!opens(kPath));
+    std::remove(kPath);
+}
+
+} // namespace
+
+int main()
+{
+    testRoundTrip();
+    testRanges();
+    testReplace();
+    testCorrupt();
+    return checkResult();
+}
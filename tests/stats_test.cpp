@@ -0,0 +1,93 @@
+//
+//  stats_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#ifndef RBTREE_STATS
+#define RBTREE_STATS
+#endif
+
+#include <thread>
+
+#include "check.h"
+#include "rbtree.h"
+#include "history.h"
+#include "stats.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+void testCounts()
+{
+    stats::Snapshot before = stats::local();
+    Tree t;
+    for (int i = 0; i < 1000; ++i){
+        t = t.insert(i, i);
+    }
+    stats::Snapshot grown = stats::local() - before;
+    CHECK(grown[stats::OPERATIONS] == 1000);
+    CHECK(grown[stats::NODES_ALLOCATED] >= 1000);
+    CHECK(grown[stats::PATH_COPIES] > 0);
+    CHECK(grown[stats::DOUBLED_RIGHT] > 0);
+    // Inserting keeps to O(log n) new nodes.
+    CHECK(grown.nodesPerOperation() < 40);
+
+    before = stats::local();
+    for (int i = 0; i < 1000; i += 2){
+        t = t.remove(i);
+    }
+    stats::Snapshot shrunk = stats::local() - before;
+    CHECK(shrunk[stats::OPERATIONS] == 500);
+    CHECK(shrunk[stats::DOUBLE_BLACKS] > 0);
+    CHECK(shrunk[stats::BUBBLES] > 0);
+    CHECK(shrunk[stats::BALANCES] > 0);
+
+    before = stats::local();
+    List<int> l;
+    for (int i = 0; i < 10; ++i){
+        l = l.push_front(i);
+    }
+    CHECK((stats::local() - before)[stats::LIST_CELLS] == 10);
+
+    before = stats::local();
+    t = t.insert(1, 1).insert(1, 2).insert(1, 3).insert(1, 4).insert(1, 5);
+    CHECK((stats::local() - before)[stats::ITEM_CHUNKS] > 0);
+}
+
+void testTotals()
+{
+    stats::Snapshot before = stats::total();
+    std::thread th([]{
+        Tree t;
+        for (int i = 0; i < 100; ++i){
+            t = t.insert(i, i);
+        }
+    });
+    th.join();
+    CHECK((stats::total() - before)[stats::OPERATIONS] == 100);
+}
+
+void testSharing()
+{
+    Tree a;
+    for (int i = 0; i < 1000; ++i){
+        a = a.insert(i, i);
+    }
+    Tree b = a.insert(5000, 1);
+    VersionHistory<int, int>::Sharing s = sharing(a, b);
+    CHECK(s.uniqueBytes < s.sharedBytes);
+    CHECK(s.sharedBytes + s.uniqueBytes == s.distinctBytes);
+}
+
+} // namespace
+
+int main()
+{
+    testCounts();
+    testTotals();
+    testSharing();
+    return checkResult();
+}
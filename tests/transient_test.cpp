@@ -0,0 +1,100 @@
+//
+//  transient_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <random>
+#include <vector>
+
+#include "check.h"
+#include "model.h"
+#include "rbtree.h"
+#include "transient.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+// Random inserts, key removes and item removes, with the tree taken out of
+// the transient at intervals and then edited further. Every tree taken out,
+// and the one the transient started from, must keep what it had.
+void testTransient()
+{
+    std::mt19937 rng(11);
+    Tree base = { { 1, 1 }, { 2, 2 } };
+    Model baseModel = { { 1, 1 }, { 2, 2 } };
+    Tree::Transient tr(base);
+    Model m = baseModel;
+    std::vector<std::pair<Tree, Model>> taken;
+    for (int i = 0; i < 4000; ++i){
+        int k = rng() % 300, item = rng() % 4;
+        switch (rng() % 4){
+            case 0:
+                tr.remove(k);
+                m.erase(k);
+                break;
+            case 1:
+                tr.remove(k, item);
+                eraseOne(m, k, item);
+                break;
+            default:
+                tr.insert(k, item);
+                m.emplace(k, item);
+        }
+        if (i % 250 == 0){
+            taken.push_back(std::make_pair(tr.persistent(), m));
+            CHECK(taken.back().first.isValid());
+        }
+    }
+    Tree t = tr.persistent();
+    CHECK(t.isValid());
+    CHECK(contents(t) == contents(m));
+    for (auto const & v : taken){
+        CHECK(v.first.isValid());
+        CHECK(contents(v.first) == contents(v.second));
+    }
+    CHECK(contents(base) == contents(baseModel));
+}
+
+// Item removes that empty a key remove it; ones naming a missing key or item
+// change nothing.
+void testRemoveItems()
+{
+    Tree::Transient tr((Tree()));
+    tr.remove(5, 1);
+    CHECK(tr.isEmpty());
+    for (int k = 0; k < 50; ++k){
+        tr.insert(k, 1);
+        tr.insert(k, 2);
+    }
+    Tree before = tr.persistent();
+    tr.remove(7, 3);
+    tr.remove(70, 1);
+    CHECK(exactly(tr.persistent()) == exactly(before));
+    for (int k = 0; k < 50; ++k){
+        tr.remove(k, 1);
+    }
+    Tree half = tr.persistent();
+    CHECK(half.isValid());
+    for (int k = 0; k < 50; ++k){
+        CHECK(half.getItems(k).size() == 1 && half.getItems(k).front() == 2);
+    }
+    for (int k = 0; k < 50; ++k){
+        tr.remove(k, 2);
+        CHECK(tr.persistent().isValid());
+    }
+    CHECK(tr.isEmpty());
+    CHECK(half.getItems(49).size() == 1);
+    CHECK(before.getItems(49).size() == 2);
+}
+
+} // namespace
+
+int main()
+{
+    testTransient();
+    testRemoveItems();
+    return checkResult();
+}
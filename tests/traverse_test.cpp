@@ -0,0 +1,125 @@
+//
+//  traverse_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+// Workers however many cores there are, so that tasks are stolen and
+// joined even on one.
+#define RBTREE_POOL_WORKERS 3
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "rbtree.h"
+#include "traverse.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+void testTraversals()
+{
+    std::vector<std::pair<int, Tree::ItemList>> sorted;
+    for (int i = 0; i < 100000; ++i){
+        sorted.push_back(std::make_pair(i, Tree::ItemList({ i, 1 })));
+    }
+    Tree t = Tree::fromSorted(sorted.begin(), sorted.end());
+
+    std::atomic<long> sum(0), entries(0);
+    parallelForEach(t, [&](int k, Tree::ItemList const & items){
+        sum += k;
+        entries += items.size();
+    });
+    CHECK(sum == 4999950000L);
+    CHECK(entries == 200000);
+
+    long total = parallelReduce(t, 0L,
+                                [](int, Tree::ItemList const & items){
+                                    long s = 0;
+                                    for (int u : items){
+                                        s += u;
+                                    }
+                                    return s;
+                                },
+                                [](long a, long b){ return a + b; });
+    CHECK(total == 4999950000L + 100000);
+
+    // Not commutative: the keys must come out in order.
+    std::string digits = parallelReduce(t.remove(10).remove(11), std::string(),
+                                        [](int k, Tree::ItemList const &){
+                                            return k < 13 ? std::to_string(k % 10) : std::string();
+                                        },
+                                        [](std::string const & a, std::string const & b){ return a + b; });
+    CHECK(digits == "01234567892");
+
+    RBTree<int, std::string> named = mapValues(t, [](int u){ return std::to_string(u); });
+    CHECK(named.isValid());
+    CHECK(named.blackHeight() == t.blackHeight());
+    std::vector<std::string> want;
+    for (int u : t.getItems(42)){
+        want.push_back(std::to_string(u));
+    }
+    auto items = named.getItems(42);
+    CHECK(std::vector<std::string>(items.begin(), items.end()) == want);
+    CHECK(mapValues(Tree(), [](int u){ return u; }).isEmpty());
+}
+
+long sumTo(long lo, long hi)
+{
+    if (hi - lo < 64){
+        long s = 0;
+        for (long i = lo; i < hi; ++i){
+            s += i;
+        }
+        return s;
+    }
+    long mid = lo + (hi - lo) / 2, l = 0, r = 0;
+    forkJoin([&]{ l = sumTo(lo, mid); }, [&]{ r = sumTo(mid, hi); });
+    return l + r;
+}
+
+// Forks nested many levels deep, from several threads outside the pool at
+// once, and a throw on either side of a fork.
+void testForkJoin()
+{
+    CHECK(TaskPool::instance().workers() == 3);
+    std::vector<long> sums(4);
+    std::vector<std::thread> callers;
+    for (std::size_t i = 0; i < sums.size(); ++i){
+        callers.emplace_back([&sums, i]{ sums[i] = sumTo(0, 200000 + i); });
+    }
+    for (std::thread & c : callers){
+        c.join();
+    }
+    for (std::size_t i = 0; i < sums.size(); ++i){
+        long n = 200000 + i;
+        CHECK(sums[i] == n * (n - 1) / 2);
+    }
+
+    for (int side = 0; side < 2; ++side){
+        bool threw = false;
+        try {
+            forkJoin([&]{ sumTo(0, 10000); if (side == 0) throw std::runtime_error("f"); },
+                     [&]{ sumTo(0, 10000); if (side == 1) throw std::runtime_error("g"); });
+        } catch (std::runtime_error const & e) {
+            threw = e.what() == std::string(side == 0 ? "f" : "g");
+        }
+        CHECK(threw);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    testTraversals();
+    testForkJoin();
+    return checkResult();
+}
@@ -0,0 +1,160 @@
+//
+//  versions_test.cpp
+//  rbtree
+//
+//  Copyright (c) 2014 J A Mark. All rights reserved.
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "pool.h"
+#include "rbtree.h"
+#include "versioned.h"
+
+namespace {
+
+typedef RBTree<int, int> Tree;
+
+Tree range(int lo, int hi)
+{
+    Tree t;
+    for (int i = lo; i < hi; ++i){
+        t = t.insert(i, i);
+    }
+    return t;
+}
+
+std::size_t count(Tree const & t)
+{
+    std::size_t n = 0;
+    for (auto it = t.begin(); it != t.end(); ++it){
+        ++n;
+    }
+    return n;
+}
+
+void testVersioned()
+{
+    VersionedRBTree<int, int> v;
+    std::atomic<bool> done(false);
+    std::atomic<int> bad(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r){
+        readers.push_back(std::thread([&]{
+            while (!done.load()){
+                Tree t = v.snapshot();
+                if (!t.isValid())
+                    ++bad;
+            }
+        }));
+    }
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; ++w){
+        writers.push_back(std::thread([&, w]{
+            for (int i = 0; i < 500; ++i){
+                v.update([&](Tree const & t){ return t.insert(w * 1000 + i, i); });
+            }
+        }));
+    }
+    for (std::thread & t : writers){
+        t.join();
+    }
+    done = true;
+    for (std::thread & t : readers){
+        t.join();
+    }
+    CHECK(bad == 0);
+    CHECK(count(v.snapshot()) == 1000);
+}
+
+// One writer and many readers. Each reader in turn lets go of the snapshot
+// it holds and takes the current one, after the writer has rewritten every
+// key since that reader's last turn. The version dropped shares nothing with
+// the newer ones, so the reader frees all of its nodes on its own thread.
+// Those blocks must find their way back to the writer: the slabs reserved
+// may grow by what the readers are allowed to keep on their free lists and
+// by the versions held at once, but not with the number of turns.
+void testReadersReturnMemory()
+{
+    const int kReaders = 32;
+    const int kKeys = 500;
+    const int kRounds = 40;
+    std::size_t live = poolStats().liveBytes;
+    VersionedRBTree<int, int> v(range(0, kKeys));
+    std::size_t versionBytes = poolStats().liveBytes - live;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    // Turns called and served; reader r's are r + 1, r + 1 + kReaders, ...
+    int turn = 0, taken = 0;
+    bool stop = false;
+    std::atomic<int> bad(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < kReaders; ++r){
+        readers.push_back(std::thread([&, r]{
+            Tree held;
+            for (int mine = r + 1; ; mine += kReaders){
+                std::unique_lock<std::mutex> g(lock);
+                changed.wait(g, [&]{ return stop || turn == mine; });
+                if (stop)
+                    return;
+                g.unlock();
+                held = v.snapshot();
+                if (count(held) != kKeys)
+                    ++bad;
+                g.lock();
+                ++taken;
+                changed.notify_all();
+            }
+        }));
+    }
+
+    PoolStats start = poolStats();
+    std::size_t afterFirst = 0;
+    for (int round = 0; round < kRounds; ++round){
+        for (int i = 0; i < kReaders; ++i){
+            for (int k = 0; k < kKeys; ++k){
+                v.update([&](Tree const & t){ return t.remove(k).insert(k, round); });
+            }
+            std::unique_lock<std::mutex> g(lock);
+            ++turn;
+            changed.notify_all();
+            changed.wait(g, [&]{ return taken == turn; });
+        }
+        if (round == 0)
+            afterFirst = poolStats().slabBytes;
+    }
+    {
+        std::lock_guard<std::mutex> g(lock);
+        stop = true;
+        changed.notify_all();
+    }
+    for (std::thread & t : readers){
+        t.join();
+    }
+    CHECK(bad == 0);
+
+    // Each reader may keep two batches of free blocks, and the writer one;
+    // a version per reader and a couple more for the writer are live.
+    std::size_t allowed = (2 * kReaders + 1) * pool::kSlabSize + (kReaders + 2) * versionBytes;
+    std::size_t grown = poolStats().slabBytes - afterFirst;
+    CHECK(grown <= allowed);
+    // The readers alone freed many times that after the first round, so
+    // hoarding it would show.
+    CHECK((kRounds - 1) * kReaders * versionBytes > 4 * allowed);
+    CHECK(poolStats().reclaimedBytes - start.reclaimedBytes > (kRounds - 1) * kReaders * versionBytes);
+}
+
+} // namespace
+
+int main()
+{
+    testVersioned();
+    testReadersReturnMemory();
+    return checkResult();
+}